@@ -0,0 +1,173 @@
+#include "balancer.h"
+
+#include <iostream>
+
+namespace vm
+{
+    Balancer::Node::Node()
+        : page_size(0), load(0), waiting(false), detached(false), arrivals() {}
+
+    Balancer::Balancer(unsigned int machine_count)
+        : _machine_count(machine_count), _nodes(), _migrations(0), _finished(false) {}
+
+    Balancer::~Balancer() {}
+
+    unsigned int Balancer::Attach(Kernel &kernel)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _nodes.push_back(Node());
+        _nodes.back().page_size = kernel.machine.mmu.GetPageSize();
+        _nodes.back().load = kernel.GetRunnableProcessCount();
+
+        return static_cast<unsigned int>(_nodes.size() - 1);
+    }
+
+    void Balancer::Detach(unsigned int machine)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        Node &node = _nodes[machine];
+        node.detached = true;
+        node.load = 0;
+
+        while (!node.arrivals.empty()) {
+            unsigned int target = FindTarget(machine);
+            if (target == machine) {
+                std::cerr << "Balancer: no machine is left to take in " << node.arrivals.front().name << "." << std::endl;
+            } else {
+                _nodes[target].arrivals.push_back(node.arrivals.front());
+                ++_nodes[target].load;
+            }
+
+            node.arrivals.pop_front();
+        }
+
+        _condition.notify_all();
+    }
+
+    void Balancer::Balance(unsigned int machine, Kernel &kernel)
+    {
+        std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+
+        TakeArrivals(machine, kernel);
+
+        Node &node = _nodes[machine];
+        node.load = kernel.GetRunnableProcessCount();
+
+        unsigned int target = FindTarget(machine);
+        if (target == machine || node.load < _nodes[target].load + MIN_IMBALANCE) {
+            return;
+        }
+
+        Kernel::Migration migration(kernel.machine.mmu);
+        if (!kernel.ExportProcess(migration)) {
+            return;
+        }
+
+        _nodes[target].arrivals.push_back(migration);
+        ++_nodes[target].load;
+        --node.load;
+
+        ++_migrations;
+
+        _condition.notify_all();
+    }
+
+    // Going idle may be the last thing the others wait for before they stop
+
+    bool Balancer::WaitForWork(unsigned int machine, Kernel &kernel)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _nodes[machine].waiting = true;
+        _nodes[machine].load = 0;
+
+        _condition.notify_all();
+
+        for (;;) {
+            TakeArrivals(machine, kernel);
+
+            if (!kernel.processes.empty()) {
+                _nodes[machine].waiting = false;
+                _nodes[machine].load = kernel.GetRunnableProcessCount();
+
+                return true;
+            }
+
+            if (_finished || IsOutOfWork()) {
+                _finished = true;
+                _condition.notify_all();
+
+                return false;
+            }
+
+            _condition.wait(lock);
+        }
+    }
+
+    unsigned long long Balancer::GetMigrationCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        return _migrations;
+    }
+
+    // A process that does not fit waits for memory to free up. On an empty
+    // machine nothing ever will.
+
+    void Balancer::TakeArrivals(unsigned int machine, Kernel &kernel)
+    {
+        std::deque<Kernel::Migration> &arrivals = _nodes[machine].arrivals;
+
+        while (!arrivals.empty()) {
+            if (!kernel.ImportProcess(arrivals.front())) {
+                if (!kernel.processes.empty()) {
+                    break;
+                }
+
+                std::cerr << "Balancer: machine " << machine << " can not take in " << arrivals.front().name << "." << std::endl;
+            }
+
+            arrivals.pop_front();
+        }
+    }
+
+    // The least busy of the other machines with the same page size, or
+    // "machine" itself when there is none
+
+    unsigned int Balancer::FindTarget(unsigned int machine) const
+    {
+        unsigned int target = machine;
+
+        for (unsigned int i = 0; i < _nodes.size(); ++i) {
+            if (i == machine || _nodes[i].detached || _nodes[i].page_size != _nodes[machine].page_size) {
+                continue;
+            }
+
+            if (target == machine || _nodes[i].load < _nodes[target].load) {
+                target = i;
+            }
+        }
+
+        return target;
+    }
+
+    bool Balancer::IsOutOfWork() const
+    {
+        if (_nodes.size() < _machine_count) {
+            return false;
+        }
+
+        for (std::deque<Node>::const_iterator it = _nodes.begin(); it != _nodes.end(); ++it) {
+            if ((!it->waiting && !it->detached) || !it->arrivals.empty()) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
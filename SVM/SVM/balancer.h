@@ -0,0 +1,86 @@
+#ifndef BALANCER_H
+#define BALANCER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "kernel.h"
+
+namespace vm
+{
+    // Spreads processes over kernels running side by side, one per host
+    // thread. Every kernel reports its run queue on its timer ticks, and the
+    // busiest hands a ready process to the least busy once they are far
+    // enough apart. The process is taken in on the target's own thread, the
+    // next time it ticks or while it waits for work.
+    class Balancer
+    {
+    public:
+        // Closer than this moving a process gains nothing, it would only
+        // bounce back
+
+        static const unsigned int MIN_IMBALANCE = 2;
+
+        // Cycles between two calls to Balance by the same kernel. Every call
+        // takes the lock all of the machines share.
+
+        static const CPU::cycle_count_type BALANCE_INTERVAL = 256;
+
+        explicit Balancer(unsigned int machine_count);
+        virtual ~Balancer();
+
+        // Every kernel attaches once as it starts and gets its machine
+        // number, and detaches as it goes away. Processes still on their
+        // way to it go to another machine.
+
+        unsigned int Attach(Kernel &kernel);
+        void Detach(unsigned int machine);
+
+        // Skips the call when another machine holds the lock, rather than
+        // wait for it
+
+        void Balance(unsigned int machine, Kernel &kernel);
+
+        // For a kernel with nothing to run. Returns true once it has taken a
+        // process in, false when every machine has run out of work.
+
+        bool WaitForWork(unsigned int machine, Kernel &kernel);
+
+        unsigned long long GetMigrationCount();
+
+    private:
+        struct Node
+        {
+            MMU::ram_size_type page_size;
+            Kernel::process_list_type::size_type load;
+
+            bool waiting;
+            bool detached;
+
+            std::deque<Kernel::Migration> arrivals;
+
+            Node();
+        };
+
+        unsigned int _machine_count;
+        std::deque<Node> _nodes;  // attaching never moves the others
+
+        std::mutex _mutex;
+        std::condition_variable _condition;
+
+        unsigned long long _migrations;
+        bool _finished;
+
+        Balancer(const Balancer &);
+        Balancer &operator=(const Balancer &);
+
+        // All of them expect the mutex held
+
+        void TakeArrivals(unsigned int machine, Kernel &kernel);
+        unsigned int FindTarget(unsigned int machine) const;
+        bool IsOutOfWork() const;
+    };
+}
+
+#endif
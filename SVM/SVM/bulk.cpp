@@ -0,0 +1,216 @@
+#include "bulk.h"
+
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define BULK_X86
+#endif
+
+#ifdef BULK_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BULK_TARGET_SSE2
+#define BULK_TARGET_AVX2
+#else
+#define BULK_TARGET_SSE2 __attribute__((target("sse2")))
+#define BULK_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace vm
+{
+    namespace
+    {
+        typedef void (*fill_type)(int *destination, int value, std::size_t count);
+        typedef std::size_t (*compare_type)(const int *first, const int *second, std::size_t count);
+
+        struct Implementation
+        {
+            const char *name;
+
+            fill_type fill;
+            compare_type compare;
+        };
+
+        void FillPortable(int *destination, int value, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i) {
+                destination[i] = value;
+            }
+        }
+
+        std::size_t ComparePortable(const int *first, const int *second, std::size_t count)
+        {
+            std::size_t i = 0;
+            while (i < count && first[i] == second[i]) {
+                ++i;
+            }
+
+            return i;
+        }
+
+#ifdef BULK_X86
+        unsigned int FirstSetBit(unsigned int mask)
+        {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanForward(&index, mask);
+
+            return index;
+#else
+            return __builtin_ctz(mask);
+#endif
+        }
+
+        // Unaligned loads and stores throughout: frames are only word aligned
+        // in host memory
+
+        BULK_TARGET_SSE2 void FillSse2(int *destination, int value, std::size_t count)
+        {
+            __m128i values = _mm_set1_epi32(value);
+
+            std::size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(destination + i), values);
+            }
+            for (; i < count; ++i) {
+                destination[i] = value;
+            }
+        }
+
+        BULK_TARGET_SSE2 std::size_t CompareSse2(const int *first, const int *second, std::size_t count)
+        {
+            std::size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(first + i)),
+                                                _mm_loadu_si128(reinterpret_cast<const __m128i *>(second + i)));
+
+                unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(equal)) ^ 0xFFFFu;
+                if (mask) {
+                    return i + FirstSetBit(mask) / sizeof(int);
+                }
+            }
+
+            return i + ComparePortable(first + i, second + i, count - i);
+        }
+
+        BULK_TARGET_AVX2 void FillAvx2(int *destination, int value, std::size_t count)
+        {
+            __m256i values = _mm256_set1_epi32(value);
+
+            std::size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(destination + i), values);
+            }
+            for (; i < count; ++i) {
+                destination[i] = value;
+            }
+        }
+
+        BULK_TARGET_AVX2 std::size_t CompareAvx2(const int *first, const int *second, std::size_t count)
+        {
+            std::size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                __m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(first + i)),
+                                                   _mm256_loadu_si256(reinterpret_cast<const __m256i *>(second + i)));
+
+                unsigned int mask = ~static_cast<unsigned int>(_mm256_movemask_epi8(equal));
+                if (mask) {
+                    return i + FirstSetBit(mask) / sizeof(int);
+                }
+            }
+
+            return i + ComparePortable(first + i, second + i, count - i);
+        }
+
+        // AVX2 needs the OS to save the upper halves of the ymm registers,
+        // which XGETBV reports
+
+        bool HasAvx2()
+        {
+#ifdef _MSC_VER
+            int info[4];
+
+            __cpuid(info, 0);
+            if (info[0] < 7) {
+                return false;
+            }
+
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+                return false;
+            }
+
+            __cpuidex(info, 7, 0);
+
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+
+            return __builtin_cpu_supports("avx2") != 0;
+#endif
+        }
+
+        bool HasSse2()
+        {
+#if defined(_M_X64) || defined(__x86_64__)
+            return true;
+#elif defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 1);
+
+            return (info[3] & (1 << 26)) != 0;
+#else
+            __builtin_cpu_init();
+
+            return __builtin_cpu_supports("sse2") != 0;
+#endif
+        }
+#endif
+
+        Implementation Select()
+        {
+            Implementation implementation = { "portable", &FillPortable, &ComparePortable };
+
+#ifdef BULK_X86
+            if (HasAvx2()) {
+                Implementation avx2 = { "avx2", &FillAvx2, &CompareAvx2 };
+                implementation = avx2;
+            } else if (HasSse2()) {
+                Implementation sse2 = { "sse2", &FillSse2, &CompareSse2 };
+                implementation = sse2;
+            }
+#endif
+
+            return implementation;
+        }
+
+        const Implementation implementation = Select();
+    }
+
+    // The C library's memmove already picks vector code for the host and
+    // beat hand-written AVX2 loops on page sized copies
+
+    void BulkMemory::Copy(int *destination, const int *source, std::size_t count)
+    {
+        std::memmove(destination, source, count * sizeof(int));
+    }
+
+    void BulkMemory::Fill(int *destination, int value, std::size_t count)
+    {
+        implementation.fill(destination, value, count);
+    }
+
+    std::size_t BulkMemory::Compare(const int *first, const int *second, std::size_t count)
+    {
+        return implementation.compare(first, second, count);
+    }
+
+    const char *BulkMemory::GetImplementationName()
+    {
+        return implementation.name;
+    }
+}
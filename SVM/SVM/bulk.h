@@ -0,0 +1,29 @@
+#ifndef BULK_H
+#define BULK_H
+
+#include <cstddef>
+
+namespace vm
+{
+    // Word copy, fill and compare behind the CPU's bulk instructions. Fill
+    // and compare use the widest vector unit of the host (AVX2, SSE2, or
+    // none), picked once at startup. Results are the same whichever one runs.
+    class BulkMemory
+    {
+    public:
+        // Overlapping ranges are copied as if through a temporary buffer
+
+        static void Copy(int *destination, const int *source, std::size_t count);
+        static void Fill(int *destination, int value, std::size_t count);
+
+        // Returns the index of the first word that differs, "count" if none does
+
+        static std::size_t Compare(const int *first, const int *second, std::size_t count);
+
+        // "avx2", "sse2" or "portable"
+
+        static const char *GetImplementationName();
+    };
+}
+
+#endif
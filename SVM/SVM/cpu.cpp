@@ -1,4 +1,9 @@
 #include "cpu.h"
+#include "trace.h"
+#include "profiler.h"
+#include "jit.h"
+#include "bulk.h"
+#include "verifier.h"
 
 #include <iostream>
 
@@ -7,151 +12,431 @@ namespace vm
     Registers::Registers()
         : a(0), b(0), c(0), flags(0), ip(0), sp(0) {}
 
-    CPU::CPU(MMU &mmu, PIC &pic): registers(), _mmu(mmu), _pic(pic) {}
+    CPU::CPU(MMU &mmu, PIC &pic): registers(), cycles(0), verified(false), tracer(NULL), profiler(NULL), jit(NULL), _mmu(mmu), _pic(pic) {}
 
     CPU::~CPU() {}
 
     void CPU::Step()
+    {
+        ++cycles;
+
+        if (verified) {
+            Execute<false>();
+        } else {
+            Execute<true>();
+        }
+    }
+
+    CPU::cycle_count_type CPU::RunTranslated(cycle_count_type budget)
+    {
+        // Translated code does not report page accesses, so the JIT sits out
+        // profiled runs. Unverified images always need the checks.
+
+        if (!jit || !verified || profiler || budget < Jit::MIN_BUDGET) {
+            return 0;
+        }
+
+        Jit::Exit exit;
+        cycle_count_type retired = jit->Run(_mmu, registers, budget, exit);
+
+        cycles += retired;
+
+        if (exit.reason == Jit::PageFaultExit || exit.reason == Jit::WriteFaultExit) {
+            RaisePageFault(exit.address, _mmu.GetPageIndexAndOffsetForVirtualAddress(exit.address).first,
+                           exit.reason == Jit::WriteFaultExit);
+        } else if (exit.reason == Jit::CodeWriteExit) {
+            jit->CodeWritten(exit.address);
+        }
+
+        return retired;
+    }
+
+    const CPU::DispatchTable CPU::CHECKED_DISPATCH_TABLE = CPU::BuildDispatchTable<true>();
+    const CPU::DispatchTable CPU::UNCHECKED_DISPATCH_TABLE = CPU::BuildDispatchTable<false>();
+
+    // Each variant of a register instruction gets its own instantiation, so
+    // the register it works on is a constant in the handler
+
+    template <bool checked>
+    CPU::DispatchTable CPU::BuildDispatchTable()
+    {
+        static const handler_type moves[REGISTER_COUNT] = {
+            &CPU::ExecuteMove<checked, 0>, &CPU::ExecuteMove<checked, 1>, &CPU::ExecuteMove<checked, 2>
+        };
+        static const handler_type loads[REGISTER_COUNT] = {
+            &CPU::ExecuteLoad<checked, 0>, &CPU::ExecuteLoad<checked, 1>, &CPU::ExecuteLoad<checked, 2>
+        };
+        static const handler_type stores[REGISTER_COUNT] = {
+            &CPU::ExecuteStore<checked, 0>, &CPU::ExecuteStore<checked, 1>, &CPU::ExecuteStore<checked, 2>
+        };
+        static const handler_type move_stores[REGISTER_COUNT] = {
+            &CPU::ExecuteMoveStore<checked, 0>, &CPU::ExecuteMoveStore<checked, 1>, &CPU::ExecuteMoveStore<checked, 2>
+        };
+        static const handler_type load_stores[REGISTER_COUNT] = {
+            &CPU::ExecuteLoadStore<checked, 0>, &CPU::ExecuteLoadStore<checked, 1>, &CPU::ExecuteLoadStore<checked, 2>
+        };
+        static const handler_type load_loads[REGISTER_COUNT * REGISTER_COUNT] = {
+            &CPU::ExecuteLoadLoad<checked, 0>, &CPU::ExecuteLoadLoad<checked, 1>, &CPU::ExecuteLoadLoad<checked, 2>,
+            &CPU::ExecuteLoadLoad<checked, 3>, &CPU::ExecuteLoadLoad<checked, 4>, &CPU::ExecuteLoadLoad<checked, 5>,
+            &CPU::ExecuteLoadLoad<checked, 6>, &CPU::ExecuteLoadLoad<checked, 7>, &CPU::ExecuteLoadLoad<checked, 8>
+        };
+
+        DispatchTable table;
+        for (int opcode = 0; opcode < OPCODE_COUNT; ++opcode) {
+            table.handlers[opcode] = &CPU::ExecuteInvalid;
+        }
+
+        for (std::size_t i = 0; i < INSTRUCTION_COUNT; ++i) {
+            const InstructionDescription &description = INSTRUCTION_TABLE[i];
+
+            for (int variant = 0; variant < description.variants; ++variant) {
+                handler_type &handler = table.handlers[description.opcode + variant];
+
+                switch (description.operation) {
+                case MoveOperation:
+                    handler = moves[variant];
+                    break;
+                case LoadOperation:
+                    handler = loads[variant];
+                    break;
+                case StoreOperation:
+                    handler = stores[variant];
+                    break;
+                case JumpOperation:
+                    handler = &CPU::ExecuteJump<checked>;
+                    break;
+                case InterruptOperation:
+                    handler = &CPU::ExecuteInterrupt<checked>;
+                    break;
+                case MoveStoreOperation:
+                    handler = move_stores[variant];
+                    break;
+                case LoadStoreOperation:
+                    handler = load_stores[variant];
+                    break;
+                case LoadLoadOperation:
+                    handler = load_loads[variant];
+                    break;
+                case CopyOperation:
+                    handler = &CPU::ExecuteBulk<COPY_OPCODE>;
+                    break;
+                case FillOperation:
+                    handler = &CPU::ExecuteBulk<FILL_OPCODE>;
+                    break;
+                case CompareOperation:
+                    handler = &CPU::ExecuteBulk<COMPARE_OPCODE>;
+                    break;
+                }
+            }
+        }
+
+        return table;
+    }
+
+    // Images accepted by the Verifier run with "checked" set to false: every
+    // opcode, operand, jump target and virtual address was proven valid at
+    // load time, so the per-instruction checks in the handlers compile away.
+
+    template <bool checked>
+    void CPU::Execute()
     {
         int ip = registers.ip;
 
+        if (checked && (ip < 0 || static_cast<MMU::ram_size_type>(ip) + 1 >= _mmu.ram.size())) {
+            std::cerr << "CPU: instruction pointer (" << ip << ") is outside of the memory. Terminating..." << std::endl;
+            RaiseSoftwareInterrupt(1);
+
+            return;
+        }
+
         int instruction = _mmu.ram[ip];
         int data = _mmu.ram[ip + 1];
-		MMU::page_index_offset_pair_type page_index_and_offset;
-		MMU::page_entry_type frame;
 
-        switch (instruction) {
-        case CPU::MOVA_BASE_OPCODE:
-            registers.a = data;
+        if (checked && (instruction < 0 || instruction >= OPCODE_COUNT)) {
+            ExecuteInvalid(ip, data);
+
+            return;
+        }
+
+        const DispatchTable &table = checked ? CHECKED_DISPATCH_TABLE : UNCHECKED_DISPATCH_TABLE;
+        (this->*table.handlers[instruction])(ip, data);
+    }
+
+    template <bool checked, int target>
+    void CPU::ExecuteMove(int, int data)
+    {
+        Register(target) = data;
+        registers.ip += 2;
+    }
+
+    template <bool checked, int target>
+    void CPU::ExecuteLoad(int, int data)
+    {
+        MMU::ram_size_type physical_address;
+        if (Translate<checked>(data, physical_address, false)) {
+            Register(target) = _mmu.ram[physical_address];
+            registers.ip += 2;
+        }
+    }
+
+    template <bool checked, int source>
+    void CPU::ExecuteStore(int, int data)
+    {
+        MMU::ram_size_type physical_address;
+        if (Translate<checked>(data, physical_address, true)) {
+            Store(physical_address, Register(source));
             registers.ip += 2;
+        }
+    }
+
+    // A superinstruction retires its halves one at a time, so a fault on the
+    // second one restarts at the plain instruction that follows. A first half
+    // in the last words of memory runs alone, and the CPU stops at the ip
+    // past it like after any other instruction there.
+
+    template <bool checked, int target>
+    void CPU::ExecuteMoveStore(int ip, int data)
+    {
+        Register(target) = data;
+        registers.ip += 2;
+
+        if (checked && static_cast<MMU::ram_size_type>(ip) + 3 >= _mmu.ram.size()) {
+            return;
+        }
 
-            break;
-        case CPU::MOVB_BASE_OPCODE:
-            registers.b = data;
+        MMU::ram_size_type physical_address;
+        if (Translate<checked>(_mmu.ram[ip + 3], physical_address, true)) {
+            Store(physical_address, Register(target));
             registers.ip += 2;
+        }
+    }
 
-            break;
-        case CPU::MOVC_BASE_OPCODE:
-            registers.c = data;
+    template <bool checked, int target>
+    void CPU::ExecuteLoadStore(int ip, int data)
+    {
+        MMU::ram_size_type physical_address;
+        if (Translate<checked>(data, physical_address, false)) {
+            Register(target) = _mmu.ram[physical_address];
             registers.ip += 2;
 
-            break;
+            if (checked && static_cast<MMU::ram_size_type>(ip) + 3 >= _mmu.ram.size()) {
+                return;
+            }
 
-		case CPU::LDA_BASE_OPCODE:
+            if (Translate<checked>(_mmu.ram[ip + 3], physical_address, true)) {
+                Store(physical_address, Register(target));
+                registers.ip += 2;
+            }
+        }
+    }
 
-			page_index_and_offset =  _mmu.GetPageIndexAndOffsetForVirtualAddress(data);
-			frame = _mmu.page_table->at(page_index_and_offset.first);
-			if (frame== MMU::INVALID_PAGE) {
+    template <bool checked, int targets>
+    void CPU::ExecuteLoadLoad(int ip, int data)
+    {
+        MMU::ram_size_type physical_address;
+        if (Translate<checked>(data, physical_address, false)) {
+            Register(targets / REGISTER_COUNT) = _mmu.ram[physical_address];
+            registers.ip += 2;
 
-				int temp = registers.a;
-				registers.a = page_index_and_offset.first;
-				_pic.isr_4();
-				registers.a = temp;
+            if (checked && static_cast<MMU::ram_size_type>(ip) + 3 >= _mmu.ram.size()) {
+                return;
+            }
 
-			} else {
-				registers.a = _mmu.ram[frame + page_index_and_offset.second];
-				registers.ip += 2;
-			}
-			break;
+            if (Translate<checked>(_mmu.ram[ip + 3], physical_address, false)) {
+                Register(targets % REGISTER_COUNT) = _mmu.ram[physical_address];
+                registers.ip += 2;
+            }
+        }
+    }
 
-		case CPU::LDB_BASE_OPCODE:
+    template <bool checked>
+    void CPU::ExecuteJump(int, int data)
+    {
+        registers.ip += data;
+    }
 
-			page_index_and_offset =  _mmu.GetPageIndexAndOffsetForVirtualAddress(data);
-			frame = _mmu.page_table->at(page_index_and_offset.first);
-			if (frame== MMU::INVALID_PAGE) {
+    template <bool checked>
+    void CPU::ExecuteInterrupt(int, int data)
+    {
+        if (checked && (data < Verifier::MIN_INTERRUPT_NUMBER || data > Verifier::MAX_INTERRUPT_NUMBER)) {
+            std::cerr << "CPU: invalid interrupt number (" << data << "). Terminating..." << std::endl;
+            data = 1;
+        }
 
-				int temp = registers.a;
-				registers.a = page_index_and_offset.first;
-				_pic.isr_4();
-				registers.a = temp;
+        // The handler returns to the next instruction
 
-			} else {
-				registers.b = _mmu.ram[frame + page_index_and_offset.second];
-				registers.ip += 2;
-			}
-			break;
+        RaiseSoftwareInterrupt(data);
+        registers.ip += 2;
+    }
 
-		case CPU::LDC_BASE_OPCODE:
+    void CPU::ExecuteInvalid(int ip, int)
+    {
+        std::cerr << "CPU: invalid opcode data (" << _mmu.ram[ip] << "). Skipping..." << std::endl;
+        registers.ip += 2;
+    }
 
-			page_index_and_offset =  _mmu.GetPageIndexAndOffsetForVirtualAddress(data);
-			frame = _mmu.page_table->at(page_index_and_offset.first);
-			if (frame== MMU::INVALID_PAGE) {
+    // Resolves a virtual address for the instruction at registers.ip. Returns
+    // false when the instruction can not complete yet: either a page fault was
+    // raised and the instruction will be restarted, or the address was invalid
+    // and the instruction was skipped.
 
-				int temp = registers.a;
-				registers.a = page_index_and_offset.first;
-				_pic.isr_4();
-				registers.a = temp;
+    template <bool checked>
+    bool CPU::Translate(int address, MMU::ram_size_type &physical_address, bool write)
+    {
+        MMU::page_index_offset_pair_type page_index_and_offset = _mmu.GetPageIndexAndOffsetForVirtualAddress(address);
+        if (checked && !CheckPageIndex(page_index_and_offset.first)) {
+            return false;
+        }
 
-			} else {
-				registers.c = _mmu.ram[frame + page_index_and_offset.second];
-				registers.ip += 2;
-			}
-			break;
+        MMU::page_entry_type frame = (*_mmu.page_table)[page_index_and_offset.first];
+        if (frame == MMU::INVALID_PAGE || (write && _mmu.IsShared(frame))) {
+            RaisePageFault(address, page_index_and_offset.first, frame != MMU::INVALID_PAGE);
 
-		case CPU::STA_BASE_OPCODE:
+            return false;
+        }
 
-			page_index_and_offset =  _mmu.GetPageIndexAndOffsetForVirtualAddress(data);
-			frame = _mmu.page_table->at(page_index_and_offset.first);
-			if (frame == MMU::INVALID_PAGE) {
+        if (profiler) {
+            profiler->RecordPageAccess(page_index_and_offset.first);
+        }
 
-				int temp = registers.a;
-				registers.a = page_index_and_offset.first;
-				_pic.isr_4();
-				registers.a = temp;
+        physical_address = frame + page_index_and_offset.second;
 
-			} else {
-				_mmu.ram[frame + page_index_and_offset.second] = registers.a;
-				registers.ip += 2;
-			}
-			break;
+        return true;
+    }
 
-		case CPU::STB_BASE_OPCODE:
+    // Addresses come from registers, so even verified images get the checks.
+    // Each round covers what is left of the current source and destination
+    // pages, or huge pages.
 
-			page_index_and_offset =  _mmu.GetPageIndexAndOffsetForVirtualAddress(data);
-			frame = _mmu.page_table->at(page_index_and_offset.first);
-			if (frame== MMU::INVALID_PAGE) {
+    template <int instruction>
+    void CPU::ExecuteBulk(int, int)
+    {
+        while (registers.c > 0) {
+            MMU::ram_size_type destination, source = 0;
+            if (!Translate<true>(registers.a, destination, instruction != CPU::COMPARE_OPCODE)) {
+                return;
+            }
+
+            MMU::ram_size_type count = GetMappingReach(registers.a);
+            if (instruction != CPU::FILL_OPCODE) {
+                if (!Translate<true>(registers.b, source, false)) {
+                    return;
+                }
+
+                if (GetMappingReach(registers.b) < count) {
+                    count = GetMappingReach(registers.b);
+                }
+            }
+
+            if (static_cast<MMU::ram_size_type>(registers.c) < count) {
+                count = registers.c;
+            }
+
+            int *ram = &_mmu.ram[0];
+
+            if (instruction == CPU::COMPARE_OPCODE) {
+                MMU::ram_size_type equal = BulkMemory::Compare(ram + destination, ram + source, count);
+
+                registers.a += static_cast<int>(equal);
+                registers.b += static_cast<int>(equal);
+                registers.c -= static_cast<int>(equal);
+
+                if (equal < count) {
+                    registers.flags = ram[destination + equal] < ram[source + equal] ? -1 : 1;
+                    registers.ip += 2;
+
+                    return;
+                }
+            } else {
+                if (instruction == CPU::COPY_OPCODE) {
+                    BulkMemory::Copy(ram + destination, ram + source, count);
+                    registers.b += static_cast<int>(count);
+                } else {
+                    BulkMemory::Fill(ram + destination, registers.b, count);
+                }
+
+                if (jit) {
+                    jit->CodeWritten(destination, destination + count);
+                }
+
+                registers.a += static_cast<int>(count);
+                registers.c -= static_cast<int>(count);
+            }
+        }
 
-				int temp = registers.a;
-				registers.a = page_index_and_offset.first;
-				_pic.isr_4();
-				registers.a = temp;
+        if (instruction == CPU::COMPARE_OPCODE) {
+            registers.flags = 0;
+        }
 
-			} else {
-				_mmu.ram[frame + page_index_and_offset.second] = registers.b;
-				registers.ip += 2;
-			}
-			break;
+        registers.ip += 2;
+    }
 
-		case CPU::STC_BASE_OPCODE:
+    // Huge pages are contiguous in physical memory, so a translation holds
+    // up to the end of the huge page
 
-			page_index_and_offset =  _mmu.GetPageIndexAndOffsetForVirtualAddress(data);
-			frame = _mmu.page_table->at(page_index_and_offset.first);
-			if (frame== MMU::INVALID_PAGE) {
+    MMU::ram_size_type CPU::GetMappingReach(MMU::vmem_size_type address) const
+    {
+        MMU::page_table_size_type region = (address >> _mmu.GetPageShift()) / MMU::HUGE_PAGE_PAGES;
+
+        MMU::ram_size_type span = _mmu.GetPageSize();
+        if (_mmu.huge_mappings && region < _mmu.huge_mappings->size() && (*_mmu.huge_mappings)[region]) {
+            span *= MMU::HUGE_PAGE_PAGES;
+        }
 
-				int temp = registers.a;
-				registers.a = page_index_and_offset.first;
-				_pic.isr_4();
-				registers.a = temp;
+        return span - address % span;
+    }
 
-			} else {
-				_mmu.ram[frame + page_index_and_offset.second] = registers.c;
-				registers.ip += 2;
-			}
-			break;
-
-        case CPU::JMP_BASE_OPCODE:
-            registers.ip += data;
-
-            break;
-        case CPU::INT_BASE_OPCODE:
-            _pic.isr_3();
-
-            break;
+    int &CPU::Register(int index)
+    {
+        switch (index) {
+        case 0:
+            return registers.a;
+        case 1:
+            return registers.b;
         default:
-            std::cerr << "CPU: invalid opcode data (" << instruction << "). Skipping..." << std::endl;
+            return registers.c;
+        }
+    }
+
+    // Stores into a frame holding translated code drop the stale translations
+
+    void CPU::Store(MMU::ram_size_type physical_address, int value)
+    {
+        _mmu.ram[physical_address] = value;
+
+        if (jit && jit->IsCodeFrame(physical_address)) {
+            jit->CodeWritten(physical_address);
+        }
+    }
+
+    bool CPU::CheckPageIndex(MMU::page_table_size_type page)
+    {
+        if (page >= _mmu.page_table->size()) {
+            std::cerr << "CPU: virtual page (" << page << ") is outside of the address space. Skipping..." << std::endl;
             registers.ip += 2;
 
-            break;
+            return false;
+        }
+
+        return true;
+    }
+
+    void CPU::RaisePageFault(MMU::vmem_size_type address, MMU::page_table_size_type page, bool write)
+    {
+        if (tracer) {
+            tracer->PageFault(cycles, page, address, registers.ip);
         }
+
+        _pic.fault.ip = registers.ip;
+        _pic.fault.address = address;
+        _pic.fault.page = page;
+        _pic.fault.write = write;
+        _pic.Raise(PIC::PAGE_FAULT_VECTOR);
+    }
+
+    void CPU::RaiseSoftwareInterrupt(int number)
+    {
+        _pic.fault.ip = registers.ip;
+        _pic.Raise(PIC::SOFTWARE_VECTOR_BASE + number - 1);
     }
 }
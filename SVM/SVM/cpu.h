@@ -2,10 +2,15 @@
 #define CPU_H
 
 #include "mmu.h"
+#include "opcodes.h"
 #include "pic.h"
 
 namespace vm
 {
+    class Tracer;
+    class Profiler;
+    class Jit;
+
     struct Registers
     {
         int a, b, c;
@@ -17,35 +22,98 @@ namespace vm
         Registers();
     };
 
-    class CPU
+    class CPU : public Opcodes
     {
     public:
-        static const int MOVA_BASE_OPCODE = 0x10;
-        static const int MOVB_BASE_OPCODE = MOVA_BASE_OPCODE + 1;
-        static const int MOVC_BASE_OPCODE = MOVA_BASE_OPCODE + 2;
+        typedef unsigned long long cycle_count_type;
 
-		static const int LDA_BASE_OPCODE = 0x20;
-		static const int LDB_BASE_OPCODE = LDA_BASE_OPCODE + 1;
-		static const int LDC_BASE_OPCODE = LDA_BASE_OPCODE + 2;
+        Registers registers;
 
-		static const int STA_BASE_OPCODE = 0x30;
-		static const int STB_BASE_OPCODE = STA_BASE_OPCODE + 1;
-		static const int STC_BASE_OPCODE = STA_BASE_OPCODE + 2;
-	
-        static const int JMP_BASE_OPCODE = 0x40;
+        cycle_count_type cycles;
 
-        static const int INT_BASE_OPCODE = 0x50;
+        bool verified;
 
-        Registers registers;
+        Tracer *tracer;
+        Profiler *profiler;
+        Jit *jit;
 
         CPU(MMU &mmu, PIC &pic);
         virtual ~CPU();
 
         void Step();
 
+        // Runs translated code for at most "budget" instructions and returns
+        // how many were retired. Zero means Step has to interpret the next one.
+
+        cycle_count_type RunTranslated(cycle_count_type budget);
+
     private:
         MMU &_mmu;
         PIC &_pic;
+
+        // Every opcode has a handler specialised for its operation and
+        // registers, looked up in a table indexed by the opcode. Opcodes no
+        // instruction uses lead to ExecuteInvalid.
+
+        typedef void (CPU::*handler_type)(int ip, int data);
+
+        struct DispatchTable
+        {
+            handler_type handlers[OPCODE_COUNT];
+        };
+
+        static const DispatchTable CHECKED_DISPATCH_TABLE;
+        static const DispatchTable UNCHECKED_DISPATCH_TABLE;
+
+        template <bool checked>
+        static DispatchTable BuildDispatchTable();
+
+        template <bool checked>
+        void Execute();
+
+        template <bool checked, int target>
+        void ExecuteMove(int ip, int data);
+
+        template <bool checked, int target>
+        void ExecuteLoad(int ip, int data);
+
+        template <bool checked, int source>
+        void ExecuteStore(int ip, int data);
+
+        template <bool checked, int target>
+        void ExecuteMoveStore(int ip, int data);
+
+        template <bool checked, int target>
+        void ExecuteLoadStore(int ip, int data);
+
+        template <bool checked, int targets>
+        void ExecuteLoadLoad(int ip, int data);
+
+        template <bool checked>
+        void ExecuteJump(int ip, int data);
+
+        template <bool checked>
+        void ExecuteInterrupt(int ip, int data);
+
+        template <int instruction>
+        void ExecuteBulk(int ip, int data);
+
+        void ExecuteInvalid(int ip, int data);
+
+        template <bool checked>
+        bool Translate(int address, MMU::ram_size_type &physical_address, bool write);
+
+        // Words from the address to the end of its mapping
+
+        MMU::ram_size_type GetMappingReach(MMU::vmem_size_type address) const;
+
+        int &Register(int index);
+
+        void Store(MMU::ram_size_type physical_address, int value);
+
+        bool CheckPageIndex(MMU::page_table_size_type page);
+        void RaisePageFault(MMU::vmem_size_type address, MMU::page_table_size_type page, bool write);
+        void RaiseSoftwareInterrupt(int number);
     };
 }
 
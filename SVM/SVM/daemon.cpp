@@ -0,0 +1,628 @@
+#include "daemon.h"
+#include "verifier.h"
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DAEMON_SUPPORTED
+#endif
+
+#ifdef DAEMON_SUPPORTED
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace vm
+{
+    Daemon::Options::Options()
+        : queue_size(64), run_queue_size(16),
+          address_space_size(MMU::RAM_SIZE / MMU::DEFAULT_PAGE_SIZE * MMU::DEFAULT_PAGE_SIZE) {}
+
+    Daemon::Job::Job()
+        : id(0), client(0), name(), image(), priority(0), page_limit(0), submitted() {}
+
+    Daemon::RunningJob::RunningJob()
+        : id(0), client(0), started_cycle(0), submitted(), started() {}
+
+    Daemon::Client::Client()
+        : socket(-1), input(), output(), reading_image(false), image_bytes(0), image_job() {}
+
+    Daemon::Daemon(const Options &options)
+        : _options(options), _path(), _socket(-1), _thread(), _clients(), _last_client_id(0),
+          _queue(), _running(), _attached(), _last_job_id(0), _shutting_down(false), _stopping(false)
+    {
+        _wakeup[0] = _wakeup[1] = -1;
+    }
+
+    Daemon::~Daemon()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+
+            Wake();
+        }
+        _condition.notify_all();
+
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+
+#ifdef DAEMON_SUPPORTED
+        // The last replies go out as far as the sockets take them
+
+        for (client_map_type::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+            Flush(it->second);
+            close(it->second.socket);
+        }
+
+        if (_socket != -1) {
+            close(_socket);
+            unlink(_path.c_str());
+        }
+
+        for (int i = 0; i < 2; ++i) {
+            if (_wakeup[i] != -1) {
+                close(_wakeup[i]);
+            }
+        }
+#endif
+    }
+
+    bool Daemon::Listen(const std::string &path)
+    {
+#ifdef DAEMON_SUPPORTED
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Daemon: the socket path " << path << " is too long." << std::endl;
+
+            return false;
+        }
+        std::strcpy(address.sun_path, path.c_str());
+
+        if (pipe(_wakeup) != 0) {
+            std::cerr << "Daemon: failed to create the wakeup pipe." << std::endl;
+
+            _wakeup[0] = _wakeup[1] = -1;
+
+            return false;
+        }
+
+        for (int i = 0; i < 2; ++i) {
+            fcntl(_wakeup[i], F_SETFL, fcntl(_wakeup[i], F_GETFL) | O_NONBLOCK);
+        }
+
+        _socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_socket == -1) {
+            std::cerr << "Daemon: failed to create the socket." << std::endl;
+
+            return false;
+        }
+
+        unlink(path.c_str());
+
+        if (bind(_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(_socket, SOMAXCONN) != 0) {
+            std::cerr << "Daemon: failed to listen on " << path << "." << std::endl;
+
+            close(_socket);
+            _socket = -1;
+
+            return false;
+        }
+
+        _path = path;
+        _thread = std::thread(&Daemon::Serve, this);
+
+        std::cout << "Daemon: listening on " << path << "." << std::endl;
+
+        return true;
+#else
+        std::cerr << "Daemon: Unix domain sockets are not available on this host." << std::endl;
+
+        return false;
+#endif
+    }
+
+    unsigned int Daemon::Attach(Kernel &)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _attached.push_back(true);
+
+        return static_cast<unsigned int>(_attached.size() - 1);
+    }
+
+    // A kernel stops early only when every process it has is blocked for
+    // good. Its jobs never finish, and with no kernel left neither do the
+    // queued ones.
+
+    void Daemon::Detach(unsigned int machine)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _attached[machine] = false;
+
+        for (running_job_map_type::iterator it = _running.begin(); it != _running.end();) {
+            if (it->first.first == machine) {
+                std::ostringstream line;
+                line << "failed " << it->second.id;
+                Send(it->second.client, line.str());
+
+                _running.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+
+        if (!HasMachines()) {
+            for (std::deque<Job>::const_iterator it = _queue.begin(); it != _queue.end(); ++it) {
+                std::ostringstream line;
+                line << "failed " << it->id;
+                Send(it->client, line.str());
+            }
+
+            _queue.clear();
+        }
+
+        _condition.notify_all();
+    }
+
+    void Daemon::Admit(unsigned int machine, Kernel &kernel)
+    {
+        std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+
+        TakeJobs(machine, kernel);
+    }
+
+    bool Daemon::WaitForWork(unsigned int machine, Kernel &kernel)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        for (;;) {
+            TakeJobs(machine, kernel);
+
+            if (!kernel.processes.empty()) {
+                return true;
+            }
+
+            if (_stopping || (_shutting_down && _queue.empty())) {
+                return false;
+            }
+
+            _condition.wait(lock);
+        }
+    }
+
+    void Daemon::Finish(unsigned int machine, Process &process, int exit_code, bool killed, CPU::cycle_count_type cycles)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        running_job_map_type::iterator it = _running.find(std::make_pair(machine, process.id));
+        if (it == _running.end()) {
+            return;
+        }
+
+        const RunningJob &job = it->second;
+        clock_type::time_point now = clock_type::now();
+
+        process.PruneMappedPages();
+
+        std::ostringstream line;
+        line << (killed ? "killed " : "done ") << job.id
+             << " exit=" << exit_code
+             << " cycles=" << cycles - job.started_cycle
+             << " pages=" << process.mapped_pages.size()
+             << " wait_us=" << std::chrono::duration_cast<std::chrono::microseconds>(job.started - job.submitted).count()
+             << " run_us=" << std::chrono::duration_cast<std::chrono::microseconds>(now - job.started).count();
+        Send(job.client, line.str());
+
+        _running.erase(it);
+    }
+
+    unsigned long long Daemon::GetJobCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        return _last_job_id;
+    }
+
+    // Sleeps in poll until a client or Wake has something for it. Sockets
+    // are non-blocking, no client holds up the kernels waiting on the lock.
+
+    void Daemon::Serve()
+    {
+#ifdef DAEMON_SUPPORTED
+        std::vector<pollfd> descriptors;
+        std::vector<client_id_type> ids;
+
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+
+                if (_stopping) {
+                    return;
+                }
+
+                descriptors.clear();
+                ids.clear();
+
+                pollfd descriptor = { _socket, POLLIN, 0 };
+                descriptors.push_back(descriptor);
+
+                pollfd wakeup_descriptor = { _wakeup[0], POLLIN, 0 };
+                descriptors.push_back(wakeup_descriptor);
+
+                for (client_map_type::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+                    short events = 0;
+                    if (it->second.output.size() < _MAX_OUTPUT_LENGTH) {
+                        events |= POLLIN;
+                    }
+                    if (!it->second.output.empty()) {
+                        events |= POLLOUT;
+                    }
+
+                    pollfd client_descriptor = { it->second.socket, events, 0 };
+                    descriptors.push_back(client_descriptor);
+                    ids.push_back(it->first);
+                }
+            }
+
+            if (poll(&descriptors[0], descriptors.size(), -1) <= 0) {
+                continue;
+            }
+
+            if (descriptors[1].revents & POLLIN) {
+                char buffer[64];
+                while (read(_wakeup[0], buffer, sizeof(buffer)) > 0) {}
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            if (descriptors[0].revents & POLLIN) {
+                int client_socket = accept(_socket, NULL, NULL);
+                if (client_socket != -1) {
+                    fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+
+                    _clients[++_last_client_id].socket = client_socket;
+                }
+            }
+
+            for (std::vector<client_id_type>::size_type i = 0; i < ids.size(); ++i) {
+                short events = descriptors[i + 2].revents;
+                if (events == 0) {
+                    continue;
+                }
+
+                client_map_type::iterator it = _clients.find(ids[i]);
+                if (it == _clients.end()) {
+                    continue;
+                }
+
+                bool connected = true;
+                if (events & POLLOUT) {
+                    connected = Flush(it->second);
+                }
+                if (connected && (events & (POLLIN | POLLHUP | POLLERR))) {
+                    connected = Read(it->first, it->second, lock);
+                }
+
+                if (!connected) {
+                    close(it->second.socket);
+                    _clients.erase(it);
+                }
+            }
+        }
+#endif
+    }
+
+    std::string Daemon::Load(Job &job, MMU::vmem_size_type address_space_size)
+    {
+        if (job.image.empty() && !Kernel::ReadProgram(job.name, job.image)) {
+            return "failed to read " + job.name;
+        }
+
+        // The kernels would run an image that fails verification with
+        // checks, wherever its control goes. Jobs from clients have to pass.
+
+        Verifier::error_list_type errors;
+
+        if (!Verifier::Verify(job.image, address_space_size, errors)) {
+            return job.name + " failed verification, " + errors.front();
+        }
+
+        return std::string();
+    }
+
+    // False once the client has gone or broken the protocol. Only Serve
+    // removes clients, so "client" outlives the unlocked Load.
+
+    bool Daemon::Read(client_id_type id, Client &client, std::unique_lock<std::mutex> &lock)
+    {
+#ifdef DAEMON_SUPPORTED
+        char buffer[4096];
+
+        ssize_t received = recv(client.socket, buffer, sizeof(buffer), 0);
+        if (received == 0) {
+            return false;
+        } else if (received < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        client.input.append(buffer, received);
+
+        for (;;) {
+            Job job;
+
+            if (client.reading_image) {
+                if (client.input.size() < client.image_bytes) {
+                    break;
+                }
+
+                job = client.image_job;
+                job.image.resize(client.image_bytes / sizeof(int));
+                std::memcpy(&job.image[0], client.input.data(), client.image_bytes);
+                client.input.erase(0, client.image_bytes);
+
+                client.reading_image = false;
+            } else {
+                std::string::size_type end = client.input.find('\n');
+                if (end == std::string::npos) {
+                    if (client.input.size() > _MAX_LINE_LENGTH) {
+                        Send(id, "error the line is too long");
+                        Flush(client);
+
+                        return false;
+                    }
+
+                    break;
+                }
+
+                std::string line = client.input.substr(0, end);
+                client.input.erase(0, end + 1);
+
+                if (!line.empty() && line[line.size() - 1] == '\r') {
+                    line.erase(line.size() - 1);
+                }
+
+                if (!Execute(id, client, line, job)) {
+                    continue;
+                }
+            }
+
+            lock.unlock();
+            std::string error = Load(job, _options.address_space_size);
+            lock.lock();
+
+            if (error.empty()) {
+                Submit(id, job);
+            } else {
+                Send(id, "error " + error);
+            }
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // True when the line is a job ready to be loaded, an image request
+    // only has its words read next
+
+    bool Daemon::Execute(client_id_type id, Client &client, const std::string &line, Job &job)
+    {
+        std::istringstream stream(line);
+
+        std::string command;
+        stream >> command;
+
+        if (command.empty()) {
+            return false;
+        }
+
+        if (command == "shutdown") {
+            _shutting_down = true;
+            _condition.notify_all();
+
+            Send(id, "stopping");
+
+            return false;
+        }
+
+        std::string path;
+        unsigned long words = 0;
+
+        if (command == "run") {
+            stream >> path;
+        } else if (command == "image") {
+            stream >> words;
+        } else {
+            Send(id, "error unknown request " + command);
+
+            return false;
+        }
+
+        if (path.empty() && words == 0) {
+            Send(id, "error usage: run PATH [PRIORITY [PAGES]] or image WORDS [PRIORITY [PAGES]]");
+
+            return false;
+        }
+
+        unsigned long priority = 0;
+        unsigned long page_limit = 0;
+        stream >> priority >> page_limit;
+
+        std::string rest;
+        stream.clear();
+        if (stream >> rest) {
+            Send(id, "error unexpected " + rest);
+
+            return false;
+        }
+
+        job.priority = static_cast<Process::process_priority_type>(priority);
+        job.page_limit = page_limit;
+
+        if (command == "run") {
+            job.name = path;
+
+            return true;
+        }
+
+        if (words > MMU::RAM_SIZE) {
+            Send(id, "error the image does not fit in memory");
+        } else {
+            std::ostringstream name;
+            name << "image from client " << id;
+            job.name = name.str();
+
+            client.reading_image = true;
+            client.image_bytes = words * sizeof(int);
+            client.image_job = job;
+        }
+
+        return false;
+    }
+
+    void Daemon::Submit(client_id_type id, Job &job)
+    {
+        if (_shutting_down || _stopping) {
+            Send(id, "error shutting down");
+        } else if (!HasMachines()) {
+            Send(id, "error no machine is running");
+        } else if (_queue.size() >= _options.queue_size) {
+            Send(id, "busy");
+        } else {
+            job.id = ++_last_job_id;
+            job.client = id;
+            job.submitted = clock_type::now();
+
+            _queue.push_back(job);
+
+            std::ostringstream line;
+            line << "queued " << job.id;
+            Send(id, line.str());
+
+            _condition.notify_all();
+        }
+    }
+
+    // Replies to a client that has gone are dropped. The rest wait for
+    // Serve to flush them.
+
+    void Daemon::Send(client_id_type id, const std::string &line)
+    {
+        client_map_type::iterator it = _clients.find(id);
+        if (it == _clients.end()) {
+            return;
+        }
+
+        if (it->second.output.empty()) {
+            Wake();
+        }
+
+        it->second.output += line;
+        it->second.output += '\n';
+    }
+
+    // Sends what the socket takes without blocking. False once the client
+    // has gone.
+
+    bool Daemon::Flush(Client &client)
+    {
+#ifdef DAEMON_SUPPORTED
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+
+        if (client.output.empty()) {
+            return true;
+        }
+
+        ssize_t sent = send(client.socket, client.output.data(), client.output.size(), flags);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+
+        client.output.erase(0, sent);
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // A full pipe means Serve has a wakeup waiting already
+
+    void Daemon::Wake()
+    {
+#ifdef DAEMON_SUPPORTED
+        if (_wakeup[1] != -1) {
+            char byte = 0;
+
+            ssize_t written = write(_wakeup[1], &byte, 1);
+            static_cast<void>(written);
+        }
+#endif
+    }
+
+    // A job that does not fit waits for memory to free up. On an empty
+    // kernel nothing ever will.
+
+    void Daemon::TakeJobs(unsigned int machine, Kernel &kernel)
+    {
+        while (!_queue.empty() && kernel.processes.size() < _options.run_queue_size) {
+            Job &job = _queue.front();
+
+            if (!kernel.CreateProcess(job.name, job.image)) {
+                if (!kernel.processes.empty()) {
+                    break;
+                }
+
+                std::ostringstream line;
+                line << "failed " << job.id;
+                Send(job.client, line.str());
+            } else {
+                Process &process = kernel.processes.back();
+                process.priority = job.priority;
+                process.page_limit = job.page_limit;
+
+                RunningJob &running = _running[std::make_pair(machine, process.id)];
+                running.id = job.id;
+                running.client = job.client;
+                running.started_cycle = kernel.machine.cpu.cycles;
+                running.submitted = job.submitted;
+                running.started = clock_type::now();
+            }
+
+            _queue.pop_front();
+        }
+    }
+
+    // True until every kernel that attached has gone, and before the first
+    // one attaches
+
+    bool Daemon::HasMachines() const
+    {
+        for (std::vector<bool>::const_iterator it = _attached.begin(); it != _attached.end(); ++it) {
+            if (*it) {
+                return true;
+            }
+        }
+
+        return _attached.empty();
+    }
+}
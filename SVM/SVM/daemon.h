@@ -0,0 +1,207 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "kernel.h"
+
+namespace vm
+{
+    // Keeps kernels resident between jobs. Jobs come in over a Unix domain
+    // socket and wait in a bounded queue until a kernel has room in its run
+    // queue. Kernels take them on their timer ticks, or at once while they
+    // have nothing to run, and the result of every job goes back over the
+    // connection that submitted it.
+    //
+    // Requests are lines:
+    //
+    //     run PATH [PRIORITY [PAGES]]      an executable on the host
+    //     image WORDS [PRIORITY [PAGES]]   followed by the words of an executable
+    //     shutdown                         finish the jobs queued, then stop
+    //
+    // and so are the replies:
+    //
+    //     queued JOB, busy (the queue is full, try again later) or error MESSAGE,
+    //                                      also for an image that fails verification
+    //     stopping                         to a shutdown
+    //     done JOB exit=A cycles=N pages=N wait_us=N run_us=N
+    //     killed JOB ...                   the same, for a job that went over PAGES
+    //     failed JOB                       no kernel could load it
+    class Daemon
+    {
+    public:
+        struct Options
+        {
+            // Jobs waiting for a kernel, more are turned away as busy
+
+            unsigned int queue_size;
+
+            // Processes a kernel runs at once, forked ones included
+
+            unsigned int run_queue_size;
+
+            // Of the kernels, which depends on their page size. Images are
+            // verified against it before they are queued.
+
+            MMU::vmem_size_type address_space_size;
+
+            Options();
+        };
+
+        typedef unsigned long long job_id_type;
+
+        explicit Daemon(const Options &options = Options());
+        virtual ~Daemon();
+
+        // Starts taking connections on a thread of its own. A file left
+        // behind at the path by an earlier daemon is replaced. Fails on hosts
+        // without Unix domain sockets.
+
+        bool Listen(const std::string &path);
+
+        // Cycles between two calls to Admit by the same kernel, every call
+        // takes the lock the kernels and the connections share
+
+        static const CPU::cycle_count_type ADMIT_INTERVAL = 256;
+
+        // Called by the kernels, each on its own thread, like the balancer
+
+        unsigned int Attach(Kernel &);
+        void Detach(unsigned int machine);
+
+        // Skips the call when the lock is taken, the jobs wait for the next
+        // one
+
+        void Admit(unsigned int machine, Kernel &kernel);
+
+        // For a kernel with nothing to run. Returns true once it has taken a
+        // job, false after a shutdown request with no jobs left.
+
+        bool WaitForWork(unsigned int machine, Kernel &kernel);
+
+        // Reports the process when it is one of the jobs, before it is unloaded
+
+        void Finish(unsigned int machine, Process &process, int exit_code, bool killed, CPU::cycle_count_type cycles);
+
+        unsigned long long GetJobCount();
+
+    private:
+        typedef std::chrono::steady_clock clock_type;
+        typedef unsigned int client_id_type;
+
+        struct Job
+        {
+            job_id_type id;
+            client_id_type client;
+
+            std::string name;
+            MMU::ram_type image;
+
+            Process::process_priority_type priority;
+            MMU::page_table_size_type page_limit;
+
+            clock_type::time_point submitted;
+
+            Job();
+        };
+
+        struct RunningJob
+        {
+            job_id_type id;
+            client_id_type client;
+
+            CPU::cycle_count_type started_cycle;
+
+            clock_type::time_point submitted;
+            clock_type::time_point started;
+
+            RunningJob();
+        };
+
+        // An image request reads the words after its line before the next
+        // line. Replies wait in "output" until the socket takes them, a
+        // client that lets too many pile up is not read from until it
+        // catches up.
+
+        struct Client
+        {
+            int socket;
+
+            std::string input;
+            std::string output;
+
+            bool reading_image;
+            MMU::ram_size_type image_bytes;
+            Job image_job;
+
+            Client();
+        };
+
+        typedef std::map<client_id_type, Client> client_map_type;
+        typedef std::map<std::pair<unsigned int, Process::process_id_type>, RunningJob> running_job_map_type;
+
+        static const std::string::size_type _MAX_LINE_LENGTH = 4096;
+        static const std::string::size_type _MAX_OUTPUT_LENGTH = 65536;
+
+        Options _options;
+
+        std::string _path;
+        int _socket;
+
+        // A pipe to wake Serve from its poll when there is output to send
+        // or the daemon is stopping
+
+        int _wakeup[2];
+
+        std::thread _thread;
+
+        std::mutex _mutex;
+        std::condition_variable _condition;
+
+        client_map_type _clients;
+        client_id_type _last_client_id;
+
+        std::deque<Job> _queue;
+        running_job_map_type _running;
+
+        std::vector<bool> _attached;
+
+        job_id_type _last_job_id;
+        bool _shutting_down;
+        bool _stopping;
+
+        Daemon(const Daemon &);
+        Daemon &operator=(const Daemon &);
+
+        void Serve();
+
+        // Reads and verifies the program of a job outside of the lock. Jobs
+        // of run requests come without an image, which is read from the
+        // file of their name. Returns an error message, empty on success.
+
+        static std::string Load(Job &job, MMU::vmem_size_type address_space_size);
+
+        // All of the ones below expect the mutex held. Read lets go of it
+        // around Load.
+
+        bool Read(client_id_type id, Client &client, std::unique_lock<std::mutex> &lock);
+        bool Execute(client_id_type id, Client &client, const std::string &line, Job &job);
+        void Submit(client_id_type id, Job &job);
+        void Send(client_id_type id, const std::string &line);
+        bool Flush(Client &client);
+        void Wake();
+
+        void TakeJobs(unsigned int machine, Kernel &kernel);
+        bool HasMachines() const;
+    };
+}
+
+#endif
@@ -0,0 +1,82 @@
+#include "heap.h"
+
+namespace vm
+{
+    Heap::Heap()
+        : _page_size(MMU::DEFAULT_PAGE_SIZE), _page_classes(), _whole_pages(), _allocated_chunks() {}
+
+    Heap::Heap(MMU::page_table_size_type page_count, MMU::ram_size_type page_size)
+        : _page_size(page_size), _page_classes(page_count, 0), _whole_pages(page_count, 0),
+          _allocated_chunks(page_count * page_size / SMALLEST_CLASS_SIZE, 0) {}
+
+    int Heap::SelectClass(int size) const
+    {
+        int size_class = 0;
+        while (size_class < CLASS_COUNT && size > SMALLEST_CLASS_SIZE << size_class) {
+            ++size_class;
+        }
+
+        if (size_class < CLASS_COUNT && static_cast<MMU::ram_size_type>(SMALLEST_CLASS_SIZE << size_class) > _page_size) {
+            return CLASS_COUNT;
+        }
+
+        return size_class;
+    }
+
+    bool Heap::TakeChunk(int size_class, MMU::vmem_size_type &address)
+    {
+        std::vector<MMU::vmem_size_type> &free_chunks = _free_chunks[size_class];
+        if (free_chunks.empty()) {
+            return false;
+        }
+
+        address = free_chunks.back();
+        free_chunks.pop_back();
+
+        _allocated_chunks[address / SMALLEST_CLASS_SIZE] = 1;
+
+        return true;
+    }
+
+    void Heap::AddPage(int size_class, MMU::vmem_size_type address)
+    {
+        _page_classes[address / _page_size] = static_cast<unsigned char>(size_class + 1);
+
+        // Pushed from the end, so that chunks go out in address order
+
+        MMU::ram_size_type chunk_size = SMALLEST_CLASS_SIZE << size_class;
+        for (MMU::ram_size_type offset = _page_size; offset >= chunk_size; offset -= chunk_size) {
+            _free_chunks[size_class].push_back(address + offset - chunk_size);
+        }
+    }
+
+    void Heap::AddWholePages(MMU::vmem_size_type address)
+    {
+        _whole_pages[address / _page_size] = 1;
+    }
+
+    Heap::FreeResult Heap::Free(MMU::vmem_size_type address)
+    {
+        MMU::page_table_size_type page = address / _page_size;
+
+        if (page < _page_classes.size() && _page_classes[page] != 0) {
+            MMU::ram_size_type chunk_size = SMALLEST_CLASS_SIZE << (_page_classes[page] - 1);
+            if (address % chunk_size != 0 || !_allocated_chunks[address / SMALLEST_CLASS_SIZE]) {
+                return NotHandedOut;
+            }
+
+            _allocated_chunks[address / SMALLEST_CLASS_SIZE] = 0;
+            _free_chunks[_page_classes[page] - 1].push_back(address);
+
+            return ChunkFreed;
+        }
+
+        if (page < _whole_pages.size() && _whole_pages[page] && address % _page_size == 0) {
+            _whole_pages[page] = 0;
+
+            return PagesFreed;
+        }
+
+        return NotHandedOut;
+    }
+}
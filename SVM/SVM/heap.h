@@ -0,0 +1,63 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <vector>
+
+#include "mmu.h"
+
+namespace vm
+{
+    // What a process's heap has handed out. Requests up to the largest size
+    // class are carved out of pages kept per class, larger ones take whole
+    // pages. The pages themselves come from the process's block list, which
+    // the kernel keeps. A page split into chunks stays with its class for
+    // the life of the process. Free accepts only what was handed out and has
+    // not been freed since.
+    class Heap
+    {
+    public:
+        static const int CLASS_COUNT = 4;
+        static const int SMALLEST_CLASS_SIZE = 8;
+
+        enum FreeResult
+        {
+            NotHandedOut,
+            ChunkFreed,
+            PagesFreed      // the block at the address goes back to the block list
+        };
+
+        // An empty heap, for a migration to fill
+
+        Heap();
+        Heap(MMU::page_table_size_type page_count, MMU::ram_size_type page_size);
+
+        // The class of a request of "size" words, CLASS_COUNT when it takes
+        // whole pages. Classes larger than a page are left to whole pages.
+
+        int SelectClass(int size) const;
+
+        // False when the class has no free chunk, it needs a page first
+
+        bool TakeChunk(int size_class, MMU::vmem_size_type &address);
+
+        // Splits the page at the address into chunks of the class
+
+        void AddPage(int size_class, MMU::vmem_size_type address);
+
+        // The address is the first of a block handed out whole
+
+        void AddWholePages(MMU::vmem_size_type address);
+
+        FreeResult Free(MMU::vmem_size_type address);
+
+    private:
+        MMU::ram_size_type _page_size;
+
+        std::vector<MMU::vmem_size_type> _free_chunks[CLASS_COUNT];
+        std::vector<unsigned char> _page_classes;  // the class + 1, 0 for pages not split
+        std::vector<unsigned char> _whole_pages;  // 1 for the first page of a block handed out whole
+        std::vector<unsigned char> _allocated_chunks;  // 1 per chunk in use, by address / SMALLEST_CLASS_SIZE
+    };
+}
+
+#endif
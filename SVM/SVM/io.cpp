@@ -0,0 +1,159 @@
+#include "io.h"
+
+namespace vm
+{
+    IOService::Request::Request()
+        : owner(0), tag(0), operation(Read), file(0), offset(0), address(0), data(), result(-1) {}
+
+    IOService::IOService(unsigned int thread_count)
+        : _files(), _thread_count(thread_count == 0 ? 1 : thread_count), _threads(),
+          _submitted(), _completed(), _in_flight(0), _stopping(false) {}
+
+    // Requests still queued are carried out before the threads exit, so that
+    // no write is lost
+
+    IOService::~IOService()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _submitted_condition.notify_all();
+
+        for (std::vector<std::thread>::iterator it = _threads.begin(); it != _threads.end(); ++it) {
+            it->join();
+        }
+
+        for (std::vector<File *>::iterator it = _files.begin(); it != _files.end(); ++it) {
+            if ((*it)->stream) {
+                std::fclose((*it)->stream);
+            }
+            delete *it;
+        }
+    }
+
+    bool IOService::Open(const std::string &path)
+    {
+        std::FILE *stream = std::fopen(path.c_str(), "r+b");
+        if (stream == NULL) {
+            stream = std::fopen(path.c_str(), "w+b");
+        }
+
+        File *file = new File();
+        file->stream = stream;
+        _files.push_back(file);
+
+        return stream != NULL;
+    }
+
+    void IOService::Submit(const Request &request)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            if (_threads.empty()) {
+                for (unsigned int i = 0; i < _thread_count; ++i) {
+                    _threads.push_back(std::thread(&IOService::Work, this));
+                }
+            }
+
+            _submitted.push_back(request);
+            ++_in_flight;
+        }
+        _submitted_condition.notify_one();
+    }
+
+    bool IOService::PollCompletion(Request &request)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_completed.empty()) {
+            return false;
+        }
+
+        request = _completed.front();
+        _completed.pop_front();
+        --_in_flight;
+
+        return true;
+    }
+
+    bool IOService::HasCompletions()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        return !_completed.empty();
+    }
+
+    void IOService::WaitForCompletion()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (_completed.empty() && _in_flight > 0) {
+            _completed_condition.wait(lock);
+        }
+    }
+
+    unsigned int IOService::GetInFlightCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        return _in_flight;
+    }
+
+    void IOService::Work()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        for (;;) {
+            while (_submitted.empty() && !_stopping) {
+                _submitted_condition.wait(lock);
+            }
+
+            if (_submitted.empty()) {
+                return;
+            }
+
+            Request request = _submitted.front();
+            _submitted.pop_front();
+
+            lock.unlock();
+            Execute(request);
+            lock.lock();
+
+            _completed.push_back(request);
+            _completed_condition.notify_all();
+        }
+    }
+
+    // Requests against one file are serialised, since seeking and reading
+    // or writing are two steps on a shared stream
+
+    void IOService::Execute(Request &request)
+    {
+        request.result = -1;
+
+        if (request.file >= _files.size() || _files[request.file]->stream == NULL || request.offset < 0) {
+            return;
+        }
+
+        File &file = *_files[request.file];
+        std::lock_guard<std::mutex> lock(file.mutex);
+
+        if (std::fseek(file.stream, request.offset * static_cast<long>(sizeof(int)), SEEK_SET) != 0) {
+            return;
+        }
+
+        if (request.data.empty()) {
+            request.result = 0;
+        } else if (request.operation == Read) {
+            std::size_t words = std::fread(&request.data[0], sizeof(int), request.data.size(), file.stream);
+            request.data.resize(words);
+            request.result = static_cast<int>(words);
+        } else if (request.operation == Write) {
+            std::size_t words = std::fwrite(&request.data[0], sizeof(int), request.data.size(), file.stream);
+            std::fflush(file.stream);
+            request.result = static_cast<int>(words);
+        }
+    }
+}
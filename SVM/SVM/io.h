@@ -0,0 +1,105 @@
+#ifndef IO_H
+#define IO_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mmu.h"
+
+namespace vm
+{
+    // Host side of guest I/O. Requests run against files opened up front on
+    // a small pool of host threads, which start with the first request. The
+    // kernel collects completions between instructions, so the CPU loop
+    // never waits on the host file system.
+    class IOService
+    {
+    public:
+        enum Operation
+        {
+            Read = 1,
+            Write = 2
+        };
+
+        typedef std::vector<int> data_type;
+
+        struct Request
+        {
+            unsigned int owner;             // the process id
+            int tag;                        // handed back with the completion
+
+            Operation operation;
+            unsigned int file;
+            long offset;                    // in words
+
+            MMU::vmem_size_type address;    // the guest buffer
+            data_type data;                 // the words to write, or the words read
+
+            int result;                     // words transferred, -1 on error
+
+            Request();
+        };
+
+        static const unsigned int DEFAULT_THREAD_COUNT = 2;
+
+        explicit IOService(unsigned int thread_count = DEFAULT_THREAD_COUNT);
+        virtual ~IOService();
+
+        // Opens the file for reading and writing, creating it if needed. It
+        // takes the next index even when it fails to open, so that indices
+        // stay in the order files were given; requests against it then fail.
+
+        bool Open(const std::string &path);
+
+        unsigned int GetFileCount() const { return static_cast<unsigned int>(_files.size()); }
+
+        void Submit(const Request &request);
+
+        // Neither blocks
+
+        bool PollCompletion(Request &request);
+        bool HasCompletions();
+
+        // Blocks until a completion is ready, returns at once when nothing
+        // is in flight
+
+        void WaitForCompletion();
+
+        unsigned int GetInFlightCount();
+
+    private:
+        struct File
+        {
+            std::FILE *stream;
+            std::mutex mutex;
+        };
+
+        std::vector<File *> _files;
+
+        unsigned int _thread_count;
+        std::vector<std::thread> _threads;
+
+        std::mutex _mutex;
+        std::condition_variable _submitted_condition;
+        std::condition_variable _completed_condition;
+
+        std::deque<Request> _submitted;
+        std::deque<Request> _completed;
+
+        unsigned int _in_flight;
+        bool _stopping;
+
+        IOService(const IOService &);
+        IOService &operator=(const IOService &);
+
+        void Work();
+        void Execute(Request &request);
+    };
+}
+
+#endif
@@ -0,0 +1,714 @@
+#include "jit.h"
+#include "cpu.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_SUPPORTED
+#endif
+
+#ifdef JIT_SUPPORTED
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace vm
+{
+    // Everything translated code reads or writes goes through this record,
+    // addressed by r11 for the whole time a chain of blocks runs
+
+    struct Jit::State
+    {
+        int registers[3];
+
+        unsigned int ip;
+        unsigned int exit_reason;
+        unsigned int address;
+
+        long long budget;
+
+        const MMU::page_entry_type *page_table;
+        int *ram;
+        const unsigned char *code_frames;
+        const unsigned char *shared_frames;
+
+        Block *exit_block;
+    };
+
+    namespace
+    {
+        typedef std::vector<unsigned char> code_buffer_type;
+
+        void EmitByte(code_buffer_type &code, unsigned int value)
+        {
+            code.push_back(static_cast<unsigned char>(value));
+        }
+
+        void EmitDword(code_buffer_type &code, unsigned int value)
+        {
+            for (int i = 0; i < 4; ++i) {
+                EmitByte(code, (value >> (i * 8)) & 0xFF);
+            }
+        }
+
+        void EmitQword(code_buffer_type &code, unsigned long long value)
+        {
+            EmitDword(code, static_cast<unsigned int>(value));
+            EmitDword(code, static_cast<unsigned int>(value >> 32));
+        }
+
+        // Emits a 32-bit relative jump (0x0F 0x8x for conditional ones) and
+        // returns the position of its displacement for PatchJump
+
+        code_buffer_type::size_type EmitJump(code_buffer_type &code, unsigned int condition)
+        {
+            if (condition) {
+                EmitByte(code, 0x0F);
+                EmitByte(code, condition);
+            } else {
+                EmitByte(code, 0xE9);
+            }
+
+            code_buffer_type::size_type position = code.size();
+            EmitDword(code, 0);
+
+            return position;
+        }
+
+        void PatchJump(code_buffer_type &code, code_buffer_type::size_type position, code_buffer_type::size_type target)
+        {
+            unsigned int displacement = static_cast<unsigned int>(target - (position + 4));
+            for (int i = 0; i < 4; ++i) {
+                code[position + i] = static_cast<unsigned char>((displacement >> (i * 8)) & 0xFF);
+            }
+        }
+
+        const unsigned int JZ = 0x84;
+        const unsigned int JNZ = 0x85;
+        const unsigned int JL = 0x8C;
+
+        // r8d, r9d or r10d <-> [r11 + offset]
+
+        void EmitGuestRegisterTransfer(code_buffer_type &code, bool store, int index, std::size_t offset)
+        {
+            EmitByte(code, 0x45);
+            EmitByte(code, store ? 0x89 : 0x8B);
+            EmitByte(code, 0x83 | (index << 3));
+            EmitDword(code, static_cast<unsigned int>(offset + index * sizeof(int)));
+        }
+
+        // op qword [r11 + offset], imm32 where "extension" selects add (0), sub (5) or cmp (7)
+
+        void EmitStateArithmetic(code_buffer_type &code, int extension, std::size_t offset, unsigned int value)
+        {
+            EmitByte(code, 0x49);
+            EmitByte(code, 0x81);
+            EmitByte(code, 0x83 | (extension << 3));
+            EmitDword(code, static_cast<unsigned int>(offset));
+            EmitDword(code, value);
+        }
+
+        // mov dword [r11 + offset], imm32
+
+        void EmitStateStore(code_buffer_type &code, std::size_t offset, unsigned int value)
+        {
+            EmitByte(code, 0x41);
+            EmitByte(code, 0xC7);
+            EmitByte(code, 0x83);
+            EmitDword(code, static_cast<unsigned int>(offset));
+            EmitDword(code, value);
+        }
+
+        // mov rax or rdx, [r11 + offset]
+
+        void EmitStateLoad(code_buffer_type &code, bool rdx, std::size_t offset)
+        {
+            EmitByte(code, 0x49);
+            EmitByte(code, 0x8B);
+            EmitByte(code, rdx ? 0x93 : 0x83);
+            EmitDword(code, static_cast<unsigned int>(offset));
+        }
+
+        bool IsLoad(int opcode)
+        {
+            return opcode >= CPU::LDA_BASE_OPCODE && opcode <= CPU::LDC_BASE_OPCODE;
+        }
+
+        bool IsStore(int opcode)
+        {
+            return opcode >= CPU::STA_BASE_OPCODE && opcode <= CPU::STC_BASE_OPCODE;
+        }
+
+        bool IsMove(int opcode)
+        {
+            return opcode >= CPU::MOVA_BASE_OPCODE && opcode <= CPU::MOVC_BASE_OPCODE;
+        }
+    }
+
+    Jit::Jit()
+        : _code(NULL), _code_used(0), _page_shift(0), _blocks(), _execution_counts(), _coverage(), _resume_ip(NO_RESUME_IP),
+          _code_frames(), _code_writes(), _frame_blocks()
+    {
+#ifdef JIT_SUPPORTED
+#ifdef _WIN32
+        _code = static_cast<unsigned char *>(VirtualAlloc(NULL, CODE_CACHE_SIZE, MEM_COMMIT | MEM_RESERVE,
+                                                          PAGE_EXECUTE_READWRITE));
+#else
+        void *code = mmap(NULL, CODE_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code != MAP_FAILED) {
+            _code = static_cast<unsigned char *>(code);
+        }
+#endif
+#endif
+    }
+
+    Jit::~Jit()
+    {
+        Flush();
+
+#ifdef JIT_SUPPORTED
+        if (_code) {
+#ifdef _WIN32
+            VirtualFree(_code, 0, MEM_RELEASE);
+#else
+            munmap(_code, CODE_CACHE_SIZE);
+#endif
+        }
+#endif
+    }
+
+    bool Jit::IsAvailable() const
+    {
+        return _code != NULL;
+    }
+
+    Jit::cycle_count_type Jit::Run(MMU &mmu, Registers &registers, cycle_count_type budget, Exit &exit)
+    {
+        exit.reason = BlockExit;
+        exit.address = 0;
+
+        if (!_code) {
+            return 0;
+        }
+
+        if (_blocks.size() != mmu.ram.size() || _page_shift != mmu.GetPageShift()) {
+            Flush();
+
+            _page_shift = mmu.GetPageShift();
+
+            _blocks.assign(mmu.ram.size(), NULL);
+            _execution_counts.assign(mmu.ram.size(), 0);
+            _coverage.assign(mmu.ram.size(), 0);
+            _code_frames.assign((mmu.ram.size() >> _page_shift) + 1, 0);
+            _code_writes.assign(_code_frames.size(), 0);
+            _frame_blocks.assign(_code_frames.size(), std::vector<Block *>());
+        }
+
+        Block *block = Find(mmu.ram, registers.ip);
+        if (!block) {
+            return 0;
+        }
+
+        const long long max_budget = std::numeric_limits<long long>::max();
+
+        State state;
+        state.registers[0] = registers.a;
+        state.registers[1] = registers.b;
+        state.registers[2] = registers.c;
+        state.ip = registers.ip;
+        state.exit_reason = BlockExit;
+        state.address = 0;
+        state.budget = budget > static_cast<cycle_count_type>(max_budget) ? max_budget : static_cast<long long>(budget);
+        state.page_table = &(*mmu.page_table)[0];
+        state.ram = &mmu.ram[0];
+        state.code_frames = &_code_frames[0];
+        state.shared_frames = &mmu.shared_frames[0];
+        state.exit_block = NULL;
+
+        long long initial_budget = state.budget;
+
+        reinterpret_cast<entry_type>(block->entry)(&state);
+
+        registers.a = state.registers[0];
+        registers.b = state.registers[1];
+        registers.c = state.registers[2];
+        registers.ip = state.ip;
+
+        exit.reason = static_cast<ExitReason>(state.exit_reason);
+        exit.address = state.address;
+
+        // A block jumped somewhere not translated at the time. Link the two as
+        // soon as the target is compiled, so the next pass stays native. The
+        // compile may flush the cache, hence the second lookup of the source.
+
+        if (state.exit_block) {
+            MMU::ram_size_type source_ip = state.exit_block->begin;
+
+            Block *target = Find(mmu.ram, state.ip);
+            Block *source = _blocks[source_ip];
+            if (source && target) {
+                Link(source, target);
+            }
+        } else {
+            _resume_ip = state.ip;
+        }
+
+        return static_cast<cycle_count_type>(initial_budget - state.budget);
+    }
+
+    void Jit::Invalidate(MMU::ram_size_type begin, MMU::ram_size_type end)
+    {
+        if (begin >= end || _code_frames.empty()) {
+            return;
+        }
+
+        end = std::min(end, static_cast<MMU::ram_size_type>(_blocks.size()));
+        if (begin >= end) {
+            return;
+        }
+
+        for (MMU::ram_size_type frame = begin >> _page_shift; frame <= (end - 1) >> _page_shift; ++frame) {
+            std::vector<Block *> blocks(_frame_blocks[frame]);
+            for (std::vector<Block *>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+                Remove(*it);
+            }
+
+            _code_frames[frame] = 0;
+            _code_writes[frame] = 0;
+        }
+
+        std::fill(_execution_counts.begin() + begin, _execution_counts.begin() + end, 0);
+    }
+
+    void Jit::CodeWritten(MMU::ram_size_type begin, MMU::ram_size_type end)
+    {
+        if (begin >= end) {
+            return;
+        }
+
+        for (MMU::ram_size_type frame = begin >> _page_shift; frame <= (end - 1) >> _page_shift && frame < _code_frames.size(); ++frame) {
+            if (!_code_frames[frame]) {
+                continue;
+            }
+
+            unsigned int writes = _code_writes[frame];
+
+            Invalidate(std::max(begin, frame << _page_shift), std::min(end, (frame + 1) << _page_shift));
+
+            _code_writes[frame] = static_cast<unsigned char>(writes < MAX_CODE_WRITES ? writes + 1 : writes);
+        }
+    }
+
+    Jit::Block *Jit::Find(const MMU::ram_type &ram, MMU::ram_size_type ip)
+    {
+        if (ip >= _blocks.size()) {
+            return NULL;
+        }
+
+        Block *block = _blocks[ip];
+        if (!block && _coverage[ip] && ip >= _resume_ip) {
+            _resume_ip = ip;
+
+            return NULL;
+        }
+        _resume_ip = NO_RESUME_IP;
+
+        if (!block && ++_execution_counts[ip] >= HOT_BLOCK_THRESHOLD) {
+            _execution_counts[ip] = 0;
+
+            block = Compile(ram, ip);
+        }
+
+        return block;
+    }
+
+    // Register use inside a block:
+    //
+    //     r8d, r9d, r10d    guest a, b, c
+    //     r11               State
+    //     rax, rcx, rdx     scratch
+    //
+    // All of them are volatile in both the System V and the Windows x64 calling
+    // conventions, and blocks never touch the stack, so no prologue is needed.
+
+    Jit::Block *Jit::Compile(const MMU::ram_type &ram, MMU::ram_size_type ip)
+    {
+        struct SideExit
+        {
+            code_buffer_type::size_type jump;
+
+            ExitReason reason;
+            unsigned int ip;
+            unsigned int address;
+            unsigned int refund;
+        };
+
+        struct Instruction
+        {
+            MMU::ram_size_type ip;
+            int opcode;
+            int data;
+
+            unsigned int step;
+        };
+
+        // Find the extent of the block first: side exits refund the budget of
+        // the instructions they skip, so the step count has to be known upfront.
+        // A fused opcode translates as its first half, the second half follows
+        // in place as a plain instruction, and the pair counts as one step just
+        // like in the interpreter.
+
+        if (_code_writes[ip >> _page_shift] >= MAX_CODE_WRITES) {
+            return NULL;
+        }
+
+        std::vector<Instruction> instructions;
+
+        MMU::ram_size_type next_ip = ip;
+        unsigned int steps = 0;
+        bool jumps = false;
+        bool second_half = false;
+
+        while (next_ip + 1 < ram.size() && (second_half || steps < MAX_BLOCK_INSTRUCTIONS)) {
+            Instruction instruction;
+            instruction.ip = next_ip;
+            instruction.opcode = ram[next_ip];
+            instruction.data = ram[next_ip + 1];
+            instruction.step = steps;
+
+            int opcode = instruction.opcode;
+            bool first_half = false;
+
+            if (opcode >= CPU::MOVA_STA_FUSED_OPCODE && opcode <= CPU::MOVC_STC_FUSED_OPCODE) {
+                instruction.opcode = CPU::MOVA_BASE_OPCODE + (opcode - CPU::MOVA_STA_FUSED_OPCODE);
+                first_half = true;
+            } else if (opcode >= CPU::LDA_STA_FUSED_OPCODE && opcode <= CPU::LDC_STC_FUSED_OPCODE) {
+                instruction.opcode = CPU::LDA_BASE_OPCODE + (opcode - CPU::LDA_STA_FUSED_OPCODE);
+                first_half = true;
+            } else if (opcode >= CPU::LDA_LDA_FUSED_OPCODE && opcode <= CPU::LDC_LDC_FUSED_OPCODE) {
+                instruction.opcode = CPU::LDA_BASE_OPCODE + (opcode - CPU::LDA_LDA_FUSED_OPCODE) / 3;
+                first_half = true;
+            } else if (opcode == CPU::JMP_BASE_OPCODE) {
+                if (second_half) {
+                    break;
+                }
+
+                jumps = true;
+            } else if (!IsMove(opcode) && !IsLoad(opcode) && !IsStore(opcode)) {
+                break;
+            }
+
+            if (first_half && second_half) {
+                break;
+            }
+
+            instructions.push_back(instruction);
+            next_ip += 2;
+
+            if (first_half) {
+                second_half = true;
+            } else {
+                second_half = false;
+                ++steps;
+            }
+
+            if (jumps) {
+                next_ip = instruction.ip + instruction.data;
+
+                break;
+            }
+        }
+
+        // A pair cut in half at the end of memory is left to the interpreter
+
+        if (second_half) {
+            instructions.pop_back();
+            next_ip -= 2;
+        }
+
+        if (instructions.empty()) {
+            return NULL;
+        }
+
+        Block *block = new Block();
+        block->begin = ip;
+        block->end = instructions.back().ip + 2;
+        block->next_entry = NULL;
+        block->next_ip = next_ip;
+
+        code_buffer_type code;
+        std::vector<SideExit> side_exits;
+
+        // Entry from Run: the state pointer arrives in rcx on Windows and in rdi elsewhere
+
+        EmitByte(code, 0x49);
+        EmitByte(code, 0x89);
+#ifdef _WIN32
+        EmitByte(code, 0xCB);
+#else
+        EmitByte(code, 0xFB);
+#endif
+        for (int i = 0; i < 3; ++i) {
+            EmitGuestRegisterTransfer(code, false, i, offsetof(State, registers));
+        }
+
+        // Entry from another block. Leave before the first instruction when the
+        // rest of the budget can not cover the whole block.
+
+        code_buffer_type::size_type chained_entry = code.size();
+
+        EmitStateArithmetic(code, 7, offsetof(State, budget), steps);
+
+        SideExit budget_exit = { EmitJump(code, JL), BlockExit, static_cast<unsigned int>(ip), 0, 0 };
+        side_exits.push_back(budget_exit);
+
+        EmitStateArithmetic(code, 5, offsetof(State, budget), steps);
+
+        for (std::vector<Instruction>::const_iterator it = instructions.begin(); it != instructions.end(); ++it) {
+            unsigned int refund = steps - (it->step + 1);
+
+            if (IsMove(it->opcode)) {
+
+                // mov r8d + index, imm32
+
+                EmitByte(code, 0x41);
+                EmitByte(code, 0xB8 + (it->opcode - CPU::MOVA_BASE_OPCODE));
+                EmitDword(code, static_cast<unsigned int>(it->data));
+            } else if (IsLoad(it->opcode) || IsStore(it->opcode)) {
+                MMU::vmem_size_type address = static_cast<MMU::vmem_size_type>(it->data);
+                MMU::page_table_size_type page = address >> _page_shift;
+                MMU::ram_size_type offset = address & ((static_cast<MMU::vmem_size_type>(1) << _page_shift) - 1);
+
+                // mov rax, [r11 + page_table]; mov rax, [rax + page * 8]; test rax, rax
+
+                EmitStateLoad(code, false, offsetof(State, page_table));
+                EmitByte(code, 0x48);
+                EmitByte(code, 0x8B);
+                EmitByte(code, 0x80);
+                EmitDword(code, static_cast<unsigned int>(page * sizeof(MMU::page_entry_type)));
+                EmitByte(code, 0x48);
+                EmitByte(code, 0x85);
+                EmitByte(code, 0xC0);
+
+                SideExit fault_exit = { EmitJump(code, JZ), PageFaultExit, static_cast<unsigned int>(it->ip),
+                                        static_cast<unsigned int>(address), refund };
+                side_exits.push_back(fault_exit);
+
+                if (IsStore(it->opcode)) {
+
+                    // Shared frames are copied on the first write, before it lands:
+                    // mov rcx, rax; shr rcx, log2(page size); mov rdx, [r11 + shared_frames];
+                    // cmp byte [rdx + rcx], 0
+
+                    EmitByte(code, 0x48);
+                    EmitByte(code, 0x89);
+                    EmitByte(code, 0xC1);
+                    EmitByte(code, 0x48);
+                    EmitByte(code, 0xC1);
+                    EmitByte(code, 0xE9);
+                    EmitByte(code, _page_shift);
+                    EmitStateLoad(code, true, offsetof(State, shared_frames));
+                    EmitByte(code, 0x80);
+                    EmitByte(code, 0x3C);
+                    EmitByte(code, 0x0A);
+                    EmitByte(code, 0x00);
+
+                    SideExit write_exit = { EmitJump(code, JNZ), WriteFaultExit, static_cast<unsigned int>(it->ip),
+                                            static_cast<unsigned int>(address), refund };
+                    side_exits.push_back(write_exit);
+                }
+
+                // mov rdx, [r11 + ram]; then mov between the guest register and
+                // [rdx + rax * 4 + offset * 4]
+
+                EmitStateLoad(code, true, offsetof(State, ram));
+
+                int index = IsLoad(it->opcode) ? it->opcode - CPU::LDA_BASE_OPCODE : it->opcode - CPU::STA_BASE_OPCODE;
+
+                EmitByte(code, 0x44);
+                EmitByte(code, IsLoad(it->opcode) ? 0x8B : 0x89);
+                EmitByte(code, 0x84 | (index << 3));
+                EmitByte(code, 0x82);
+                EmitDword(code, static_cast<unsigned int>(offset * sizeof(int)));
+
+                if (IsStore(it->opcode)) {
+
+                    // shr rax, log2(page size); mov rdx, [r11 + code_frames]; cmp byte [rdx + rax], 0
+
+                    EmitByte(code, 0x48);
+                    EmitByte(code, 0xC1);
+                    EmitByte(code, 0xE8);
+                    EmitByte(code, _page_shift);
+                    EmitStateLoad(code, true, offsetof(State, code_frames));
+                    EmitByte(code, 0x80);
+                    EmitByte(code, 0x3C);
+                    EmitByte(code, 0x02);
+                    EmitByte(code, 0x00);
+
+                    SideExit code_write_exit = { EmitJump(code, JNZ), CodeWriteExit,
+                                                 static_cast<unsigned int>(it->ip + 2),
+                                                 static_cast<unsigned int>(offset), refund };
+                    side_exits.push_back(code_write_exit);
+                }
+            }
+        }
+
+        // Chain to the next block: mov rax, &block->next_entry; mov rax, [rax];
+        // test rax, rax; jz miss; jmp rax
+
+        EmitByte(code, 0x48);
+        EmitByte(code, 0xB8);
+        EmitQword(code, reinterpret_cast<unsigned long long>(&block->next_entry));
+        EmitByte(code, 0x48);
+        EmitByte(code, 0x8B);
+        EmitByte(code, 0x00);
+        EmitByte(code, 0x48);
+        EmitByte(code, 0x85);
+        EmitByte(code, 0xC0);
+
+        code_buffer_type::size_type chain_miss = EmitJump(code, JZ);
+
+        EmitByte(code, 0xFF);
+        EmitByte(code, 0xE0);
+
+        // The miss reports the block through exit_block, so Run can link it
+
+        std::vector<code_buffer_type::size_type> epilogue_jumps;
+
+        PatchJump(code, chain_miss, code.size());
+        EmitStateStore(code, offsetof(State, ip), static_cast<unsigned int>(next_ip));
+        EmitByte(code, 0x48);
+        EmitByte(code, 0xB8);
+        EmitQword(code, reinterpret_cast<unsigned long long>(block));
+        EmitByte(code, 0x49);
+        EmitByte(code, 0x89);
+        EmitByte(code, 0x83);
+        EmitDword(code, static_cast<unsigned int>(offsetof(State, exit_block)));
+        epilogue_jumps.push_back(EmitJump(code, 0));
+
+        for (std::vector<SideExit>::const_iterator it = side_exits.begin(); it != side_exits.end(); ++it) {
+            PatchJump(code, it->jump, code.size());
+
+            if (it->refund) {
+                EmitStateArithmetic(code, 0, offsetof(State, budget), it->refund);
+            }
+
+            EmitStateStore(code, offsetof(State, ip), it->ip);
+            EmitStateStore(code, offsetof(State, exit_reason), it->reason);
+
+            if (it->reason == PageFaultExit || it->reason == WriteFaultExit) {
+                EmitStateStore(code, offsetof(State, address), it->address);
+            } else if (it->reason == CodeWriteExit) {
+
+                // Rebuild the physical address from the frame index left in rax:
+                // shl rax, log2(page size); add rax, offset; mov [r11 + address], eax
+
+                EmitByte(code, 0x48);
+                EmitByte(code, 0xC1);
+                EmitByte(code, 0xE0);
+                EmitByte(code, _page_shift);
+                EmitByte(code, 0x48);
+                EmitByte(code, 0x05);
+                EmitDword(code, it->address);
+                EmitByte(code, 0x41);
+                EmitByte(code, 0x89);
+                EmitByte(code, 0x83);
+                EmitDword(code, static_cast<unsigned int>(offsetof(State, address)));
+            }
+
+            epilogue_jumps.push_back(EmitJump(code, 0));
+        }
+
+        for (std::vector<code_buffer_type::size_type>::const_iterator it = epilogue_jumps.begin();
+             it != epilogue_jumps.end(); ++it) {
+            PatchJump(code, *it, code.size());
+        }
+
+        for (int i = 0; i < 3; ++i) {
+            EmitGuestRegisterTransfer(code, true, i, offsetof(State, registers));
+        }
+        EmitByte(code, 0xC3);
+
+        // Blocks are never freed one by one. Once the cache is full, everything
+        // is thrown away and hot code gets translated again.
+
+        if (_code_used + code.size() > CODE_CACHE_SIZE) {
+            Flush();
+        }
+
+        unsigned char *entry = _code + _code_used;
+        std::memcpy(entry, &code[0], code.size());
+        _code_used += static_cast<unsigned int>(code.size());
+
+        block->entry = entry;
+        block->chained_entry = entry + chained_entry;
+
+        _blocks[ip] = block;
+        for (MMU::ram_size_type word = block->begin; word < block->end; ++word) {
+            ++_coverage[word];
+        }
+        for (MMU::ram_size_type frame = block->begin >> _page_shift; frame <= (block->end - 1) >> _page_shift; ++frame) {
+            _code_frames[frame] = 1;
+            _frame_blocks[frame].push_back(block);
+        }
+
+        return block;
+    }
+
+    void Jit::Link(Block *source, Block *target)
+    {
+        if (source->next_entry == NULL && source->next_ip == target->begin) {
+            source->next_entry = target->chained_entry;
+            target->incoming.push_back(source);
+        }
+    }
+
+    void Jit::Remove(Block *block)
+    {
+        for (std::vector<Block *>::iterator it = block->incoming.begin(); it != block->incoming.end(); ++it) {
+            (*it)->next_entry = NULL;
+        }
+
+        if (block->next_entry) {
+            std::vector<Block *> &incoming = _blocks[block->next_ip]->incoming;
+            incoming.erase(std::remove(incoming.begin(), incoming.end(), block), incoming.end());
+        }
+
+        for (MMU::ram_size_type frame = block->begin >> _page_shift; frame <= (block->end - 1) >> _page_shift; ++frame) {
+            std::vector<Block *> &blocks = _frame_blocks[frame];
+            blocks.erase(std::remove(blocks.begin(), blocks.end(), block), blocks.end());
+        }
+
+        for (MMU::ram_size_type word = block->begin; word < block->end; ++word) {
+            --_coverage[word];
+        }
+
+        _blocks[block->begin] = NULL;
+
+        delete block;
+    }
+
+    void Jit::Flush()
+    {
+        for (std::vector<Block *>::iterator it = _blocks.begin(); it != _blocks.end(); ++it) {
+            delete *it;
+            *it = NULL;
+        }
+
+        std::fill(_coverage.begin(), _coverage.end(), 0);
+        std::fill(_code_frames.begin(), _code_frames.end(), 0);
+        for (std::vector<std::vector<Block *> >::iterator it = _frame_blocks.begin(); it != _frame_blocks.end(); ++it) {
+            it->clear();
+        }
+
+        _code_used = 0;
+    }
+}
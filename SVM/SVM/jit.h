@@ -0,0 +1,157 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <vector>
+
+#include "mmu.h"
+
+namespace vm
+{
+    struct Registers;
+
+    // Translates hot basic blocks of verified images to native x86-64 code.
+    // Blocks are keyed by physical address, end at a JMP (inclusive) or an INT
+    // (exclusive) and jump straight into each other once both sides are
+    // compiled. Guest registers a, b and c live in r8d, r9d and r10d while
+    // translated code runs. On other hosts the JIT is never available and the
+    // CPU keeps interpreting.
+    class Jit
+    {
+    public:
+        typedef unsigned long long cycle_count_type;
+
+        enum ExitReason
+        {
+            BlockExit,       // ran off the end of a block or out of budget
+            PageFaultExit,   // "address" is not mapped, ip points at the faulting instruction
+            CodeWriteExit,   // "address" is a physical word holding translated code
+            WriteFaultExit   // "address" is mapped to a shared frame, ip points at the store
+        };
+
+        struct Exit
+        {
+            ExitReason reason;
+            MMU::vmem_size_type address;
+        };
+
+        static const unsigned int HOT_BLOCK_THRESHOLD = 16;
+        static const unsigned int MAX_BLOCK_INSTRUCTIONS = 64;
+        static const unsigned int CODE_CACHE_SIZE = 1 << 20; // 1 MB
+
+        // Below this many instructions to the next timer interrupt, entering
+        // translated code costs more than interpreting
+
+        static const unsigned int MIN_BUDGET = 16;
+
+        // Timer period for runs with the JIT that do not choose one. The
+        // default period of one cycle never leaves MIN_BUDGET.
+
+        static const unsigned int DEFAULT_TIMER_PERIOD = 16 * MIN_BUDGET;
+
+        // Frames written this many times while holding translated code are
+        // left to the interpreter until their image is invalidated as a whole
+
+        static const unsigned int MAX_CODE_WRITES = 4;
+
+        Jit();
+        virtual ~Jit();
+
+        bool IsAvailable() const;
+
+        // Runs translated code from registers.ip for at most "budget" guest
+        // instructions. Returns the number of instructions retired, including
+        // a faulting one; zero means the block is not translated (yet) and the
+        // instruction has to be interpreted.
+
+        cycle_count_type Run(MMU &mmu, Registers &registers, cycle_count_type budget, Exit &exit);
+
+        bool IsCodeFrame(MMU::ram_size_type physical_address) const
+        {
+            MMU::ram_size_type frame = physical_address >> _page_shift;
+
+            return frame < _code_frames.size() && _code_frames[frame] != 0;
+        }
+
+        // Drops every block overlapping [begin, end) of physical memory
+
+        void Invalidate(MMU::ram_size_type begin, MMU::ram_size_type end);
+
+        // Called after a guest store into a frame for which IsCodeFrame holds
+
+        void CodeWritten(MMU::ram_size_type physical_address)
+        {
+            CodeWritten(physical_address, physical_address + 1);
+        }
+
+        // Called after a bulk write to [begin, end) of physical memory, which
+        // may cover any number of frames, code or not
+
+        void CodeWritten(MMU::ram_size_type begin, MMU::ram_size_type end);
+
+        // Called when a process is switched in, it goes on where it was cut,
+        // maybe inside a block
+
+        void Resume(MMU::ram_size_type ip)
+        {
+            _resume_ip = ip;
+        }
+
+    private:
+        struct Block;
+
+        typedef void (*entry_type)(void *state);
+
+        struct Block
+        {
+            MMU::ram_size_type begin, end;
+
+            unsigned char *entry;
+            unsigned char *chained_entry;
+
+            // Filled in once the block jumped to is compiled
+
+            unsigned char *next_entry;
+            MMU::ram_size_type next_ip;
+
+            std::vector<Block *> incoming;
+        };
+
+        struct State;
+
+        unsigned char *_code;
+        unsigned int _code_used;
+
+        // Code frames are tracked per page of the machine last run
+
+        unsigned int _page_shift;
+
+        std::vector<Block *> _blocks;
+        std::vector<unsigned int> _execution_counts;
+
+        // Blocks holding each word. A block short of budget or stopped by a
+        // fault leaves the interpreter at "_resume_ip", inside translated
+        // code. Stepping on from there through covered words does not count,
+        // otherwise every point the timer cuts would turn hot and get a
+        // block of its own. Going back, or off covered code, ends the run.
+
+        static const MMU::ram_size_type NO_RESUME_IP = static_cast<MMU::ram_size_type>(-1);
+
+        std::vector<unsigned short> _coverage;
+        MMU::ram_size_type _resume_ip;
+        std::vector<unsigned char> _code_frames;
+        std::vector<unsigned char> _code_writes;
+        std::vector<std::vector<Block *> > _frame_blocks;
+
+        Block *Compile(const MMU::ram_type &ram, MMU::ram_size_type ip);
+        Block *Find(const MMU::ram_type &ram, MMU::ram_size_type ip);
+
+        void Link(Block *source, Block *target);
+        void Remove(Block *block);
+        void Flush();
+
+        Jit(const Jit &);
+        Jit &operator=(const Jit &);
+    };
+}
+
+#endif
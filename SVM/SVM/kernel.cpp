@@ -1,19 +1,76 @@
 #include "kernel.h"
+#include "verifier.h"
+#include "balancer.h"
+#include "daemon.h"
 
 #include <iostream>
 #include <string>
 #include <fstream>
 #include <algorithm>
 #include <limits>
+#include <sstream>
+#include <chrono>
 
 namespace vm
 {
-    Kernel::Kernel(Scheduler scheduler, std::vector<std::string> executables_paths)
-        : machine(), processes(), priorities(), scheduler(scheduler),
+    Kernel::Arrival::Arrival()
+        : cycle(0), name(), image(), priority(0) {}
+
+    Kernel::Options::Options()
+        : tracer(NULL), profiler(NULL), jit(NULL), timer_frequency(PIT::DEFAULT_FREQUENCY), cycle_limit(0),
+          start_machine(true), files(), io_threads(IOService::DEFAULT_THREAD_COUNT), compaction_pages(16),
+          page_size(MMU::DEFAULT_PAGE_SIZE), huge_pages(true), zeroed_frames(16),
+          quantum(DEFAULT_QUANTUM), arrivals(), record_processes(false),
+          balancer(NULL), daemon(NULL) {}
+
+    Kernel::Statistics::Statistics()
+        : page_faults(0), copy_on_write_faults(0), forks(0), io_requests(0), compacted_pages(0), huge_pages(0),
+          zeroed_frames(0), migrations(0), migrated_pages(0), context_switches(0), context_switch_nanoseconds(0),
+          idle_cycles(0) {}
+
+    Kernel::ProcessRecord::ProcessRecord()
+        : id(0), name(), priority(0), arrival_cycle(0), first_run_cycle(0), exit_cycle(0), run_cycles(0), started(false) {}
+
+    Kernel::Migration::Migration(const MMU &mmu)
+        : process(0, 0, 0, mmu), image(), pages(), has_heap(false), heap(), name() {}
+
+    Kernel::Kernel(Scheduler scheduler, std::vector<std::string> executables_paths, const Options &options)
+        : machine(options.page_size), processes(), priorities(), scheduler(scheduler), statistics(), records(),
+          _segments(machine.mmu), _io(options.io_threads), _io_rings(_io), _heaps(),
           _last_issued_process_id(0),
 		  _current_process_index(0), 
-		  _cycles_passed_after_preemption(0)
+		  _cycles_passed_after_preemption(0), _quantum(options.quantum),
+          _tracer(options.tracer), _profiler(options.profiler), _jit(options.jit),
+          _cycle_limit(options.cycle_limit),
+          _compaction_pages(options.compaction_pages),
+          _huge_pages(options.huge_pages),
+          _zeroed_frames(options.zeroed_frames),
+          _balancer(options.balancer), _balancer_machine(0), _next_balance_cycle(0), _migrated_pages(),
+          _daemon(options.daemon), _daemon_machine(0), _next_admission_cycle(0),
+          _arrivals(options.arrivals), _next_arrival(0),
+          _record_processes(options.record_processes), _process_records(),
+          _dispatched(false), _dispatched_process_id(0), _dispatch_cycle(0)
     {
+        if (!MMU::IsValidPageSize(options.page_size)) {
+            std::cerr << "Kernel: invalid page size (" << options.page_size << "), using "
+                      << machine.mmu.GetPageSize() << " words." << std::endl;
+        }
+
+        machine.cpu.tracer = _tracer;
+        machine.cpu.profiler = _profiler;
+
+        if (_profiler) {
+            _profiler->SetPageSize(machine.mmu.GetPageSize());
+        }
+
+        if (_jit && _jit->IsAvailable()) {
+            machine.cpu.jit = _jit;
+        } else {
+            _jit = NULL;
+        }
+
+        machine.pit.frequency = options.timer_frequency;
+
         // Memory
 
 		machine.mmu.ram[0] = _free_physical_memory_index = 0;
@@ -22,23 +79,35 @@ namespace vm
 		//this->page_table = MMU::CreateEmptyPageTable();
 		//this->blocklist = MMU::CreateNewVMBlockList();
 
-        // Process page faults (find an empty frame)
-        machine.pic.isr_4 = [&]() {
-            std::cout << "Kernel: page fault." << std::endl;
+        // Interrupts
 
-			MMU::page_entry_type page = machine.cpu.registers.a;
+        machine.pic.SetHandler(PIC::TIMER_VECTOR, &Kernel::TimerInterrupt, this);
+        machine.pic.SetHandler(PIC::PAGE_FAULT_VECTOR, &Kernel::PageFaultInterrupt, this);
 
-			MMU::page_entry_type frame = machine.mmu.AcquireFrame();
+        // INT 2 and 3 have no service of their own and end the process like
+        // INT 1
 
-			if(frame != MMU::INVALID_PAGE) {
+        for (int number = Verifier::MIN_INTERRUPT_NUMBER; number <= Verifier::MAX_INTERRUPT_NUMBER; ++number) {
+            machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + number - 1, &Kernel::ExitInterrupt, this);
+        }
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + FORK_INTERRUPT - 1, &Kernel::ForkInterrupt, this);
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + SEGMENT_CREATE_INTERRUPT - 1, &Kernel::SegmentCreateInterrupt, this);
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + SEGMENT_ATTACH_INTERRUPT - 1, &Kernel::SegmentAttachInterrupt, this);
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + SEGMENT_WAIT_INTERRUPT - 1, &Kernel::SegmentWaitInterrupt, this);
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + SEGMENT_NOTIFY_INTERRUPT - 1, &Kernel::SegmentNotifyInterrupt, this);
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + IO_SETUP_INTERRUPT - 1, &Kernel::IOSetupInterrupt, this);
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + IO_SUBMIT_INTERRUPT - 1, &Kernel::IOSubmitInterrupt, this);
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + IO_WAIT_INTERRUPT - 1, &Kernel::IOWaitInterrupt, this);
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + HEAP_ALLOCATE_INTERRUPT - 1, &Kernel::HeapAllocateInterrupt, this);
+        machine.pic.SetHandler(PIC::SOFTWARE_VECTOR_BASE + HEAP_FREE_INTERRUPT - 1, &Kernel::HeapFreeInterrupt, this);
 
-				(*(machine.mmu.page_table))[page] = frame;
-			} else {
-				std::cout << "Kernel: Error on Page Fault - Process: " << processes[_current_process_index].id << " skipping instruction: " << machine.cpu.registers.ip << std::endl;
-				machine.cpu.registers.ip += 2;
-				// or machine.Stop();
-			}
-        };
+        // I/O
+
+        for (std::vector<std::string>::const_iterator it = options.files.begin(); it != options.files.end(); ++it) {
+            if (!_io.Open(*it)) {
+                std::cerr << "Kernel: failed to open the file " << *it << "." << std::endl;
+            }
+        }
 
         // Process Management
 
@@ -46,174 +115,185 @@ namespace vm
             CreateProcess(path);
         });
 
+        AdmitArrivals();
+
+        TraceMemory();
+
+        // A machine that starts empty waits for work from the others, or
+        // from the daemon
+
+        if (_balancer) {
+            _balancer_machine = _balancer->Attach(*this);
+        }
+
+        if (_daemon) {
+            _daemon_machine = _daemon->Attach(*this);
+        }
+
+        if (processes.empty()) {
+            WaitForWork();
+        }
+
         if (!processes.empty()) {
+            _current_process_index = SelectNextProcess();
+
             std::cout << "Kernel: setting the first process: " << processes[_current_process_index].id << " for execution." << std::endl;
 
-            machine.cpu.registers = processes[_current_process_index].registers;
-			machine.mmu.page_table = processes[_current_process_index].page_table;
-			machine.mmu.blocklist = processes[_current_process_index].blocklist;
-			
-            processes[_current_process_index].state = Process::Running;
+            LoadProcess(_current_process_index);
+        }
+
+        if (options.start_machine && (!(_balancer || _daemon) || !processes.empty())) {
+            machine.Start();
         }
+    }
 
-        if (scheduler == FirstComeFirstServed || scheduler == ShortestJob) {
-            machine.pic.isr_0 = [&]() {};
-            machine.pic.isr_3 = [&]() {};
-        } else if (scheduler == RoundRobin) {
-            machine.pic.isr_0 = [&]() {
-                std::cout << "Kernel: processing the timer interrupt." << std::endl;
+    Kernel::~Kernel()
+    {
+        if (_balancer) {
+            _balancer->Detach(_balancer_machine);
+        }
 
-                if (!processes.empty()) {
-                    if (_cycles_passed_after_preemption <= Kernel::_MAX_CYCLES_BEFORE_PREEMPTION)
-                    {
-                        std::cout << "Kernel: allowing the current process " << processes[_current_process_index].id << " to run." << std::endl;
+        if (_daemon) {
+            _daemon->Detach(_daemon_machine);
+        }
+    }
 
-                        ++_cycles_passed_after_preemption;
+    bool Kernel::CreateProcess(const std::string &name)
+    {
+        MMU::ram_type image;
 
-                        std::cout << "Kernel: the current cycle is " << _cycles_passed_after_preemption << std::endl;
-                    } else {
-                        if (processes.size() > 1) {
-                            std::cout << "Kernel: switching the context from process " << processes[_current_process_index].id;
-                
-                            processes[_current_process_index].registers = machine.cpu.registers;
-                            processes[_current_process_index].state = Process::Ready;
+        return ReadProgram(name, image) && CreateProcess(name, image);
+    }
 
-                            _current_process_index = (_current_process_index + 1) % processes.size();
+    bool Kernel::CreateProcess(const std::string &name, const MMU::ram_type &image)
+    {
+        if (_last_issued_process_id == std::numeric_limits<Process::process_id_type>::max()) {
+            std::cerr << "Kernel: failed to create a new process. The maximum number of processes has been reached." << std::endl;
 
-                            std::cout << " to process " << processes[_current_process_index].id << std::endl;
+            return false;
+        }
 
-                            machine.cpu.registers = processes[_current_process_index].registers;
-							machine.mmu.page_table = processes[_current_process_index].page_table;
-							machine.mmu.blocklist = processes[_current_process_index].blocklist;
-							
-                            processes[_current_process_index].state = Process::Running;
-                        }
+        Verifier::error_list_type verification_errors;
 
-                        _cycles_passed_after_preemption = 0;
-                    }
-                }
+        bool verified = Verifier::Verify(image, machine.mmu.GetPageCount() * machine.mmu.GetPageSize(), verification_errors);
+        if (!verified) {
+            std::cerr << "Kernel: " << name << " failed verification, running it with checks:" << std::endl;
+            for (Verifier::error_list_type::const_iterator it = verification_errors.begin();
+                 it != verification_errors.end(); ++it) {
+                std::cerr << "    " << *it << std::endl;
+            }
+        }
 
-                std::cout << std::endl;
-            };
+		// get the position of the first-fit memory location with sufficient size
+        MMU::ram_size_type new_memory_position = AllocateMemory(image.size(),NULL);
 
-            machine.pic.isr_3 = [&]() {
-                std::cout << "Kernel: processing the first software interrupt." << std::endl;
+        // Enough memory may be free, only not in one piece
 
-                if (!processes.empty()) {
-                    std::cout << "Kernel: unloading the process " << processes[_current_process_index].id << std::endl;
-					
-					//clear out the process' VM
-					for(int i = 0; i<processes[_current_process_index].page_table->size(); i++) {
-						machine.mmu.ReleaseFrame((*(processes[_current_process_index].page_table))[i]);
-					}
-					//send the start position of the memory to be freed
-					FreeMemory(processes[_current_process_index].memory_start_position,NULL);
-					
-                    processes.erase(processes.begin() + _current_process_index);
+        if (new_memory_position == NO_ADDRESS && machine.mmu.GetFreeFrameCount() * machine.mmu.GetPageSize() >= image.size()) {
+            std::cout << "Kernel: compacting the physical memory to load " << name << "." << std::endl;
 
-                    if (processes.empty()) {
-                        _current_process_index = 0;
+            machine.mmu.ReleaseZeroedFrames();
+            CompactMemory(0);
+            new_memory_position = AllocateMemory(image.size(), NULL);
+        }
 
-                        std::cout << "Kernel: no more processes. Stopping the machine." << std::endl;
+        if (new_memory_position == NO_ADDRESS) {
+            std::cerr << "Kernel: failed to allocate memory." << std::endl;
 
-                        machine.Stop();
-                    } else {
-                        if (_current_process_index >= processes.size()) {
-                            _current_process_index %= processes.size();
-                        }
+            return false;
+        }
 
-                        std::cout << "Kernel: switching the context to process " << processes[_current_process_index].id << std::endl;
+        std::copy(image.begin(), image.end(), (machine.mmu.ram.begin() + new_memory_position));
 
-                        machine.cpu.registers = processes[_current_process_index].registers;
-						machine.mmu.page_table = processes[_current_process_index].page_table;
-						machine.mmu.blocklist = processes[_current_process_index].blocklist;
-						
-                        processes[_current_process_index].state = Process::Running;
+        if (_jit) {
+            _jit->Invalidate(new_memory_position, new_memory_position + image.size());
+        }
 
-                        _cycles_passed_after_preemption = 0;
-                    }
-                }
+        Process process(_last_issued_process_id++, new_memory_position,
+                        new_memory_position + image.size(), machine.mmu);
+        process.verified = verified;
+        ReserveImagePages(image, &process);
 
-                std::cout << std::endl;
-            };
-        } else if (scheduler == Priority) {
-            machine.pic.isr_0 = [&]() {};
-            machine.pic.isr_3 = [&]() {};
+        if (_tracer) {
+            _tracer->NameTrack(process.id + 1, name);
         }
 
-        machine.Start();
-    }
+        if (_profiler) {
+            _profiler->RegisterProcess(process.id, name, new_memory_position);
+        }
+
+        if (_record_processes) {
+            RecordArrival(process, name);
+        }
+
+		processes.push_back(std::move(process));
 
-    Kernel::~Kernel() {}
+        // Old sequential allocation
+        //
+        // std::copy(ops.begin(), ops.end(), (machine.memory.ram.begin() + _last_ram_position));
+        //
+        // Process process(_last_issued_process_id++, _last_ram_position,
+        //                                            _last_ram_position + ops.size());
+        //
+        // _last_ram_position += ops.size();
+
+        return true;
+    }
 
-    void Kernel::CreateProcess(const std::string &name)
+    bool Kernel::ReadProgram(const std::string &path, MMU::ram_type &image)
     {
-        if (_last_issued_process_id == std::numeric_limits<Process::process_id_type>::max()) {
-            std::cerr << "Kernel: failed to create a new process. The maximum number of processes has been reached." << std::endl;
-        } else {
-            std::ifstream input_stream(name, std::ios::in | std::ios::binary);
-            if (!input_stream) {
-                std::cerr << "Kernel: failed to open the program file." << std::endl;
-            } else {
-                MMU::ram_type ops;
-
-                input_stream.seekg(0, std::ios::end);
-                auto file_size = input_stream.tellg();
-                input_stream.seekg(0, std::ios::beg);
-                ops.resize(static_cast<MMU::ram_size_type>(file_size) / 4);
-
-                input_stream.read(reinterpret_cast<char *>(&ops[0]), file_size);
-
-                if (input_stream.bad()) {
-                    std::cerr << "Kernel: failed to read the program file." << std::endl;
-                } else {
-
-					// get the position of the first-fit memory location with sufficient size
-                    MMU::ram_size_type new_memory_position = AllocateMemory(ops.size(),NULL);
-                    if (new_memory_position == -1) {
-                        std::cerr << "Kernel: failed to allocate memory." << std::endl;
-                    } else {
-                        std::copy(ops.begin(), ops.end(), (machine.mmu.ram.begin() + new_memory_position));
-
-                        Process *process = new Process(_last_issued_process_id++, new_memory_position,
-                                                                   new_memory_position + ops.size());
-						processes.push_back(*process);
-
-                        // Old sequential allocation
-                        //
-                        // std::copy(ops.begin(), ops.end(), (machine.memory.ram.begin() + _last_ram_position));
-                        //
-                        // Process process(_last_issued_process_id++, _last_ram_position,
-                        //                                            _last_ram_position + ops.size());
-                        //
-                        // _last_ram_position += ops.size();
-                    }
-                }
-            }
+        std::ifstream input_stream(path, std::ios::in | std::ios::binary);
+        if (!input_stream) {
+            std::cerr << "Kernel: failed to open the program file." << std::endl;
+
+            return false;
+        }
+
+        input_stream.seekg(0, std::ios::end);
+        auto file_size = input_stream.tellg();
+        input_stream.seekg(0, std::ios::beg);
+        image.resize(static_cast<MMU::ram_size_type>(file_size) / 4);
+
+        if (image.empty()) {
+            std::cerr << "Kernel: the program file is empty." << std::endl;
+
+            return false;
         }
+
+        input_stream.read(reinterpret_cast<char *>(&image[0]), file_size);
+
+        if (input_stream.bad()) {
+            std::cerr << "Kernel: failed to read the program file." << std::endl;
+
+            return false;
+        }
+
+        return true;
     }
 
     MMU::ram_size_type Kernel::AllocateMemory(MMU::ram_size_type units, Process *process)
     {
-		MMU::ram_size_type new_allocation = -1;
+		MMU::ram_size_type new_allocation = NO_ADDRESS;
 		MMU::header *current;
 		MMU::ram_size_type frame_units;
 
+		// Both lists are kept in whole pages: virtual pages for a process,
+		// physical frames for the kernel
+
 		if(process) 
 		{	
 			current = process->blocklist;
-			frame_units = units / MMU::PAGE_SIZE + 1;
 		} else {
 			current = machine.mmu.real_list;
-			frame_units = (units / MMU::PAGE_SIZE + 1)*MMU::PAGE_SIZE;
 		}
+		frame_units = (units + machine.mmu.GetPageSize() - 1) / machine.mmu.GetPageSize();
 
 
 		while(current) {
 			if(current->free && current->size >= frame_units) {
 
 				// alloc from this block
-				new_allocation = current->block;
+				new_allocation = current->block * machine.mmu.GetPageSize();
 				current->free = false;
 
 				if(current->size > frame_units) {
@@ -226,6 +306,8 @@ namespace vm
 					current->next = tail;
 					current->size = frame_units;
 				}
+
+				current = NULL;
 			} else {
 				current = current->next;
 			}
@@ -245,21 +327,32 @@ namespace vm
 		MMU::header *prev = NULL;
 
 		while(current) {
-			if(current->block == physical_memory_index) {
+			if(current->block == physical_memory_index / machine.mmu.GetPageSize()) {
 				current->free = true;
+
+				// Frames keep what the image left in them until cleared
+
+				if(!process) {
+					std::fill(machine.mmu.dirty_frames.begin() + current->block,
+					          machine.mmu.dirty_frames.begin() + current->block + current->size, 1);
+				}
+
 				if(prev) {
 					if(prev->free) {
 						// merge
 						prev->next = current->next;
 						prev->size += current->size;
+						delete current;
 						current = prev;
 					}
 				}
 				if(current->next) {
 					if(current->next->free) {
 						//merge
-						current->size += current->next->size;
-						current->next = current->next->next;
+						MMU::header *merged = current->next;
+						current->size += merged->size;
+						current->next = merged->next;
+						delete merged;
 					}
 				}
 				current = NULL;
@@ -270,4 +363,1643 @@ namespace vm
 		}
 
     }
+
+    void Kernel::ReserveMemory(MMU::ram_size_type block, Process *process)
+    {
+		MMU::header *current = process ? process->blocklist : machine.mmu.real_list;
+
+		while (current && !(current->block <= block && block < current->block + current->size)) {
+			current = current->next;
+		}
+
+		if (!current || !current->free) {
+			return;
+		}
+
+		// Split off what comes after the page, then what comes before it
+
+		if (block + 1 < current->block + current->size) {
+			MMU::header *tail = new MMU::header();
+			tail->block = block + 1;
+			tail->size = current->block + current->size - (block + 1);
+			tail->free = true;
+			tail->next = current->next;
+
+			current->next = tail;
+			current->size = block + 1 - current->block;
+		}
+
+		if (current->block < block) {
+			MMU::header *page = new MMU::header();
+			page->block = block;
+			page->size = 1;
+			page->free = true;
+			page->next = current->next;
+
+			current->next = page;
+			current->size = block - current->block;
+			current = page;
+		}
+
+		current->free = false;
+    }
+
+    // Programs address memory through immediates only, so the pages they use
+    // directly are known at load. The heap never hands those out.
+
+    void Kernel::ReserveImagePages(const MMU::ram_type &image, Process *process)
+    {
+        MMU::page_table_size_type page_count = process->page_table->size();
+        std::vector<bool> reserved(page_count, false);
+
+        for (MMU::ram_size_type offset = 0; offset + 1 < image.size(); offset += 2) {
+            int instruction = image[offset];
+            int data = image[offset + 1];
+
+            bool addresses_memory =
+                (instruction >= CPU::LDA_BASE_OPCODE && instruction <= CPU::LDC_BASE_OPCODE) ||
+                (instruction >= CPU::STA_BASE_OPCODE && instruction <= CPU::STC_BASE_OPCODE) ||
+                (instruction >= CPU::LDA_STA_FUSED_OPCODE && instruction <= CPU::LDC_STC_FUSED_OPCODE) ||
+                (instruction >= CPU::LDA_LDA_FUSED_OPCODE && instruction <= CPU::LDC_LDC_FUSED_OPCODE);
+
+            if (addresses_memory && data >= 0 && static_cast<MMU::vmem_size_type>(data) / machine.mmu.GetPageSize() < page_count) {
+                reserved[data / machine.mmu.GetPageSize()] = true;
+            }
+        }
+
+        for (MMU::page_table_size_type page = 0; page < page_count; ++page) {
+            if (reserved[page]) {
+                ReserveMemory(page, process);
+            }
+        }
+    }
+
+    MMU::ram_size_type Kernel::CompactMemory(MMU::ram_size_type budget)
+    {
+        MMU::ram_size_type moved = 0;
+
+        MMU::header *current = machine.mmu.real_list;
+        while (current && current->next && (budget == 0 || moved < budget)) {
+            MMU::header *used = current->next;
+
+            if (!current->free || used->free || !MoveBlock(used->block, current->block, used->size)) {
+                current = used;
+
+                continue;
+            }
+
+            // Swap the two headers' roles: the block in use now starts where
+            // the hole did, and the hole follows it
+
+            MMU::ram_size_type hole_size = current->size;
+
+            current->free = false;
+            current->size = used->size;
+
+            used->free = true;
+            used->block = current->block + current->size;
+            used->size = hole_size;
+
+            if (used->next && used->next->free) {
+                MMU::header *merged = used->next;
+                used->size += merged->size;
+                used->next = merged->next;
+
+                delete merged;
+            }
+
+            moved += current->size;
+            current = used;
+        }
+
+        if (moved > 0) {
+            statistics.compacted_pages += moved;
+
+            TraceMemory();
+        }
+
+        return moved;
+    }
+
+    bool Kernel::MoveBlock(MMU::ram_size_type from, MMU::ram_size_type to, MMU::ram_size_type size)
+    {
+        const MMU::ram_size_type page_size = machine.mmu.GetPageSize();
+
+        // Frames of huge pages stay put, moving one would split the page
+
+        if (size == 1 && machine.mmu.frame_references[from] > 0) {
+            if (machine.mmu.huge_frames[from]) {
+                return false;
+            }
+
+            MoveFrame(from * page_size, to * page_size);
+
+            return true;
+        }
+
+        for (process_list_type::const_iterator it = processes.begin(); it != processes.end(); ++it) {
+            if (it->memory_start_position == from * page_size) {
+                MoveImage(from * page_size, to * page_size, size * page_size);
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Every page table mapping the frame follows it, the running process's
+    // included, since the MMU points at that same table
+
+    void Kernel::MoveFrame(MMU::page_entry_type from, MMU::page_entry_type to)
+    {
+        MMU &mmu = machine.mmu;
+        const MMU::ram_size_type page_size = mmu.GetPageSize();
+
+        std::copy(mmu.ram.begin() + from, mmu.ram.begin() + from + page_size, mmu.ram.begin() + to);
+
+        for (process_list_type::iterator it = processes.begin(); it != processes.end(); ++it) {
+            std::replace(it->page_table->begin(), it->page_table->end(), from, to);
+        }
+
+        _segments.MoveFrame(from, to);
+
+        mmu.frame_references[to / page_size] = mmu.frame_references[from / page_size];
+        mmu.shared_frames[to / page_size] = mmu.shared_frames[from / page_size];
+        mmu.segment_frames[to / page_size] = mmu.segment_frames[from / page_size];
+
+        mmu.frame_references[from / page_size] = 0;
+        mmu.shared_frames[from / page_size] = 0;
+        mmu.segment_frames[from / page_size] = 0;
+        mmu.dirty_frames[from / page_size] = 1;
+    }
+
+    // Instruction pointers are physical, so they move with the image. Forked
+    // processes share it and all move together.
+
+    void Kernel::MoveImage(MMU::ram_size_type from, MMU::ram_size_type to, MMU::ram_size_type size)
+    {
+        MMU &mmu = machine.mmu;
+
+        std::copy(mmu.ram.begin() + from, mmu.ram.begin() + from + size, mmu.ram.begin() + to);
+
+        for (MMU::ram_size_type frame = from; frame < from + size; frame += mmu.GetPageSize()) {
+            if (frame < to || frame >= to + size) {
+                mmu.dirty_frames[frame >> mmu.GetPageShift()] = 1;
+            }
+        }
+
+        if (_jit) {
+            _jit->Invalidate(from, from + size);
+            _jit->Invalidate(to, to + size);
+        }
+
+        for (process_list_type::size_type i = 0; i < processes.size(); ++i) {
+            Process &process = processes[i];
+            if (process.memory_start_position != from) {
+                continue;
+            }
+
+            process.memory_start_position = to;
+            process.memory_end_position -= from - to;
+            process.registers.ip -= from - to;
+
+            if (i == _current_process_index && process.state == Process::Running) {
+                machine.cpu.registers.ip -= from - to;
+            }
+
+            if (_profiler) {
+                _profiler->MoveImage(process.id, to);
+            }
+        }
+    }
+
+    void Kernel::ZeroFrames()
+    {
+        MMU::ram_size_type pooled = machine.mmu.GetZeroedFrameCount();
+        if (pooled < _zeroed_frames) {
+            statistics.zeroed_frames += machine.mmu.ZeroFrames(_zeroed_frames - pooled);
+        }
+    }
+
+    // Only a process that holds nothing tied to this machine can leave: no
+    // I/O ring, whose requests run against this kernel's files, and no
+    // shared memory segment. The running process stays as well.
+
+    bool Kernel::ExportProcess(Migration &migration)
+    {
+        MMU &mmu = machine.mmu;
+        const MMU::ram_size_type page_size = mmu.GetPageSize();
+
+        process_list_type::size_type index = processes.size();
+        for (process_list_type::size_type i = processes.size(); i-- > 0 && index == processes.size();) {
+            Process &candidate = processes[i];
+            if (i == _current_process_index || candidate.state != Process::Ready || _io_rings.HasRing(candidate.id)) {
+                continue;
+            }
+
+            candidate.PruneMappedPages();
+
+            bool attached = false;
+            for (std::vector<MMU::page_table_size_type>::const_iterator it = candidate.mapped_pages.begin();
+                 it != candidate.mapped_pages.end() && !attached; ++it) {
+                attached = mmu.segment_frames[(*candidate.page_table)[*it] >> mmu.GetPageShift()] != 0;
+            }
+
+            if (!attached) {
+                index = i;
+            }
+        }
+
+        if (index == processes.size()) {
+            return false;
+        }
+
+        Process &process = processes[index];
+
+        std::ostringstream name;
+        name << "process " << process.id << " of machine " << _balancer_machine;
+        migration.name = name.str();
+
+        // The pages go as their words, the frames stay here
+
+        std::vector<MMU::page_entry_type> frames;
+        for (std::vector<MMU::page_table_size_type>::const_iterator it = process.mapped_pages.begin(); it != process.mapped_pages.end(); ++it) {
+            MMU::page_entry_type frame = (*process.page_table)[*it];
+
+            migration.pages[*it].assign(mmu.ram.begin() + frame, mmu.ram.begin() + frame + page_size);
+            frames.push_back(frame);
+
+            (*process.page_table)[*it] = MMU::INVALID_PAGE;
+        }
+        mmu.ReleaseFrames(frames);
+
+        process.mapped_pages.clear();
+        std::fill(process.huge_mappings.begin(), process.huge_mappings.end(), 0);
+
+        migrated_page_map_type::iterator pages = _migrated_pages.find(process.id);
+        if (pages != _migrated_pages.end()) {
+            migration.pages.insert(pages->second.begin(), pages->second.end());
+            _migrated_pages.erase(pages);
+        }
+
+        migration.image.assign(mmu.ram.begin() + process.memory_start_position, mmu.ram.begin() + process.memory_end_position);
+
+        bool image_shared = false;
+        for (process_list_type::size_type i = 0; i < processes.size(); ++i) {
+            if (i != index && processes[i].memory_start_position == process.memory_start_position) {
+                image_shared = true;
+
+                break;
+            }
+        }
+
+        if (!image_shared) {
+            FreeMemory(process.memory_start_position, NULL);
+
+            if (_jit) {
+                _jit->Invalidate(process.memory_start_position, process.memory_end_position);
+            }
+        }
+
+        heap_map_type::iterator heap = _heaps.find(process.id);
+        if (heap != _heaps.end()) {
+            migration.has_heap = true;
+            migration.heap = heap->second;
+
+            _heaps.erase(heap);
+        }
+
+        process.registers.ip -= process.memory_start_position;
+        process.memory_end_position -= process.memory_start_position;
+        process.memory_start_position = 0;
+
+        std::cout << "Kernel: process " << process.id << " leaves for another machine with "
+                  << migration.pages.size() << " pages." << std::endl;
+
+        if (_tracer) {
+            _tracer->ProcessExit(machine.cpu.cycles, process.id + 1);
+        }
+
+        _process_records.erase(process.id);
+
+        migration.process = std::move(process);
+
+        // Erasing shifts the processes after it, the MMU follows the running one
+
+        processes.erase(processes.begin() + index);
+        if (index < _current_process_index) {
+            --_current_process_index;
+        }
+
+        mmu.page_table = processes[_current_process_index].page_table;
+        mmu.huge_mappings = &processes[_current_process_index].huge_mappings;
+        mmu.blocklist = processes[_current_process_index].blocklist;
+
+        ++statistics.migrations;
+
+        TraceMemory();
+
+        return true;
+    }
+
+    bool Kernel::ImportProcess(Migration &migration)
+    {
+        if (migration.process.page_table->size() != machine.mmu.GetPageCount()) {
+            std::cerr << "Kernel: " << migration.name << " comes from a machine with another page size." << std::endl;
+
+            return false;
+        }
+
+        if (_last_issued_process_id == std::numeric_limits<Process::process_id_type>::max()) {
+            std::cerr << "Kernel: failed to take in " << migration.name << ". The maximum number of processes has been reached." << std::endl;
+
+            return false;
+        }
+
+        MMU::ram_size_type position = AllocateMemory(migration.image.size(), NULL);
+        if (position == NO_ADDRESS && machine.mmu.GetFreeFrameCount() * machine.mmu.GetPageSize() >= migration.image.size()) {
+            machine.mmu.ReleaseZeroedFrames();
+            CompactMemory(0);
+            position = AllocateMemory(migration.image.size(), NULL);
+        }
+
+        if (position == NO_ADDRESS) {
+            std::cerr << "Kernel: failed to allocate memory for " << migration.name << "." << std::endl;
+
+            return false;
+        }
+
+        std::copy(migration.image.begin(), migration.image.end(), machine.mmu.ram.begin() + position);
+
+        if (_jit) {
+            _jit->Invalidate(position, position + migration.image.size());
+        }
+
+        Process process(migration.process);
+        process.id = _last_issued_process_id++;
+        process.state = Process::Ready;
+        process.memory_start_position = position;
+        process.memory_end_position += position;
+        process.registers.ip += position;
+        process.huge_mappings.assign(machine.mmu.GetHugePageRegionCount(), 0);
+
+        if (!migration.pages.empty()) {
+            _migrated_pages[process.id].swap(migration.pages);
+        }
+
+        if (migration.has_heap) {
+            _heaps[process.id] = migration.heap;
+        }
+
+        std::cout << "Kernel: " << migration.name << " arrived as process " << process.id << "." << std::endl;
+
+        if (_tracer) {
+            _tracer->NameTrack(process.id + 1, migration.name);
+        }
+
+        if (_profiler) {
+            _profiler->RegisterProcess(process.id, migration.name, position);
+        }
+
+        processes.push_back(std::move(process));
+
+        TraceMemory();
+
+        return true;
+    }
+
+    Kernel::process_list_type::size_type Kernel::GetRunnableProcessCount() const
+    {
+        process_list_type::size_type count = 0;
+        for (process_list_type::const_iterator it = processes.begin(); it != processes.end(); ++it) {
+            if (it->state != Process::Blocked) {
+                ++count;
+            }
+        }
+
+        return count;
+    }
+
+    void Kernel::TimerInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleTimer();
+    }
+
+    void Kernel::PageFaultInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandlePageFault();
+    }
+
+    void Kernel::ExitInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleExit();
+    }
+
+    void Kernel::ForkInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleFork();
+    }
+
+    void Kernel::SegmentCreateInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleSegmentCreate();
+    }
+
+    void Kernel::SegmentAttachInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleSegmentAttach();
+    }
+
+    void Kernel::SegmentWaitInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleSegmentWait();
+    }
+
+    void Kernel::SegmentNotifyInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleSegmentNotify();
+    }
+
+    void Kernel::IOSetupInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleIOSetup();
+    }
+
+    void Kernel::IOSubmitInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleIOSubmit();
+    }
+
+    void Kernel::IOWaitInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleIOWait();
+    }
+
+    void Kernel::HeapAllocateInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleHeapAllocate();
+    }
+
+    void Kernel::HeapFreeInterrupt(void *kernel)
+    {
+        static_cast<Kernel *>(kernel)->HandleHeapFree();
+    }
+
+    void Kernel::HandleTimer()
+    {
+        // Runs that would never end on their own are cut off on a timer tick
+
+        if (_cycle_limit && machine.cpu.cycles >= _cycle_limit) {
+            std::cout << "Kernel: the cycle limit has been reached. Stopping the machine." << std::endl;
+
+            machine.Stop();
+
+            return;
+        }
+
+        // Completed I/O is picked up on the timer, processes it wakes are
+        // scheduled like any other
+
+        if (!_io_rings.IsEmpty() && _io.HasCompletions()) {
+            _io_rings.DeliverCompletions(*this);
+        }
+
+        // Sample the guest from the timer path ahead of the scheduler
+
+        if (_profiler) {
+            _profiler->Tick(machine.cpu.registers.ip);
+        }
+
+        if (_balancer && machine.cpu.cycles >= _next_balance_cycle) {
+            _next_balance_cycle = machine.cpu.cycles + Balancer::BALANCE_INTERVAL;
+
+            _balancer->Balance(_balancer_machine, *this);
+        }
+
+        if (_daemon && machine.cpu.cycles >= _next_admission_cycle) {
+            _next_admission_cycle = machine.cpu.cycles + Daemon::ADMIT_INTERVAL;
+
+            _daemon->Admit(_daemon_machine, *this);
+        }
+
+        if (_next_arrival < _arrivals.size()) {
+            AdmitArrivals();
+        }
+
+        // The other schedulers never preempt, a process runs until it exits
+
+        if (scheduler != RoundRobin) {
+            return;
+        }
+
+        std::cout << "Kernel: processing the timer interrupt." << std::endl;
+
+        if (!processes.empty()) {
+            if (_cycles_passed_after_preemption <= _quantum)
+            {
+                std::cout << "Kernel: allowing the current process " << processes[_current_process_index].id << " to run." << std::endl;
+
+                ++_cycles_passed_after_preemption;
+
+                std::cout << "Kernel: the current cycle is " << _cycles_passed_after_preemption << std::endl;
+            } else {
+                process_list_type::size_type next_process_index = FindReadyProcess(_current_process_index + 1);
+
+                if (next_process_index != _current_process_index) {
+                    std::cout << "Kernel: switching the context from process " << processes[_current_process_index].id;
+
+                    Process::process_id_type previous_process_id = processes[_current_process_index].id;
+
+                    if (_tracer) {
+                        _tracer->ContextSwitch(machine.cpu.cycles, previous_process_id + 1,
+                                               processes[next_process_index].id + 1);
+                    }
+
+                    std::cout << " to process " << processes[next_process_index].id << std::endl;
+
+                    SwitchToProcess(next_process_index, true);
+                }
+
+                _cycles_passed_after_preemption = 0;
+
+                if (_compaction_pages) {
+                    CompactMemory(_compaction_pages);
+                }
+            }
+        }
+
+        std::cout << std::endl;
+    }
+
+    // Process page faults (find an empty frame)
+
+    void Kernel::HandlePageFault()
+    {
+        if (machine.pic.fault.write) {
+            HandleCopyOnWrite(machine.pic.fault.page);
+
+            return;
+        }
+
+        std::cout << "Kernel: page fault." << std::endl;
+
+        ++statistics.page_faults;
+
+		MMU::page_entry_type page = machine.pic.fault.page;
+
+        Process &process = processes[_current_process_index];
+
+        if (process.page_limit && process.mapped_pages.size() >= process.page_limit) {
+            process.PruneMappedPages();
+
+            if (process.mapped_pages.size() >= process.page_limit) {
+                std::cout << "Kernel: the process " << process.id << " went over its limit of " << process.page_limit << " pages." << std::endl;
+
+                EndCurrentProcess(true);
+
+                return;
+            }
+        }
+
+        if (PullMigratedPage(process, page)) {
+            TraceMemory();
+
+            return;
+        }
+
+        // Pages still to come from a migration must not be mapped over, and a
+        // whole region at once could go past the page limit
+
+        if (_huge_pages && _migrated_pages.count(process.id) == 0 && !process.page_limit && MapHugePage(process, page)) {
+            TraceMemory();
+
+            return;
+        }
+
+		MMU::page_entry_type frame = machine.mmu.AcquireFrame();
+
+		if(frame != MMU::INVALID_PAGE) {
+
+			process.MapPage(page, frame);
+
+            if (_huge_pages) {
+                PromoteHugePage(process, page);
+            }
+
+			TraceMemory();
+		} else {
+			std::cout << "Kernel: Error on Page Fault - Process: " << processes[_current_process_index].id << " skipping instruction: " << machine.cpu.registers.ip << std::endl;
+			machine.cpu.registers.ip += 2;
+			// or machine.Stop();
+		}
+    }
+
+    // The store hit a frame other page tables map as well. The writer gets a
+    // private copy and the store is restarted on it.
+
+    void Kernel::HandleCopyOnWrite(MMU::page_table_size_type page)
+    {
+        std::cout << "Kernel: copy-on-write fault." << std::endl;
+
+        ++statistics.copy_on_write_faults;
+
+        if (CopyOnWrite(*machine.mmu.page_table, page)) {
+            TraceMemory();
+        } else {
+            std::cout << "Kernel: Error on Copy-on-Write - Process: " << processes[_current_process_index].id << " skipping instruction: " << machine.cpu.registers.ip << std::endl;
+            machine.cpu.registers.ip += 2;
+        }
+    }
+
+    bool Kernel::CopyOnWrite(MMU::page_table_type &page_table, MMU::page_table_size_type page)
+    {
+        MMU::page_entry_type shared_frame = page_table[page];
+        MMU::page_entry_type frame = machine.mmu.AcquireFrame(false);
+
+        if (frame == MMU::INVALID_PAGE) {
+            return false;
+        }
+
+        std::copy(machine.mmu.ram.begin() + shared_frame, machine.mmu.ram.begin() + shared_frame + machine.mmu.GetPageSize(),
+                  machine.mmu.ram.begin() + frame);
+
+        machine.mmu.ReleaseFrame(shared_frame);
+        page_table[page] = frame;
+
+        return true;
+    }
+
+    // A process that has filled the region before the one faulting is likely
+    // to go on filling this one, so it gets the whole region in one fault
+
+    bool Kernel::MapHugePage(Process &process, MMU::page_table_size_type page)
+    {
+        MMU::page_table_size_type region = page / MMU::HUGE_PAGE_PAGES;
+        if (region == 0 || region >= process.huge_mappings.size() || !process.huge_mappings[region - 1]) {
+            return false;
+        }
+
+        MMU::page_table_type &page_table = *process.page_table;
+        MMU::page_table_size_type first_page = region * MMU::HUGE_PAGE_PAGES;
+
+        for (MMU::page_table_size_type i = first_page; i < first_page + MMU::HUGE_PAGE_PAGES; ++i) {
+            if (page_table[i] != MMU::INVALID_PAGE) {
+                return false;
+            }
+        }
+
+        MMU::page_entry_type frame = machine.mmu.AcquireHugeFrame();
+        if (frame == MMU::INVALID_PAGE) {
+            return false;
+        }
+
+        for (MMU::page_table_size_type i = 0; i < MMU::HUGE_PAGE_PAGES; ++i) {
+            process.MapPage(first_page + i, frame + i * machine.mmu.GetPageSize());
+            machine.mmu.huge_frames[(frame >> machine.mmu.GetPageShift()) + i] = 1;
+        }
+
+        process.huge_mappings[region] = 1;
+        ++statistics.huge_pages;
+
+        std::cout << "Kernel: mapped the region " << region << " of the process " << process.id << " as a huge page." << std::endl;
+
+        return true;
+    }
+
+    // Once every page of a region is mapped to a private frame, the frames
+    // are gathered into one aligned run of physical memory
+
+    bool Kernel::PromoteHugePage(Process &process, MMU::page_table_size_type page)
+    {
+        MMU &mmu = machine.mmu;
+
+        MMU::page_table_size_type region = page / MMU::HUGE_PAGE_PAGES;
+        if (region >= process.huge_mappings.size() || process.huge_mappings[region]) {
+            return false;
+        }
+
+        MMU::page_table_type &page_table = *process.page_table;
+        MMU::page_table_size_type first_page = region * MMU::HUGE_PAGE_PAGES;
+
+        for (MMU::page_table_size_type i = first_page; i < first_page + MMU::HUGE_PAGE_PAGES; ++i) {
+            MMU::page_entry_type frame = page_table[i];
+            if (frame == MMU::INVALID_PAGE || mmu.GetFrameReferences(frame) != 1 ||
+                mmu.segment_frames[frame >> mmu.GetPageShift()]) {
+                return false;
+            }
+        }
+
+        MMU::page_entry_type huge_frame = mmu.AcquireHugeFrame(false);
+        if (huge_frame == MMU::INVALID_PAGE) {
+            return false;
+        }
+
+        const MMU::ram_size_type page_size = mmu.GetPageSize();
+
+        for (MMU::page_table_size_type i = 0; i < MMU::HUGE_PAGE_PAGES; ++i) {
+            MMU::page_entry_type frame = page_table[first_page + i];
+            MMU::page_entry_type target = huge_frame + i * page_size;
+
+            std::copy(mmu.ram.begin() + frame, mmu.ram.begin() + frame + page_size, mmu.ram.begin() + target);
+
+            mmu.ReleaseFrame(frame);
+            page_table[first_page + i] = target;
+            mmu.huge_frames[target >> mmu.GetPageShift()] = 1;
+        }
+
+        process.huge_mappings[region] = 1;
+        ++statistics.huge_pages;
+
+        std::cout << "Kernel: promoted the region " << region << " of the process " << process.id << " to a huge page." << std::endl;
+
+        return true;
+    }
+
+    void Kernel::SplitHugePage(Process &process, MMU::page_table_size_type page)
+    {
+        MMU::page_table_size_type region = page / MMU::HUGE_PAGE_PAGES;
+        if (region >= process.huge_mappings.size() || !process.huge_mappings[region]) {
+            return;
+        }
+
+        process.huge_mappings[region] = 0;
+
+        MMU::page_table_size_type first_page = region * MMU::HUGE_PAGE_PAGES;
+        for (MMU::page_table_size_type i = first_page; i < first_page + MMU::HUGE_PAGE_PAGES; ++i) {
+            machine.mmu.huge_frames[(*process.page_table)[i] >> machine.mmu.GetPageShift()] = 0;
+        }
+    }
+
+    // The child is a copy of the caller sharing its image and, until either
+    // writes to them, its frames. The caller gets the child's id in a, the
+    // child gets 0, and the caller keeps running.
+
+    void Kernel::HandleFork()
+    {
+        std::cout << "Kernel: processing the fork software interrupt." << std::endl;
+
+        if (processes.empty()) {
+            return;
+        }
+
+        if (_last_issued_process_id == std::numeric_limits<Process::process_id_type>::max()) {
+            std::cerr << "Kernel: failed to fork the process. The maximum number of processes has been reached." << std::endl;
+
+            machine.cpu.registers.a = -1;
+
+            return;
+        }
+
+        Process &parent = processes[_current_process_index];
+        parent.registers = machine.cpu.registers;
+
+        for (MMU::page_table_size_type page = 0; page < parent.page_table->size(); page += MMU::HUGE_PAGE_PAGES) {
+            SplitHugePage(parent, page);
+        }
+
+        PullMigratedPages(parent);
+        parent.PruneMappedPages();
+
+        Process child(parent);
+        child.id = _last_issued_process_id++;
+        child.state = Process::Ready;
+        child.registers.a = 0;
+
+        for (std::vector<MMU::page_table_size_type>::const_iterator it = child.mapped_pages.begin(); it != child.mapped_pages.end(); ++it) {
+            machine.mmu.ShareFrame((*child.page_table)[*it]);
+        }
+
+        std::cout << "Kernel: process " << parent.id << " forked process " << child.id << std::endl;
+
+        machine.cpu.registers.a = static_cast<int>(child.id);
+
+        if (_tracer) {
+            std::ostringstream track_name;
+            track_name << "process " << child.id << " (fork of " << parent.id << ")";
+
+            _tracer->NameTrack(child.id + 1, track_name.str());
+        }
+
+        if (_profiler) {
+            _profiler->RegisterForkedProcess(child.id, parent.id);
+        }
+
+        if (_record_processes) {
+            process_record_map_type::const_iterator record = _process_records.find(parent.id);
+            RecordArrival(child, record != _process_records.end() ? record->second.name : std::string());
+        }
+
+        heap_map_type::const_iterator heap = _heaps.find(parent.id);
+        if (heap != _heaps.end()) {
+            _heaps[child.id] = heap->second;
+        }
+
+        processes.push_back(std::move(child));
+
+        ++statistics.forks;
+
+        std::cout << std::endl;
+    }
+
+    void Kernel::HandleExit()
+    {
+        std::cout << "Kernel: processing the first software interrupt." << std::endl;
+
+        if (!processes.empty()) {
+            EndCurrentProcess(false);
+        }
+
+        std::cout << std::endl;
+    }
+
+    void Kernel::EndCurrentProcess(bool killed)
+    {
+        std::cout << "Kernel: unloading the process " << processes[_current_process_index].id << std::endl;
+
+        Process::process_id_type exited_process_id = processes[_current_process_index].id;
+
+        if (_daemon) {
+            _daemon->Finish(_daemon_machine, processes[_current_process_index], machine.cpu.registers.a, killed, machine.cpu.cycles);
+        }
+
+        if (_record_processes) {
+            RecordExit(processes[_current_process_index]);
+        }
+
+        UnloadCurrentProcess();
+
+        if (_compaction_pages) {
+            CompactMemory(_compaction_pages);
+        }
+
+        if (processes.empty()) {
+            WaitForWork();
+        }
+
+        if (processes.empty()) {
+            _current_process_index = 0;
+
+            std::cout << "Kernel: no more processes. Stopping the machine." << std::endl;
+
+            machine.Stop();
+        } else {
+            ScheduleNextProcess(exited_process_id);
+        }
+    }
+
+    bool Kernel::WaitForWork()
+    {
+        // The machine has nothing else to do
+
+        if (processes.empty()) {
+            ZeroFrames();
+        }
+
+        while (processes.empty() && _next_arrival < _arrivals.size()) {
+            CPU::cycle_count_type cycle = _arrivals[_next_arrival].cycle;
+
+            if (cycle > machine.cpu.cycles) {
+                std::cout << "Kernel: no more processes, idling until the cycle " << cycle << "." << std::endl;
+
+                statistics.idle_cycles += cycle - machine.cpu.cycles;
+                machine.cpu.cycles = cycle;
+            }
+
+            AdmitArrivals();
+        }
+
+        if (!processes.empty()) {
+            return true;
+        }
+
+        if (_daemon) {
+            std::cout << "Kernel: no more processes, waiting for a job." << std::endl;
+
+            return _daemon->WaitForWork(_daemon_machine, *this);
+        }
+
+        if (_balancer) {
+            std::cout << "Kernel: no more processes, waiting for another machine to hand one over." << std::endl;
+
+            return _balancer->WaitForWork(_balancer_machine, *this);
+        }
+
+        return false;
+    }
+
+    // Runs the next ready process in place of one that exited or blocked.
+    // With none left nothing could ever wake the rest.
+
+    void Kernel::ScheduleNextProcess(Process::process_id_type previous_process_id)
+    {
+        process_list_type::size_type next_process_index = SelectNextProcess();
+
+        // Only I/O still in flight can wake someone up now
+
+        while (next_process_index == processes.size() && _io.GetInFlightCount() > 0) {
+            std::cout << "Kernel: every process is blocked, waiting for I/O." << std::endl;
+
+            // The machine has nothing else to do
+
+            ZeroFrames();
+
+            _io.WaitForCompletion();
+            _io_rings.DeliverCompletions(*this);
+
+            next_process_index = SelectNextProcess();
+        }
+
+        if (next_process_index == processes.size()) {
+            std::cout << "Kernel: every process is blocked. Stopping the machine." << std::endl;
+
+            machine.Stop();
+
+            return;
+        }
+
+        std::cout << "Kernel: switching the context to process " << processes[next_process_index].id << std::endl;
+
+        if (_tracer) {
+            _tracer->ContextSwitch(machine.cpu.cycles, previous_process_id + 1,
+                                   processes[next_process_index].id + 1);
+        }
+
+        SwitchToProcess(next_process_index, false);
+
+        _cycles_passed_after_preemption = 0;
+    }
+
+    void Kernel::HandleSegmentCreate()
+    {
+        std::cout << "Kernel: processing the shared memory create software interrupt." << std::endl;
+
+        Registers &registers = machine.cpu.registers;
+
+        int key = registers.a;
+        registers.a = -1;
+
+        const SegmentTable::frame_list_type *existing = _segments.Find(key);
+        if (existing) {
+            if (registers.c > 0 && static_cast<MMU::page_table_size_type>(registers.c) == existing->size()) {
+                registers.a = 0;
+            } else {
+                std::cerr << "Kernel: the shared memory segment " << key << " already exists with another size." << std::endl;
+            }
+
+            return;
+        }
+
+        if (registers.c <= 0 || static_cast<MMU::page_table_size_type>(registers.c) > machine.mmu.page_table->size()) {
+            std::cerr << "Kernel: invalid shared memory segment size (" << registers.c << ")." << std::endl;
+
+            return;
+        }
+
+        if (!_segments.Create(key, static_cast<MMU::page_table_size_type>(registers.c))) {
+            std::cerr << "Kernel: failed to allocate the shared memory segment " << key << "." << std::endl;
+
+            return;
+        }
+
+        registers.a = 0;
+
+        TraceMemory();
+    }
+
+    // Whatever the process had mapped in the range is dropped
+
+    void Kernel::HandleSegmentAttach()
+    {
+        std::cout << "Kernel: processing the shared memory attach software interrupt." << std::endl;
+
+        Registers &registers = machine.cpu.registers;
+
+        const SegmentTable::frame_list_type *frames = _segments.Find(registers.a);
+        if (!frames) {
+            std::cerr << "Kernel: the shared memory segment " << registers.a << " does not exist." << std::endl;
+
+            registers.a = -1;
+
+            return;
+        }
+
+        MMU::page_table_type &page_table = *machine.mmu.page_table;
+
+        MMU::page_table_size_type first_page = static_cast<MMU::vmem_size_type>(registers.b) / machine.mmu.GetPageSize();
+        if (registers.b < 0 || first_page + frames->size() > page_table.size()) {
+            std::cerr << "Kernel: the shared memory segment " << registers.a << " does not fit at " << registers.b << "." << std::endl;
+
+            registers.a = -1;
+
+            return;
+        }
+
+        for (SegmentTable::frame_list_type::size_type i = 0; i < frames->size(); ++i) {
+            MMU::page_entry_type frame = (*frames)[i];
+            if (page_table[first_page + i] != frame) {
+                SplitHugePage(processes[_current_process_index], first_page + i);
+                DropMigratedPages(processes[_current_process_index], first_page + i, 1);
+
+                machine.mmu.ReleaseFrame(page_table[first_page + i]);
+                machine.mmu.ShareFrame(frame);
+                processes[_current_process_index].MapPage(first_page + i, frame);
+            }
+        }
+
+        registers.a = 0;
+    }
+
+    void Kernel::HandleSegmentWait()
+    {
+        std::cout << "Kernel: processing the shared memory wait software interrupt." << std::endl;
+
+        Registers &registers = machine.cpu.registers;
+
+        if (!_segments.Find(registers.a)) {
+            std::cerr << "Kernel: the shared memory segment " << registers.a << " does not exist." << std::endl;
+
+            registers.a = -1;
+
+            return;
+        }
+
+        Process &process = processes[_current_process_index];
+
+        int key = registers.a;
+        registers.a = 0;
+
+        if (_segments.Wait(key, process.id)) {
+            return;
+        }
+
+        std::cout << "Kernel: blocking the process " << process.id << std::endl;
+
+        process.registers = registers;
+        process.state = Process::Blocked;
+
+        ScheduleNextProcess(process.id);
+    }
+
+    void Kernel::HandleSegmentNotify()
+    {
+        std::cout << "Kernel: processing the shared memory notify software interrupt." << std::endl;
+
+        Registers &registers = machine.cpu.registers;
+
+        if (!_segments.Find(registers.a)) {
+            std::cerr << "Kernel: the shared memory segment " << registers.a << " does not exist." << std::endl;
+
+            registers.a = -1;
+
+            return;
+        }
+
+        int key = registers.a;
+        registers.a = 0;
+
+        Process::process_id_type waiter_id = 0;
+        if (!_segments.Notify(key, waiter_id)) {
+            return;
+        }
+
+        Process *waiter = FindProcess(waiter_id);
+        if (waiter) {
+            std::cout << "Kernel: waking up the process " << waiter->id << std::endl;
+
+            waiter->state = Process::Ready;
+        }
+    }
+
+    void Kernel::HandleIOSetup()
+    {
+        std::cout << "Kernel: processing the I/O setup software interrupt." << std::endl;
+
+        Registers &registers = machine.cpu.registers;
+        Process &process = processes[_current_process_index];
+
+        MMU::vmem_size_type address_space_size = process.page_table->size() * machine.mmu.GetPageSize();
+        MMU::vmem_size_type address = static_cast<MMU::vmem_size_type>(registers.a);
+        MMU::vmem_size_type size = IORingTable::HEADER_SIZE +
+                                   registers.b * (IORingTable::SUBMISSION_SIZE + IORingTable::COMPLETION_SIZE);
+
+        if (registers.a < 0 || registers.b <= 0 || registers.b > IORingTable::MAX_ENTRIES ||
+            address + size > address_space_size) {
+            std::cerr << "Kernel: invalid I/O ring (" << registers.a << ", " << registers.b << ")." << std::endl;
+
+            registers.a = -1;
+        } else if (_io_rings.GetInFlightCount(process.id) > 0) {
+            std::cerr << "Kernel: the I/O ring of the process " << process.id << " still has requests in flight." << std::endl;
+
+            registers.a = -1;
+        } else {
+            registers.a = _io_rings.Setup(*this, process, address, static_cast<unsigned int>(registers.b)) ? 0 : -1;
+        }
+    }
+
+    // Returns how many submissions were taken, the rest stay queued
+
+    void Kernel::HandleIOSubmit()
+    {
+        std::cout << "Kernel: processing the I/O submit software interrupt." << std::endl;
+
+        Registers &registers = machine.cpu.registers;
+        Process &process = processes[_current_process_index];
+
+        if (!_io_rings.HasRing(process.id)) {
+            std::cerr << "Kernel: the process " << process.id << " has no I/O ring." << std::endl;
+
+            registers.a = -1;
+
+            return;
+        }
+
+        registers.a = _io_rings.Submit(*this, process);
+
+        statistics.io_requests += registers.a;
+    }
+
+    void Kernel::HandleIOWait()
+    {
+        std::cout << "Kernel: processing the I/O wait software interrupt." << std::endl;
+
+        Registers &registers = machine.cpu.registers;
+        Process &process = processes[_current_process_index];
+
+        if (!_io_rings.HasRing(process.id)) {
+            std::cerr << "Kernel: the process " << process.id << " has no I/O ring." << std::endl;
+
+            registers.a = -1;
+
+            return;
+        }
+
+        bool block = false;
+        registers.a = _io_rings.Wait(*this, process, block);
+
+        if (!block) {
+            return;
+        }
+
+        std::cout << "Kernel: blocking the process " << process.id << std::endl;
+
+        process.registers = registers;
+        process.state = Process::Blocked;
+
+        ScheduleNextProcess(process.id);
+    }
+
+    // The heap picks the chunk, the pages it splits and whole page requests
+    // come off the process's block list. Only an empty class walks the
+    // block list.
+
+    void Kernel::HandleHeapAllocate()
+    {
+        std::cout << "Kernel: processing the heap allocate software interrupt." << std::endl;
+
+        Registers &registers = machine.cpu.registers;
+        Process &process = processes[_current_process_index];
+
+        int size = registers.a;
+        registers.a = -1;
+
+        if (size <= 0) {
+            std::cerr << "Kernel: invalid heap allocation size (" << size << ")." << std::endl;
+
+            return;
+        }
+
+        const MMU::ram_size_type page_size = machine.mmu.GetPageSize();
+
+        heap_map_type::iterator heap = _heaps.find(process.id);
+        if (heap == _heaps.end()) {
+            heap = _heaps.insert(std::make_pair(process.id, Heap(process.page_table->size(), page_size))).first;
+        }
+
+        int heap_class = heap->second.SelectClass(size);
+        MMU::vmem_size_type address = 0;
+
+        if (heap_class == Heap::CLASS_COUNT || !heap->second.TakeChunk(heap_class, address)) {
+            MMU::ram_size_type pages = AllocateMemory(heap_class == Heap::CLASS_COUNT ? size : page_size, &process);
+            if (pages == NO_ADDRESS) {
+                std::cerr << "Kernel: the heap of the process " << process.id << " is out of pages." << std::endl;
+
+                return;
+            }
+
+            if (heap_class == Heap::CLASS_COUNT) {
+                heap->second.AddWholePages(pages);
+                address = pages;
+            } else {
+                heap->second.AddPage(heap_class, pages);
+                heap->second.TakeChunk(heap_class, address);
+            }
+        }
+
+        registers.a = static_cast<int>(address);
+    }
+
+    // Whole pages go back to the block list without their frames, so that
+    // touching them again faults in fresh ones
+
+    void Kernel::HandleHeapFree()
+    {
+        std::cout << "Kernel: processing the heap free software interrupt." << std::endl;
+
+        Registers &registers = machine.cpu.registers;
+        Process &process = processes[_current_process_index];
+
+        MMU::vmem_size_type address = static_cast<MMU::vmem_size_type>(registers.a);
+        MMU::page_table_size_type page = address / machine.mmu.GetPageSize();
+
+        registers.a = -1;
+
+        heap_map_type::iterator heap = _heaps.find(process.id);
+        Heap::FreeResult result = heap != _heaps.end() ? heap->second.Free(address) : Heap::NotHandedOut;
+
+        if (result == Heap::ChunkFreed) {
+            registers.a = 0;
+        } else if (result == Heap::PagesFreed) {
+            MMU::header *block = process.blocklist;
+            while (block && block->block != page) {
+                block = block->next;
+            }
+
+            if (block && !block->free) {
+                std::vector<MMU::page_entry_type> frames;
+                for (MMU::page_table_size_type i = page; i < page + block->size; ++i) {
+                    SplitHugePage(process, i);
+
+                    frames.push_back((*process.page_table)[i]);
+                    (*process.page_table)[i] = MMU::INVALID_PAGE;
+                }
+                machine.mmu.ReleaseFrames(frames);
+                DropMigratedPages(process, page, block->size);
+
+                FreeMemory(address, &process);
+
+                registers.a = 0;
+            }
+        }
+
+        if (registers.a != 0) {
+            std::cerr << "Kernel: the process " << process.id << " freed an address the heap did not hand out ("
+                      << address << ")." << std::endl;
+        }
+    }
+
+    bool Kernel::ReadGuestWord(const Process &process, MMU::vmem_size_type address, int &value) const
+    {
+        MMU::page_table_size_type page = address / machine.mmu.GetPageSize();
+        if (page >= process.page_table->size()) {
+            return false;
+        }
+
+        // Pages never touched read as zero
+
+        MMU::page_entry_type frame = (*process.page_table)[page];
+        if (frame != MMU::INVALID_PAGE) {
+            value = machine.mmu.ram[frame + address % machine.mmu.GetPageSize()];
+
+            return true;
+        }
+
+        value = 0;
+
+        migrated_page_map_type::const_iterator pages = _migrated_pages.find(process.id);
+        if (pages != _migrated_pages.end()) {
+            page_contents_type::const_iterator contents = pages->second.find(page);
+            if (contents != pages->second.end()) {
+                value = contents->second[address % machine.mmu.GetPageSize()];
+            }
+        }
+
+        return true;
+    }
+
+    bool Kernel::WriteGuestWord(Process &process, MMU::vmem_size_type address, int value)
+    {
+        MMU::page_table_size_type page = address / machine.mmu.GetPageSize();
+        if (page >= process.page_table->size()) {
+            return false;
+        }
+
+        MMU::page_table_type &page_table = *process.page_table;
+
+        if (page_table[page] == MMU::INVALID_PAGE && !PullMigratedPage(process, page)) {
+            MMU::page_entry_type frame = machine.mmu.AcquireFrame();
+            if (frame == MMU::INVALID_PAGE) {
+                return false;
+            }
+
+            process.MapPage(page, frame);
+        } else if (machine.mmu.IsShared(page_table[page]) && !CopyOnWrite(page_table, page)) {
+            return false;
+        }
+
+        machine.mmu.ram[page_table[page] + address % machine.mmu.GetPageSize()] = value;
+
+        return true;
+    }
+
+    bool Kernel::PullMigratedPage(Process &process, MMU::page_table_size_type page)
+    {
+        migrated_page_map_type::iterator pages = _migrated_pages.find(process.id);
+        if (pages == _migrated_pages.end()) {
+            return false;
+        }
+
+        page_contents_type::iterator contents = pages->second.find(page);
+        if (contents == pages->second.end()) {
+            return false;
+        }
+
+        MMU::page_entry_type frame = machine.mmu.AcquireFrame(false);
+        if (frame == MMU::INVALID_PAGE) {
+            return false;
+        }
+
+        std::copy(contents->second.begin(), contents->second.end(), machine.mmu.ram.begin() + frame);
+        process.MapPage(page, frame);
+
+        pages->second.erase(contents);
+        if (pages->second.empty()) {
+            _migrated_pages.erase(pages);
+        }
+
+        ++statistics.migrated_pages;
+
+        return true;
+    }
+
+    // Fork shares frames, so the parent's pages all have to be in place first
+
+    void Kernel::PullMigratedPages(Process &process)
+    {
+        migrated_page_map_type::iterator pages;
+        while ((pages = _migrated_pages.find(process.id)) != _migrated_pages.end()) {
+            if (!PullMigratedPage(process, pages->second.begin()->first)) {
+                std::cerr << "Kernel: failed to map the migrated pages of the process " << process.id << "." << std::endl;
+
+                return;
+            }
+        }
+    }
+
+    void Kernel::DropMigratedPages(const Process &process, MMU::page_table_size_type first_page, MMU::page_table_size_type count)
+    {
+        migrated_page_map_type::iterator pages = _migrated_pages.find(process.id);
+        if (pages == _migrated_pages.end()) {
+            return;
+        }
+
+        pages->second.erase(pages->second.lower_bound(first_page), pages->second.lower_bound(first_page + count));
+        if (pages->second.empty()) {
+            _migrated_pages.erase(pages);
+        }
+    }
+
+    void Kernel::AdmitArrivals()
+    {
+        while (_next_arrival < _arrivals.size() && _arrivals[_next_arrival].cycle <= machine.cpu.cycles) {
+            const Arrival &arrival = _arrivals[_next_arrival++];
+
+            if (CreateProcess(arrival.name, arrival.image)) {
+                processes.back().priority = arrival.priority;
+
+                if (_record_processes) {
+                    _process_records[processes.back().id].arrival_cycle = arrival.cycle;
+                }
+            }
+        }
+    }
+
+    void Kernel::RecordArrival(const Process &process, const std::string &name)
+    {
+        ProcessRecord &record = _process_records[process.id];
+        record.id = process.id;
+        record.name = name;
+        record.arrival_cycle = machine.cpu.cycles;
+    }
+
+    void Kernel::RecordDispatch(const Process &process)
+    {
+        ChargeDispatchedProcess();
+
+        process_record_map_type::iterator record = _process_records.find(process.id);
+        if (record != _process_records.end() && !record->second.started) {
+            record->second.first_run_cycle = machine.cpu.cycles;
+            record->second.started = true;
+        }
+
+        _dispatched = true;
+        _dispatched_process_id = process.id;
+        _dispatch_cycle = machine.cpu.cycles;
+    }
+
+    void Kernel::RecordExit(const Process &process)
+    {
+        ChargeDispatchedProcess();
+
+        process_record_map_type::iterator record = _process_records.find(process.id);
+        if (record != _process_records.end()) {
+            record->second.priority = process.priority;
+            record->second.exit_cycle = machine.cpu.cycles;
+
+            records.push_back(record->second);
+            _process_records.erase(record);
+        }
+    }
+
+    // The cycles since the last dispatch went to the process it loaded
+
+    void Kernel::ChargeDispatchedProcess()
+    {
+        if (_dispatched) {
+            process_record_map_type::iterator record = _process_records.find(_dispatched_process_id);
+            if (record != _process_records.end()) {
+                record->second.run_cycles += machine.cpu.cycles - _dispatch_cycle;
+            }
+
+            _dispatched = false;
+        }
+    }
+
+    Process *Kernel::FindProcess(Process::process_id_type id)
+    {
+        for (process_list_type::iterator it = processes.begin(); it != processes.end(); ++it) {
+            if (it->id == id) {
+                return &*it;
+            }
+        }
+
+        return NULL;
+    }
+
+    // Picks the process to run when the machine starts or the current one
+    // exits. Round robin simply continues with the process after it.
+
+    Kernel::process_list_type::size_type Kernel::SelectNextProcess() const
+    {
+        process_list_type::size_type selected = FindReadyProcess(0);
+        if (selected == processes.size()) {
+            return selected;
+        }
+
+        switch (scheduler) {
+        case ShortestJob:
+            for (process_list_type::size_type i = selected + 1; i < processes.size(); ++i) {
+                if (processes[i].state != Process::Blocked &&
+                    processes[i].sequential_instruction_count < processes[selected].sequential_instruction_count) {
+                    selected = i;
+                }
+            }
+
+            break;
+        case Priority:
+            for (process_list_type::size_type i = selected + 1; i < processes.size(); ++i) {
+                if (processes[i].state != Process::Blocked && processes[selected] < processes[i]) {
+                    selected = i;
+                }
+            }
+
+            break;
+        case RoundRobin:
+            selected = FindReadyProcess(_current_process_index);
+
+            break;
+        default:
+            break;
+        }
+
+        return selected;
+    }
+
+    // The first process that is not blocked, searching from "start" and
+    // wrapping around
+
+    Kernel::process_list_type::size_type Kernel::FindReadyProcess(process_list_type::size_type start) const
+    {
+        for (process_list_type::size_type i = 0; i < processes.size(); ++i) {
+            process_list_type::size_type index = (start + i) % processes.size();
+            if (processes[index].state != Process::Blocked) {
+                return index;
+            }
+        }
+
+        return processes.size();
+    }
+
+    void Kernel::LoadProcess(process_list_type::size_type index)
+    {
+        _current_process_index = index;
+
+        if (_record_processes) {
+            RecordDispatch(processes[index]);
+        }
+
+        machine.cpu.registers = processes[index].registers;
+
+        machine.cpu.verified = processes[index].verified;
+        machine.mmu.page_table = processes[index].page_table;
+        machine.mmu.huge_mappings = &processes[index].huge_mappings;
+        machine.mmu.blocklist = processes[index].blocklist;
+
+        if (_jit) {
+            _jit->Resume(processes[index].registers.ip);
+        }
+
+        processes[index].state = Process::Running;
+
+        NotifyRunning(processes[index]);
+    }
+
+    void Kernel::SwitchToProcess(process_list_type::size_type index, bool save_current)
+    {
+        std::chrono::steady_clock::time_point switch_start = std::chrono::steady_clock::now();
+
+        if (save_current) {
+            processes[_current_process_index].registers = machine.cpu.registers;
+            processes[_current_process_index].state = Process::Ready;
+        }
+
+        LoadProcess(index);
+
+        ++statistics.context_switches;
+        statistics.context_switch_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - switch_start).count();
+    }
+
+    void Kernel::UnloadCurrentProcess()
+    {
+        Process &process = processes[_current_process_index];
+
+        if (_tracer) {
+            _tracer->ProcessExit(machine.cpu.cycles, process.id + 1);
+            _tracer->EndSlice(machine.cpu.cycles);
+        }
+
+        // Only the pages it mapped hold frames, they go back together
+
+        process.PruneMappedPages();
+
+        std::vector<MMU::page_entry_type> frames;
+        frames.reserve(process.mapped_pages.size());
+        for (std::vector<MMU::page_table_size_type>::const_iterator it = process.mapped_pages.begin(); it != process.mapped_pages.end(); ++it) {
+            frames.push_back((*process.page_table)[*it]);
+        }
+        machine.mmu.ReleaseFrames(frames);
+        // Forked processes share the image, the last one to exit frees it
+
+        bool image_shared = false;
+        for (process_list_type::size_type i = 0; i < processes.size(); ++i) {
+            if (i != _current_process_index && processes[i].memory_start_position == process.memory_start_position) {
+                image_shared = true;
+
+                break;
+            }
+        }
+
+        if (!image_shared) {
+            //send the start position of the memory to be freed
+            FreeMemory(process.memory_start_position, NULL);
+
+            if (_jit) {
+                _jit->Invalidate(process.memory_start_position, process.memory_end_position);
+            }
+        }
+
+        TraceMemory();
+
+        _io_rings.Remove(process.id);
+        _heaps.erase(process.id);
+        _migrated_pages.erase(process.id);
+
+        processes.erase(processes.begin() + _current_process_index);
+    }
+
+    // Process tracks are offset by one so that track 0 stays reserved for the kernel
+
+    void Kernel::NotifyRunning(const Process &process)
+    {
+        if (_profiler) {
+            _profiler->SetCurrentProcess(process.id);
+        }
+
+        if (_tracer) {
+            std::ostringstream slice_name;
+            slice_name << "process " << process.id;
+
+            _tracer->BeginSlice(machine.cpu.cycles, process.id + 1, slice_name.str());
+        }
+    }
+
+    void Kernel::TraceMemory()
+    {
+        if (_tracer) {
+            MMU::ram_size_type free_frames = machine.mmu.GetFreeFrameCount();
+
+            _tracer->MemoryCounter(machine.cpu.cycles, machine.mmu.GetFrameCount() - free_frames, free_frames);
+        }
+    }
 }
@@ -2,14 +2,25 @@
 #define KERNEL_H
 
 #include <deque>
+#include <map>
 #include <queue>
 #include <string>
 
 #include "machine.h"
 #include "process.h"
+#include "trace.h"
+#include "profiler.h"
+#include "jit.h"
+#include "io.h"
+#include "segments.h"
+#include "rings.h"
+#include "heap.h"
 
 namespace vm
 {
+    class Balancer;
+    class Daemon;
+
     class Kernel
     {
     public:
@@ -21,9 +32,181 @@ namespace vm
             Priority
         };
 
+        static const unsigned int DEFAULT_QUANTUM = 5;
+
+        // A program entering the machine at a set cycle, for replaying
+        // arrival traces
+
+        struct Arrival
+        {
+            CPU::cycle_count_type cycle;
+
+            std::string name;
+            MMU::ram_type image;
+
+            Process::process_priority_type priority;
+
+            Arrival();
+        };
+
+        typedef std::vector<Arrival> arrival_list_type;
+
+        struct Options
+        {
+            Tracer *tracer;
+            Profiler *profiler;
+            Jit *jit;
+
+            PIT::frequency_type timer_frequency;
+
+            // Stop the machine on the first timer tick past this many cycles, 0 for no limit
+
+            CPU::cycle_count_type cycle_limit;
+
+            // Without it the constructor only loads the executables and the
+            // caller starts the machine itself
+
+            bool start_machine;
+
+            // Host files guests can read and write, by their index here
+
+            std::vector<std::string> files;
+            unsigned int io_threads;
+
+            // Pages the compactor may move at the end of each scheduler
+            // quantum, 0 to compact only when a program fails to load
+
+            MMU::ram_size_type compaction_pages;
+
+            // Words per page, see MMU::IsValidPageSize
+
+            MMU::ram_size_type page_size;
+
+            // Regions of MMU::HUGE_PAGE_PAGES pages a process has filled are
+            // remapped as one huge page, and the region after a huge page is
+            // mapped as a huge page on its first fault
+
+            bool huge_pages;
+
+            // Free frames kept cleared ahead of the page faults that want them,
+            // topped up while the machine has nothing to run or every process
+            // waits for I/O. With 0 faults clear their frames.
+
+            MMU::ram_size_type zeroed_frames;
+
+            // Timer ticks round robin lets a process run on before it
+            // preempts it
+
+            unsigned int quantum;
+
+            // Loaded on the first timer tick at or past their cycle, in
+            // order. A machine with nothing to run skips ahead to the next
+            // one, the cycles skipped count as idle.
+
+            arrival_list_type arrivals;
+
+            // Keep a record of every process that exits in Kernel::records
+
+            bool record_processes;
+
+            // Kernels sharing a balancer run side by side, each on its own
+            // host thread, and hand processes to each other
+
+            Balancer *balancer;
+
+            // Kernels of a daemon stay up with nothing to run and take the
+            // jobs it queues, reporting back as each one exits
+
+            Daemon *daemon;
+
+            Options();
+        };
+
+        // Software interrupts, the rest end the process like EXIT_INTERRUPT.
+        // Results come back in a, -1 on failure. Every INT used to end the
+        // process, and guests written then end with INT 1, 2 or 3, so those
+        // three still do. Fork is numbered after the other services.
+
+        static const int EXIT_INTERRUPT = 1;
+        static const int FORK_INTERRUPT = 13;
+
+        // Shared memory: create a segment of c pages under the key in a, map
+        // it at the virtual address in b, and wait for or post a notification
+        // on it. Creating a segment that exists with the same size succeeds,
+        // so either side of a pair may come first. Notifications are
+        // counted, so one posted before the wait is not lost.
+
+        static const int SEGMENT_CREATE_INTERRUPT = 4;
+        static const int SEGMENT_ATTACH_INTERRUPT = 5;
+        static const int SEGMENT_WAIT_INTERRUPT = 6;
+        static const int SEGMENT_NOTIFY_INTERRUPT = 7;
+
+        // I/O: set up a ring of b entries at the virtual address in a, submit
+        // every request queued in it, and wait for a completion. The wait
+        // returns how many completions are ready. See IORingTable for the
+        // ring layout.
+
+        static const int IO_SETUP_INTERRUPT = 8;
+        static const int IO_SUBMIT_INTERRUPT = 9;
+        static const int IO_WAIT_INTERRUPT = 10;
+
+        // Heap: allocate a words and return their virtual address in a, or
+        // free the allocation at the address in a. Pages are backed by frames
+        // on first touch. Requests up to the largest size class are carved
+        // out of pages kept per class; larger ones take whole pages from the
+        // process's block list.
+
+        static const int HEAP_ALLOCATE_INTERRUPT = 11;
+        static const int HEAP_FREE_INTERRUPT = 12;
+
+        struct Statistics
+        {
+            unsigned long long page_faults;
+            unsigned long long copy_on_write_faults;
+            unsigned long long forks;
+            unsigned long long io_requests;
+            unsigned long long compacted_pages;
+            unsigned long long huge_pages;
+            unsigned long long zeroed_frames;
+            unsigned long long migrations;
+            unsigned long long migrated_pages;
+            unsigned long long context_switches;
+            unsigned long long context_switch_nanoseconds;
+            unsigned long long idle_cycles;
+
+            Statistics();
+        };
+
         typedef std::deque<Process> process_list_type;
         typedef std::priority_queue<Process> process_priorities_type;
 
+        // The words of a page, by page, for pages not in a page table
+
+        typedef std::map<MMU::page_table_size_type, MMU::ram_type> page_contents_type;
+
+        struct Migration;
+
+        // Cycles of one process's life. Run cycles are the ones it spent on
+        // the CPU, the rest of its turnaround it waited.
+
+        struct ProcessRecord
+        {
+            Process::process_id_type id;
+            std::string name;
+            Process::process_priority_type priority;
+
+            CPU::cycle_count_type arrival_cycle;
+            CPU::cycle_count_type first_run_cycle;
+            CPU::cycle_count_type exit_cycle;
+            CPU::cycle_count_type run_cycles;
+
+            bool started;
+
+            ProcessRecord();
+        };
+
+        typedef std::vector<ProcessRecord> process_record_list_type;
+
         Machine machine;
 
         process_list_type processes;
@@ -31,26 +214,232 @@ namespace vm
 
         Scheduler scheduler;
 
+        Statistics statistics;
+
+        process_record_list_type records;
+
 		MMU::page_table_type *page_table;
 		MMU::header *blocklist;
 
-        Kernel(Scheduler scheduler, std::vector<std::string> executables_paths);
+        Kernel(Scheduler scheduler, std::vector<std::string> executables_paths, const Options &options = Options());
         virtual ~Kernel();
 
-        void CreateProcess(const std::string &name);
+        // Both return false when the program is not loaded. The name only
+        // labels the process for the tracer and the profiler.
+
+        bool CreateProcess(const std::string &name);
+        bool CreateProcess(const std::string &name, const MMU::ram_type &image);
+
+        static bool ReadProgram(const std::string &path, MMU::ram_type &image);
+
+        // AllocateMemory returns NO_ADDRESS when no free block is large enough
+
+        static const MMU::ram_size_type NO_ADDRESS = static_cast<MMU::ram_size_type>(-1);
 
         MMU::ram_size_type AllocateMemory(MMU::ram_size_type units, Process *process);
         void FreeMemory(MMU::ram_size_type physical_memory_index, Process *process);
 
+        // Slides blocks in use down over the free ones before them, so that
+        // free physical memory ends up in one piece. Moves at most "budget"
+        // pages, 0 for no limit, and returns how many it moved.
+
+        MMU::ram_size_type CompactMemory(MMU::ram_size_type budget);
+
+        // Live migration, each called on this kernel's thread. Export takes a
+        // ready process off this machine, import resumes one taken off
+        // another. Both leave everything as it was when they return false.
+
+        bool ExportProcess(Migration &migration);
+        bool ImportProcess(Migration &migration);
+
+        // Processes ready or running, the balancer's measure of load
+
+        process_list_type::size_type GetRunnableProcessCount() const;
+
+        // The scheduler's context switch: saves the running process when
+        // "save_current" is set and loads the one at "index"
+
+        void SwitchToProcess(process_list_type::size_type index, bool save_current);
+
+        // Guest memory of any process, not only the running one, for the I/O
+        // rings. Writes map missing pages and copy shared ones like the
+        // faults would.
+
+        bool ReadGuestWord(const Process &process, MMU::vmem_size_type address, int &value) const;
+        bool WriteGuestWord(Process &process, MMU::vmem_size_type address, int value);
+
+        Process *FindProcess(Process::process_id_type id);
+
     private:
-        static const unsigned int _MAX_CYCLES_BEFORE_PREEMPTION = 5;
+        SegmentTable _segments;
+
+        IOService _io;
+        IORingTable _io_rings;
+
+        typedef std::map<Process::process_id_type, Heap> heap_map_type;
+
+        heap_map_type _heaps;
 
         Process::process_id_type _last_issued_process_id;
 		process_list_type::size_type _current_process_index;
 
         unsigned int _cycles_passed_after_preemption;
+        unsigned int _quantum;
 
         MMU::ram_size_type _free_physical_memory_index;
+
+        Tracer *_tracer;
+        Profiler *_profiler;
+        Jit *_jit;
+
+        CPU::cycle_count_type _cycle_limit;
+
+        MMU::ram_size_type _compaction_pages;
+
+        bool _huge_pages;
+
+        MMU::ram_size_type _zeroed_frames;
+
+        Balancer *_balancer;
+        unsigned int _balancer_machine;
+        CPU::cycle_count_type _next_balance_cycle;
+
+        // Pages of migrated processes still to be mapped, they are copied
+        // into frames as the process faults on them
+
+        typedef std::map<Process::process_id_type, page_contents_type> migrated_page_map_type;
+
+        migrated_page_map_type _migrated_pages;
+
+        Daemon *_daemon;
+        unsigned int _daemon_machine;
+        CPU::cycle_count_type _next_admission_cycle;
+
+        arrival_list_type _arrivals;
+        arrival_list_type::size_type _next_arrival;
+
+        // Records of the processes still running, and which one the cycles
+        // since the last dispatch go to
+
+        typedef std::map<Process::process_id_type, ProcessRecord> process_record_map_type;
+
+        bool _record_processes;
+        process_record_map_type _process_records;
+
+        bool _dispatched;
+        Process::process_id_type _dispatched_process_id;
+        CPU::cycle_count_type _dispatch_cycle;
+
+        static void TimerInterrupt(void *kernel);
+        static void PageFaultInterrupt(void *kernel);
+        static void ExitInterrupt(void *kernel);
+        static void ForkInterrupt(void *kernel);
+        static void SegmentCreateInterrupt(void *kernel);
+        static void SegmentAttachInterrupt(void *kernel);
+        static void SegmentWaitInterrupt(void *kernel);
+        static void SegmentNotifyInterrupt(void *kernel);
+        static void IOSetupInterrupt(void *kernel);
+        static void IOSubmitInterrupt(void *kernel);
+        static void IOWaitInterrupt(void *kernel);
+        static void HeapAllocateInterrupt(void *kernel);
+        static void HeapFreeInterrupt(void *kernel);
+
+        void HandleTimer();
+        void HandlePageFault();
+        void HandleExit();
+        void HandleFork();
+        void HandleCopyOnWrite(MMU::page_table_size_type page);
+        void HandleSegmentCreate();
+        void HandleSegmentAttach();
+        void HandleSegmentWait();
+        void HandleSegmentNotify();
+        void HandleIOSetup();
+        void HandleIOSubmit();
+        void HandleIOWait();
+        void HandleHeapAllocate();
+        void HandleHeapFree();
+
+        // Ends the running process, on its exit or when it goes over its
+        // page limit
+
+        void EndCurrentProcess(bool killed);
+
+        // Blocks a kernel left without processes until its balancer or
+        // daemon hands it one, or skips ahead to the next arrival. False
+        // when no process ever will come.
+
+        bool WaitForWork();
+
+        void AdmitArrivals();
+
+        void RecordArrival(const Process &process, const std::string &name);
+        void RecordDispatch(const Process &process);
+        void RecordExit(const Process &process);
+        void ChargeDispatchedProcess();
+
+        // Takes a single page out of a block list, when it is free
+
+        void ReserveMemory(MMU::ram_size_type block, Process *process);
+        void ReserveImagePages(const MMU::ram_type &image, Process *process);
+
+        bool CopyOnWrite(MMU::page_table_type &page_table, MMU::page_table_size_type page);
+
+        // Maps a page of a migrated process from its words. False when the
+        // page did not come with the process, or no frame is free.
+
+        bool PullMigratedPage(Process &process, MMU::page_table_size_type page);
+        void PullMigratedPages(Process &process);
+        void DropMigratedPages(const Process &process, MMU::page_table_size_type first_page, MMU::page_table_size_type count);
+
+        // Huge pages only ever hold private frames. Anything about to share,
+        // unmap or replace one of their pages splits them back into pages
+        // first, which only drops the marks.
+
+        bool MapHugePage(Process &process, MMU::page_table_size_type page);
+        bool PromoteHugePage(Process &process, MMU::page_table_size_type page);
+        void SplitHugePage(Process &process, MMU::page_table_size_type page);
+
+        // Blocks are either a frame, found through its reference count, or a
+        // program image, found through the processes running it. Anything
+        // else stays where it is.
+
+        bool MoveBlock(MMU::ram_size_type from, MMU::ram_size_type to, MMU::ram_size_type size);
+        void MoveFrame(MMU::page_entry_type from, MMU::page_entry_type to);
+        void MoveImage(MMU::ram_size_type from, MMU::ram_size_type to, MMU::ram_size_type size);
+
+        // Tops the zeroed frame pool up to Options::zeroed_frames, for when
+        // the machine would sit idle otherwise
+
+        void ZeroFrames();
+
+        // Both return processes.size() when every process is blocked
+
+        process_list_type::size_type SelectNextProcess() const;
+        process_list_type::size_type FindReadyProcess(process_list_type::size_type start) const;
+
+        void LoadProcess(process_list_type::size_type index);
+        void ScheduleNextProcess(Process::process_id_type previous_process_id);
+        void UnloadCurrentProcess();
+
+        void NotifyRunning(const Process &process);
+        void TraceMemory();
+    };
+
+    // Everything the target needs to rebuild the process. The page table
+    // stays behind empty, the mapped pages travel as their words.
+
+    struct Kernel::Migration
+    {
+        Process process;            // the image at address 0
+        MMU::ram_type image;
+        page_contents_type pages;
+
+        bool has_heap;
+        Heap heap;
+
+        std::string name;           // for the target's tracer and profiler
+
+        explicit Migration(const MMU &mmu);
     };
 }
 
@@ -2,8 +2,8 @@
 
 namespace vm
 {
-    Machine::Machine()
-        : mmu(), pic(), pit(pic), cpu(mmu, pic),
+    Machine::Machine(MMU::ram_size_type page_size)
+        : mmu(page_size), pic(), pit(pic), cpu(mmu, pic),
          _working(false) {}
 
     Machine::~Machine() {}
@@ -15,7 +15,29 @@ namespace vm
 
             while (_working) {
                 pit.Tick();
-                cpu.Step();
+
+                // Interrupts are delivered between instructions: the timer's
+                // before the next one runs, a fault's or an INT's right after
+                // the instruction that raised it
+
+                if (pic.HasPending()) {
+                    pic.Dispatch();
+                }
+
+                // Translated blocks retire many instructions per call, but
+                // never run past the next timer interrupt. A stop requested by
+                // the timer still lets exactly one instruction through.
+
+                CPU::cycle_count_type retired = _working ? cpu.RunTranslated(pit.GetCyclesUntilInterrupt()) : 0;
+                if (retired == 0) {
+                    cpu.Step();
+                } else {
+                    pit.Advance(static_cast<PIT::frequency_type>(retired - 1));
+                }
+
+                if (pic.HasPending()) {
+                    pic.Dispatch();
+                }
             }
         }
     }
@@ -16,7 +16,7 @@ namespace vm
         PIT pit;
         CPU cpu;
 
-        Machine();
+        explicit Machine(MMU::ram_size_type page_size = MMU::DEFAULT_PAGE_SIZE);
         virtual ~Machine();
 
         void Start();
@@ -1,63 +1,127 @@
 #include "mmu.h"
 
+#include <algorithm>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MMU_STREAMING_STORES
+#include <emmintrin.h>
+#endif
+
 namespace vm
 {
-    MMU::MMU()
-        : ram(RAM_SIZE)
+    namespace
     {
-		
+        // Sizes the MMU can not work with fall back to the default
+
+        MMU::ram_size_type SelectPageSize(MMU::ram_size_type page_size)
+        {
+            return MMU::IsValidPageSize(page_size) ? page_size : MMU::DEFAULT_PAGE_SIZE;
+        }
+
+        // Non-temporal stores leave the cache to the guest, a frame cleared
+        // ahead of time would otherwise push out lines still in use
+
+        void StreamZeros(int *words, MMU::ram_size_type count)
+        {
+#ifdef MMU_STREAMING_STORES
+            MMU::ram_size_type i = 0;
+
+            if (reinterpret_cast<std::size_t>(words) % sizeof(__m128i) == 0) {
+                const __m128i zero = _mm_setzero_si128();
+                for (; i + 4 <= count; i += 4) {
+                    _mm_stream_si128(reinterpret_cast<__m128i *>(words + i), zero);
+                }
+            }
+            for (; i < count; ++i) {
+                _mm_stream_si32(words + i, 0);
+            }
+
+            _mm_sfence();
+#else
+            std::fill(words, words + count, 0);
+#endif
+        }
+    }
+
+    MMU::MMU(ram_size_type page_size)
+        : ram(RAM_SIZE), page_table(NULL), huge_mappings(NULL),
+          frame_references(RAM_SIZE / SelectPageSize(page_size) + 1, 0),
+          shared_frames(RAM_SIZE / SelectPageSize(page_size) + 1, 0),
+          segment_frames(RAM_SIZE / SelectPageSize(page_size) + 1, 0),
+          huge_frames(RAM_SIZE / SelectPageSize(page_size) + 1, 0),
+          dirty_frames(RAM_SIZE / SelectPageSize(page_size) + 1, 0),
+          _page_size(SelectPageSize(page_size)), _page_shift(0), _zeroed_frames()
+    {
+        while ((static_cast<ram_size_type>(1) << _page_shift) < _page_size) {
+            ++_page_shift;
+        }
+
+		// Frame 0 is never handed out, so that INVALID_PAGE stays unambiguous
+
 		real_list = new header();
-		real_list->block = 0;
-		real_list->size = ram.size()/PAGE_SIZE;
+		real_list->block = 1;
+		real_list->size = ram.size()/_page_size - 1;
 		real_list->next = NULL;
 		real_list->free = true;
 		
-		//for (page_entry_type frame = PAGE_SIZE; frame< RAM_SIZE; frame += PAGE_SIZE) 
+		//for (page_entry_type frame = _page_size; frame< RAM_SIZE; frame += _page_size) 
 		//{
 		//	free_frames.push(frame);
 		//}
     }
 
-    MMU::~MMU() {}
+    MMU::~MMU()
+    {
+        while (real_list) {
+            header *next = real_list->next;
+            delete real_list;
+            real_list = next;
+        }
+    }
+
+    bool MMU::IsValidPageSize(ram_size_type page_size)
+    {
+        return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE && (page_size & (page_size - 1)) == 0;
+    }
 
-    MMU::page_table_type* MMU::CreateEmptyPageTable()
+    MMU::page_table_type* MMU::CreateEmptyPageTable() const
     {
-		MMU::page_table_type *table = new page_table_type(RAM_SIZE / PAGE_SIZE);
-		for(int i=0; i<RAM_SIZE / PAGE_SIZE; i++) {
+		MMU::page_table_type *table = new page_table_type(GetPageCount());
+		for(page_table_size_type i=0; i<GetPageCount(); i++) {
 			(*table)[i] = MMU::INVALID_PAGE;
 		}
 		return table;
     }
 
-	MMU::header* MMU::CreateNewVMBlockList() 
+	MMU::header* MMU::CreateNewVMBlockList() const
 	{
 		MMU::header *blocklist = new header();
 		blocklist->block = 0;
-		blocklist->size = RAM_SIZE/PAGE_SIZE;
+		blocklist->size = GetPageCount();
 		blocklist->next = NULL;
 		blocklist->free = true;
 		return blocklist;
 	}
 
-    MMU::page_index_offset_pair_type MMU::GetPageIndexAndOffsetForVirtualAddress(vmem_size_type address)
+    MMU::page_entry_type MMU::AcquireFrame(bool cleared)
     {
-        page_index_offset_pair_type result = std::make_pair((page_table_size_type) -1, (ram_size_type) -1);
+        if (cleared && !_zeroed_frames.empty()) {
+            page_entry_type frame = _zeroed_frames.back();
+            _zeroed_frames.pop_back();
 
-		result.first = address / PAGE_SIZE;
-		result.second = address % PAGE_SIZE;
+            frame_references[frame / _page_size] = 1;
 
-        return result;
-    }
+            return frame;
+        }
 
-    MMU::page_entry_type MMU::AcquireFrame()
-    {
 		MMU::header *current = real_list;
 		MMU::page_entry_type result = INVALID_PAGE;
 
 		while(current) {
 			if(current->free) {
 				
-				result = current->block;
+				result = current->block * _page_size;
 				current->free = false;
 
 				if(current->size > 1) {
@@ -70,35 +134,233 @@ namespace vm
 					current->next = tail;
 					current->size = 1;					
 				}
+
+				current = NULL;
 			} else {
 				current = current->next;
 			}
 		}
+
+		// The free list ran out, the pool has the rest
+
+		if (result == INVALID_PAGE && !_zeroed_frames.empty()) {
+			return AcquireFrame(true);
+		}
+
+		if (result != INVALID_PAGE) {
+			if (cleared && dirty_frames[result / _page_size]) {
+				ClearFrame(result, false);
+			}
+			dirty_frames[result / _page_size] = 0;
+			frame_references[result / _page_size] = 1;
+		}
+
 		return result;
     }
+
+    // The run is cut out of the first free block that holds an aligned one,
+    // and split into single frames like AcquireFrame's, so that ReleaseFrame
+    // can give them back one at a time. Pooled frames may be in the way of
+    // every aligned run, they go back to the free list before giving up.
+
+    MMU::page_entry_type MMU::AcquireHugeFrame(bool cleared)
+    {
+        for (header *current = real_list; current; current = current->next) {
+            if (!current->free) {
+                continue;
+            }
+
+            ram_size_type first = (current->block + HUGE_PAGE_PAGES - 1) / HUGE_PAGE_PAGES * HUGE_PAGE_PAGES;
+            if (first + HUGE_PAGE_PAGES > current->block + current->size) {
+                continue;
+            }
+
+            if (first > current->block) {
+                header *run = new header();
+                run->block = first;
+                run->size = current->block + current->size - first;
+                run->free = true;
+                run->next = current->next;
+
+                current->next = run;
+                current->size = first - current->block;
+                current = run;
+            }
+
+            if (current->size > HUGE_PAGE_PAGES) {
+                header *tail = new header();
+                tail->block = first + HUGE_PAGE_PAGES;
+                tail->size = current->size - HUGE_PAGE_PAGES;
+                tail->free = true;
+                tail->next = current->next;
+
+                current->next = tail;
+                current->size = HUGE_PAGE_PAGES;
+            }
+
+            for (ram_size_type frame = first; frame < first + HUGE_PAGE_PAGES; ++frame) {
+                current->block = frame;
+                current->size = 1;
+                current->free = false;
+
+                if (frame + 1 < first + HUGE_PAGE_PAGES) {
+                    header *next = new header();
+                    next->next = current->next;
+                    current->next = next;
+                    current = next;
+                }
+
+                if (cleared && dirty_frames[frame]) {
+                    ClearFrame(frame * _page_size, false);
+                }
+                dirty_frames[frame] = 0;
+                frame_references[frame] = 1;
+            }
+
+            return first * _page_size;
+        }
+
+        if (!_zeroed_frames.empty()) {
+            ReleaseZeroedFrames();
+
+            return AcquireHugeFrame(cleared);
+        }
+
+        return INVALID_PAGE;
+    }
+
+    MMU::ram_size_type MMU::ZeroFrames(ram_size_type count)
+    {
+        ram_size_type cleared = 0;
+        header *last = NULL;
+
+        for (ram_size_type i = 0; i < count; ++i) {
+            page_entry_type frame = TakeLastFreeFrame(last);
+            if (frame == INVALID_PAGE) {
+                break;
+            }
+
+            if (dirty_frames[frame / _page_size]) {
+                ClearFrame(frame, true);
+                dirty_frames[frame / _page_size] = 0;
+
+                ++cleared;
+            }
+
+            _zeroed_frames.push_back(frame);
+        }
+
+        return cleared;
+    }
+
+    void MMU::ReleaseZeroedFrames()
+    {
+        for (std::vector<page_entry_type>::const_iterator it = _zeroed_frames.begin(); it != _zeroed_frames.end(); ++it) {
+            FreeFrame(*it);
+        }
+
+        _zeroed_frames.clear();
+    }
     
     void MMU::ReleaseFrame(page_entry_type page)
     {
         //free_frames.push(page);
+			if (page != INVALID_PAGE && DropReference(page)) {
+				FreeFrame(page);
+			}
+    }
+
+    void MMU::ReleaseFrames(const std::vector<page_entry_type> &pages)
+    {
+        std::vector<ram_size_type> freed;
+        for (std::vector<page_entry_type>::const_iterator it = pages.begin(); it != pages.end(); ++it) {
+            if (*it != INVALID_PAGE && DropReference(*it)) {
+                freed.push_back(*it / _page_size);
+            }
+        }
+
+        std::sort(freed.begin(), freed.end());
+
+        // Both are in frame order. Every frame of a page table has a header
+        // of its own, freed ones are merged into a free block just before.
+
+        std::vector<ram_size_type>::const_iterator next = freed.begin();
+        header *previous = NULL;
+        header *current = real_list;
+
+        while (current && next != freed.end()) {
+            while (next != freed.end() && *next < current->block) {
+                ++next;
+            }
+            if (next != freed.end() && *next == current->block) {
+                current->free = true;
+                ++next;
+            }
+
+            if (previous && previous->free && current->free) {
+                previous->size += current->size;
+                previous->next = current->next;
+
+                delete current;
+            } else {
+                previous = current;
+            }
+            current = previous->next;
+        }
+
+        if (previous && previous->free && current && current->free) {
+            previous->size += current->size;
+            previous->next = current->next;
+
+            delete current;
+        }
+    }
+
+    // True when that was the last reference and the frame is free again
+
+    bool MMU::DropReference(page_entry_type page)
+    {
+        unsigned int &references = frame_references[page / _page_size];
+        if (references > 1) {
+            if (--references == 1) {
+                shared_frames[page / _page_size] = 0;
+            }
+
+            return false;
+        }
+
+        references = 0;
+        segment_frames[page / _page_size] = 0;
+        huge_frames[page / _page_size] = 0;
+        dirty_frames[page / _page_size] = 1;
+
+        return true;
+    }
+
+    void MMU::FreeFrame(page_entry_type page)
+    {
 			MMU::header *current = real_list;
 			MMU::header *prev = NULL;
 
 			while(current) {
-				if(current->block == page) {
+				if(current->block == page / _page_size) {
 					current->free = true;
 					if(prev) {
 						if(prev->free) {
 							// merge
 							prev->next = current->next;
 							prev->size += current->size;
+							delete current;
 							current = prev;
 						}
 					}
 					if(current->next) {
 						if(current->next->free) {
 							//merge
-							current->size += current->next->size;
-							current->next = current->next->next;
+							header *merged = current->next;
+							current->size += merged->size;
+							current->next = merged->next;
+							delete merged;
 						}
 					}
 					current = NULL;
@@ -109,4 +371,81 @@ namespace vm
 
 			}
     }
+
+    void MMU::ShareFrame(page_entry_type page)
+    {
+        if (page == INVALID_PAGE) {
+            return;
+        }
+
+        if (++frame_references[page / _page_size] > 1 && !segment_frames[page / _page_size]) {
+            shared_frames[page / _page_size] = 1;
+        }
+    }
+
+    MMU::ram_size_type MMU::GetFrameCount() const
+    {
+        return ram.size() / _page_size;
+    }
+
+    MMU::ram_size_type MMU::GetFreeFrameCount() const
+    {
+        ram_size_type result = _zeroed_frames.size();
+
+        for (const header *current = real_list; current; current = current->next) {
+            if (current->free) {
+                result += current->size;
+            }
+        }
+
+        return result;
+    }
+
+    // The pool sits at the far end of memory, past the blocks the compactor
+    // slides down. Frames come off the end of "last", so the list is walked
+    // again only once that block is used up.
+
+    MMU::page_entry_type MMU::TakeLastFreeFrame(header *&last)
+    {
+        if (last == NULL) {
+            for (header *current = real_list; current; current = current->next) {
+                if (current->free) {
+                    last = current;
+                }
+            }
+
+            if (last == NULL) {
+                return INVALID_PAGE;
+            }
+        }
+
+        if (last->size > 1) {
+            header *frame = new header();
+            frame->block = last->block + last->size - 1;
+            frame->size = 1;
+            frame->free = false;
+            frame->next = last->next;
+
+            last->next = frame;
+            last->size -= 1;
+
+            return frame->block * _page_size;
+        }
+
+        last->free = false;
+
+        page_entry_type frame = last->block * _page_size;
+        last = NULL;
+
+        return frame;
+    }
+
+    void MMU::ClearFrame(page_entry_type page, bool streaming)
+    {
+        if (streaming) {
+            StreamZeros(&ram[page], _page_size);
+        } else {
+            std::fill(ram.begin() + page, ram.begin() + page + _page_size, 0);
+        }
+    }
 }
@@ -22,13 +22,32 @@ namespace vm
         typedef std::pair<page_table_size_type, ram_size_type> page_index_offset_pair_type;
 
         static const ram_size_type RAM_SIZE = 0xFFFF; // 64 KB
-        static const ram_size_type PAGE_SIZE = 0x80;  // 128 B
+
+        // The page size is chosen per machine, a power of two in words
+        // between the two limits
+
+        static const ram_size_type DEFAULT_PAGE_SIZE = 0x80; // 128 B
+        static const ram_size_type MIN_PAGE_SIZE = 0x10;
+        static const ram_size_type MAX_PAGE_SIZE = 0x1000;
+
+        // A huge mapping covers this many pages, aligned in virtual and in
+        // physical memory, all mapped to private frames in order
+
+        static const page_table_size_type HUGE_PAGE_PAGES = 64;
+
+        // Page table entries hold the physical address of a frame. The first
+        // frame is reserved, so zero can never be a valid mapping.
 
         static const ram_size_type INVALID_PAGE = 0;
 
         ram_type ram;
         page_table_type* page_table;
 
+        // Per huge page sized region of the current address space, non-zero
+        // where it is mapped as one huge page
+
+        std::vector<unsigned char>* huge_mappings;
+
 		struct header {
 			header* next;
 			ram_size_type block;
@@ -40,19 +59,107 @@ namespace vm
 
 		header* real_list;
 
-        MMU();
+        // Per frame, indexed by the physical address divided by the page size.
+        // shared_frames is non-zero where the count is above one, except for
+        // frames of shared memory segments, which every mapping writes in place.
+
+        std::vector<unsigned int> frame_references;
+        std::vector<unsigned char> shared_frames;
+        std::vector<unsigned char> segment_frames;
+
+        // Non-zero for the frames of huge pages, which stay where they are
+        // when memory is compacted
+
+        std::vector<unsigned char> huge_frames;
+
+        // Non-zero for free frames that may still hold the words of whoever
+        // had them last. Nothing is handed out that way, see AcquireFrame.
+
+        std::vector<unsigned char> dirty_frames;
+
+        explicit MMU(ram_size_type page_size = DEFAULT_PAGE_SIZE);
         virtual ~MMU();
 
-        static page_table_type* CreateEmptyPageTable();
-		static header* CreateNewVMBlockList();
+        static bool IsValidPageSize(ram_size_type page_size);
+
+        ram_size_type GetPageSize() const { return _page_size; }
+        unsigned int GetPageShift() const { return _page_shift; }
+
+        // Pages in an address space, which is as large as the physical memory
+
+        page_table_size_type GetPageCount() const { return RAM_SIZE / _page_size; }
+        page_table_size_type GetHugePageRegionCount() const { return GetPageCount() / HUGE_PAGE_PAGES; }
+
+        page_table_type* CreateEmptyPageTable() const;
+		header* CreateNewVMBlockList() const;
+
+        page_index_offset_pair_type GetPageIndexAndOffsetForVirtualAddress(vmem_size_type address)
+        {
+            return std::make_pair(static_cast<page_table_size_type>(address >> _page_shift),
+                                  static_cast<ram_size_type>(address & (_page_size - 1)));
+        }
+
+        // Frames come cleared, from the zeroed pool first, then from the free
+        // list. Callers about to overwrite the whole frame pass false and
+        // take one from the free list as it is.
+
+        page_entry_type AcquireFrame(bool cleared = true);
 
-        page_index_offset_pair_type GetPageIndexAndOffsetForVirtualAddress(vmem_size_type address);
+        // HUGE_PAGE_PAGES frames in a row, starting at a multiple of that
+        // many frames. Returns the first or INVALID_PAGE.
+
+        page_entry_type AcquireHugeFrame(bool cleared = true);
+
+        // Moves up to "count" free frames into the zeroed pool, clearing the
+        // dirty ones with stores that bypass the cache. Returns how many it
+        // cleared. Pooled frames are taken off the end of the free list.
+
+        ram_size_type ZeroFrames(ram_size_type count);
+
+        // Hands the pool back to the free list, for allocations that need
+        // free memory in one piece
+
+        void ReleaseZeroedFrames();
+
+        ram_size_type GetZeroedFrameCount() const { return _zeroed_frames.size(); }
+
+        // Drops one reference, the frame goes back to the free list with the last
 
-        page_entry_type AcquireFrame();
         void ReleaseFrame(page_entry_type page);
 
+        // ReleaseFrame for many frames at once. The ones that lose their last
+        // reference go back to the free list in one pass over it.
+
+        void ReleaseFrames(const std::vector<page_entry_type> &pages);
+
+        // Adds a reference for another page table mapping the frame
+
+        void ShareFrame(page_entry_type page);
+
+        unsigned int GetFrameReferences(page_entry_type page) const { return frame_references[page >> _page_shift]; }
+
+        // Stores into a frame mapped more than once fault, so that the writer
+        // gets its own copy first
+
+        bool IsShared(page_entry_type page) const { return shared_frames[page >> _page_shift] != 0; }
+
+        ram_size_type GetFrameCount() const;
+        ram_size_type GetFreeFrameCount() const;
+
     private:
+        ram_size_type _page_size;
+        unsigned int _page_shift;
+
 		std::stack<page_entry_type> free_frames;
+
+        std::vector<page_entry_type> _zeroed_frames;
+
+        // "last" is the last free block of real_list, or NULL to look it up
+
+        page_entry_type TakeLastFreeFrame(header *&last);
+        bool DropReference(page_entry_type page);
+        void FreeFrame(page_entry_type page);
+        void ClearFrame(page_entry_type page, bool streaming);
     };
     
 }
@@ -0,0 +1,113 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+#include <cstddef>
+
+namespace vm
+{
+    // The instruction set, shared by the CPU and the assembler
+    class Opcodes
+    {
+    public:
+        static const int MOVA_BASE_OPCODE = 0x10;
+        static const int MOVB_BASE_OPCODE = MOVA_BASE_OPCODE + 1;
+        static const int MOVC_BASE_OPCODE = MOVA_BASE_OPCODE + 2;
+
+        static const int LDA_BASE_OPCODE = 0x20;
+        static const int LDB_BASE_OPCODE = LDA_BASE_OPCODE + 1;
+        static const int LDC_BASE_OPCODE = LDA_BASE_OPCODE + 2;
+
+        static const int STA_BASE_OPCODE = 0x30;
+        static const int STB_BASE_OPCODE = STA_BASE_OPCODE + 1;
+        static const int STC_BASE_OPCODE = STA_BASE_OPCODE + 2;
+
+        static const int JMP_BASE_OPCODE = 0x40;
+
+        static const int INT_BASE_OPCODE = 0x50;
+
+        // Superinstructions emitted by the assembler. A fused opcode replaces the
+        // first opcode of a pair and leaves the second instruction in place, so
+        // jumps into the pair and restarts after a page fault still work.
+
+        static const int MOVA_STA_FUSED_OPCODE = 0x60; // mov r N; st r ADDR
+        static const int MOVB_STB_FUSED_OPCODE = MOVA_STA_FUSED_OPCODE + 1;
+        static const int MOVC_STC_FUSED_OPCODE = MOVA_STA_FUSED_OPCODE + 2;
+
+        static const int LDA_STA_FUSED_OPCODE = 0x70;  // ld r SRC; st r DST
+        static const int LDB_STB_FUSED_OPCODE = LDA_STA_FUSED_OPCODE + 1;
+        static const int LDC_STC_FUSED_OPCODE = LDA_STA_FUSED_OPCODE + 2;
+
+        static const int LDA_LDA_FUSED_OPCODE = 0x80;  // ld r1 X; ld r2 Y, 0x80 + r1 * 3 + r2
+        static const int LDC_LDC_FUSED_OPCODE = LDA_LDA_FUSED_OPCODE + 8;
+
+        // Bulk memory instructions. The operand is unused, they work on the
+        // registers: a holds the destination (or first) virtual address, b the
+        // source (or second) address or the fill value, c the word count. Every
+        // page done is written back to a, b and c, so an instruction restarted
+        // after a page fault carries on from there. Compare leaves a and b at
+        // the first words that differ and sets flags to -1, 0 or 1.
+
+        static const int COPY_OPCODE = 0x90;    // copy c words from [b] to [a]
+        static const int FILL_OPCODE = 0x91;    // fill c words at [a] with b
+        static const int COMPARE_OPCODE = 0x92; // compare c words at [a] and [b]
+
+        // Every opcode fits in a byte, the CPU dispatches on a table this size
+
+        static const int OPCODE_COUNT = 0x100;
+
+        static const int REGISTER_COUNT = 3;
+    };
+
+    enum Operation
+    {
+        MoveOperation,
+        LoadOperation,
+        StoreOperation,
+        JumpOperation,
+        InterruptOperation,
+        MoveStoreOperation,
+        LoadStoreOperation,
+        LoadLoadOperation,
+        CopyOperation,
+        FillOperation,
+        CompareOperation
+    };
+
+    enum OperandKind
+    {
+        RegisterAndImmediate, // mov a 42, ld b 100
+        JumpTarget,           // jmp -2, jmp loop
+        Immediate,            // int 1
+        NoOperand             // copy
+    };
+
+    struct InstructionDescription
+    {
+        const char *mnemonic;    // NULL for superinstructions, which are never written by hand
+        int opcode;              // the first of the variants
+        int variants;            // one opcode per register, or per pair of registers
+        Operation operation;
+        OperandKind operands;
+    };
+
+    // Adding an instruction means a row here, a handler in the CPU and, when
+    // it can be written by hand, a free slot in the assembler's mnemonic hash
+
+    const InstructionDescription INSTRUCTION_TABLE[] = {
+        { "mov", Opcodes::MOVA_BASE_OPCODE, Opcodes::REGISTER_COUNT, MoveOperation, RegisterAndImmediate },
+        { "ld", Opcodes::LDA_BASE_OPCODE, Opcodes::REGISTER_COUNT, LoadOperation, RegisterAndImmediate },
+        { "st", Opcodes::STA_BASE_OPCODE, Opcodes::REGISTER_COUNT, StoreOperation, RegisterAndImmediate },
+        { "jmp", Opcodes::JMP_BASE_OPCODE, 1, JumpOperation, JumpTarget },
+        { "int", Opcodes::INT_BASE_OPCODE, 1, InterruptOperation, Immediate },
+        { NULL, Opcodes::MOVA_STA_FUSED_OPCODE, Opcodes::REGISTER_COUNT, MoveStoreOperation, RegisterAndImmediate },
+        { NULL, Opcodes::LDA_STA_FUSED_OPCODE, Opcodes::REGISTER_COUNT, LoadStoreOperation, RegisterAndImmediate },
+        { NULL, Opcodes::LDA_LDA_FUSED_OPCODE, Opcodes::REGISTER_COUNT * Opcodes::REGISTER_COUNT, LoadLoadOperation, RegisterAndImmediate },
+        { "copy", Opcodes::COPY_OPCODE, 1, CopyOperation, NoOperand },
+        { "fill", Opcodes::FILL_OPCODE, 1, FillOperation, NoOperand },
+        { "cmp", Opcodes::COMPARE_OPCODE, 1, CompareOperation, NoOperand }
+    };
+
+    const std::size_t INSTRUCTION_COUNT = sizeof(INSTRUCTION_TABLE) / sizeof(INSTRUCTION_TABLE[0]);
+}
+
+#endif
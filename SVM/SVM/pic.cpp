@@ -1,14 +1,58 @@
 #include "pic.h"
 
+#include <cstddef>
+#include <iostream>
+
 namespace vm
 {
+    PIC::FaultInfo::FaultInfo()
+        : ip(0), address(0), page(0), write(false) {}
+
     PIC::PIC()
-        : isr_0([]() {}),
-          isr_1([]() {}),
-          isr_2([]() {}),
-          isr_3([]() {}),
-          isr_4([]() {}),
-          isr_5([]() {}) {}
+        : fault(), _pending(0), _masked(0)
+    {
+        for (vector_type vector = 0; vector < VECTOR_COUNT; ++vector) {
+            _vectors[vector].handler = NULL;
+            _vectors[vector].context = NULL;
+            _vectors[vector].priority = 0;
+        }
+    }
 
     PIC::~PIC() {}
+
+    void PIC::SetHandler(vector_type vector, handler_type handler, void *context)
+    {
+        _vectors[vector].handler = handler;
+        _vectors[vector].context = context;
+    }
+
+    void PIC::SetPriority(vector_type vector, priority_type priority)
+    {
+        _vectors[vector].priority = priority;
+    }
+
+    void PIC::Dispatch()
+    {
+        mask_type deliverable;
+        while ((deliverable = _pending & ~_masked) != 0) {
+            vector_type selected = VECTOR_COUNT;
+            for (vector_type vector = 0; vector < VECTOR_COUNT; ++vector) {
+                if ((deliverable & (1u << vector)) != 0 &&
+                    (selected == VECTOR_COUNT || _vectors[vector].priority > _vectors[selected].priority)) {
+                    selected = vector;
+                }
+            }
+
+            _pending &= ~(1u << selected);
+
+            // Vectors without a handler are acknowledged and dropped, nothing
+            // should raise one
+
+            if (_vectors[selected].handler) {
+                _vectors[selected].handler(_vectors[selected].context);
+            } else {
+                std::cerr << "PIC: no handler for the vector " << selected << ". Dropping it..." << std::endl;
+            }
+        }
+    }
 }
@@ -1,29 +1,86 @@
 #ifndef PIC_H
 #define PIC_H
 
-#include <functional>
+#include "mmu.h"
 
 namespace vm
 {
+    // Interrupt controller. Devices and the CPU raise vectors, which stay
+    // pending until the machine delivers them between two instructions.
+    // Masked vectors stay pending until they are unmasked.
     class PIC
     {
     public:
-        typedef std::function<void()> isr_type;
+        typedef void (*handler_type)(void *context);
+
+        typedef unsigned int vector_type;
+        typedef unsigned int mask_type;
+        typedef int priority_type;
+
+        static const vector_type VECTOR_COUNT = 16;
 
         // Hardware Interrupts
 
-        isr_type isr_0; // Timer
-        isr_type isr_1;
-        isr_type isr_2;
+        static const vector_type TIMER_VECTOR = 0;
+        static const vector_type PAGE_FAULT_VECTOR = 1;
+
+        // Software Interrupts, INT n raises SOFTWARE_VECTOR_BASE + n - 1
+
+        static const vector_type SOFTWARE_VECTOR_BASE = 3;
+
+        // Filled in by the CPU before it raises PAGE_FAULT_VECTOR or a
+        // software interrupt
 
-        // Software Interrupts
-        
-        isr_type isr_3;
-        isr_type isr_4;
-        isr_type isr_5;
+        struct FaultInfo
+        {
+            unsigned int ip;                 // the instruction that raised it
+            MMU::vmem_size_type address;     // the virtual address that missed
+            MMU::page_table_size_type page;  // and its page
+            bool write;                      // a store to a shared frame, the page is mapped
+
+            FaultInfo();
+        };
+
+        FaultInfo fault;
 
         PIC();
         virtual ~PIC();
+
+        void SetHandler(vector_type vector, handler_type handler, void *context);
+
+        // Among pending vectors the highest priority is delivered first, the
+        // lowest vector on a tie. All vectors start at priority 0.
+
+        void SetPriority(vector_type vector, priority_type priority);
+
+        void Raise(vector_type vector) { _pending |= 1u << vector; }
+
+        void Mask(vector_type vector) { _masked |= 1u << vector; }
+        void Unmask(vector_type vector) { _masked &= ~(1u << vector); }
+
+        bool IsPending(vector_type vector) const { return (_pending & (1u << vector)) != 0; }
+
+        // The one check on the instruction path
+
+        bool HasPending() const { return (_pending & ~_masked) != 0; }
+
+        // Delivers pending unmasked vectors until none are left, including
+        // any raised by the handlers themselves
+
+        void Dispatch();
+
+    private:
+        struct Vector
+        {
+            handler_type handler;
+            void *context;
+            priority_type priority;
+        };
+
+        Vector _vectors[VECTOR_COUNT];
+
+        mask_type _pending;
+        mask_type _masked;
     };
 }
 
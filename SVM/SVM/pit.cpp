@@ -13,7 +13,7 @@ namespace vm
         ++_passed_cycles_count;
         
         if (_passed_cycles_count >= frequency) {
-            _pic.isr_0(); _passed_cycles_count = 0;
+            _pic.Raise(PIC::TIMER_VECTOR); _passed_cycles_count = 0;
         }
     }
 }
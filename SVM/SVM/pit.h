@@ -19,6 +19,16 @@ namespace vm
 
         void Tick();
 
+        // Ticks left up to and including the next interrupt, counting the
+        // instruction that is about to run after this tick
+
+        frequency_type GetCyclesUntilInterrupt() const { return frequency - _passed_cycles_count; }
+
+        // Accounts for ticks that passed without calling Tick. Never crosses an
+        // interrupt when "cycles" is below GetCyclesUntilInterrupt().
+
+        void Advance(frequency_type cycles) { _passed_cycles_count += cycles; }
+
     private:
         frequency_type _passed_cycles_count;
 
@@ -1,22 +1,132 @@
 #include "process.h"
 
+#include <algorithm>
+#include <utility>
+
 namespace vm
 {
     Process::Process(process_id_type id, MMU::ram_size_type memory_start_position,
-                                         MMU::ram_size_type memory_end_position)
+                                         MMU::ram_size_type memory_end_position, const MMU &mmu)
         : id(id), registers(), state(Ready), priority(0),
           memory_start_position(memory_start_position),
-          memory_end_position(memory_end_position)
+          memory_end_position(memory_end_position),
+          verified(false), huge_mappings(mmu.GetHugePageRegionCount(), 0), mapped_pages(),
+          page_limit(0)
     {
         registers.ip = memory_start_position;
 
         sequential_instruction_count = (memory_end_position - memory_start_position) / 2;
 
-        page_table = MMU::CreateEmptyPageTable();
-		blocklist = MMU::CreateNewVMBlockList();
+        page_table = mmu.CreateEmptyPageTable();
+		blocklist = mmu.CreateNewVMBlockList();
+    }
+
+    Process::Process(const Process &anotherProcess)
+        : id(anotherProcess.id), registers(anotherProcess.registers), state(anotherProcess.state),
+          priority(anotherProcess.priority),
+          memory_start_position(anotherProcess.memory_start_position),
+          memory_end_position(anotherProcess.memory_end_position),
+          sequential_instruction_count(anotherProcess.sequential_instruction_count),
+          verified(anotherProcess.verified),
+          page_table(new MMU::page_table_type(*anotherProcess.page_table)),
+          blocklist(CopyBlockList(anotherProcess.blocklist)),
+          huge_mappings(anotherProcess.huge_mappings),
+          mapped_pages(anotherProcess.mapped_pages),
+          page_limit(anotherProcess.page_limit) {}
+
+    Process::Process(Process &&anotherProcess)
+        : id(anotherProcess.id), registers(anotherProcess.registers), state(anotherProcess.state),
+          priority(anotherProcess.priority),
+          memory_start_position(anotherProcess.memory_start_position),
+          memory_end_position(anotherProcess.memory_end_position),
+          sequential_instruction_count(anotherProcess.sequential_instruction_count),
+          verified(anotherProcess.verified),
+          page_table(anotherProcess.page_table),
+          blocklist(anotherProcess.blocklist),
+          huge_mappings(std::move(anotherProcess.huge_mappings)),
+          mapped_pages(std::move(anotherProcess.mapped_pages)),
+          page_limit(anotherProcess.page_limit)
+    {
+        anotherProcess.page_table = NULL;
+        anotherProcess.blocklist = NULL;
+    }
+
+    Process &Process::operator=(const Process &anotherProcess)
+    {
+        if (this != &anotherProcess) {
+            id = anotherProcess.id;
+            registers = anotherProcess.registers;
+            state = anotherProcess.state;
+            priority = anotherProcess.priority;
+            memory_start_position = anotherProcess.memory_start_position;
+            memory_end_position = anotherProcess.memory_end_position;
+            sequential_instruction_count = anotherProcess.sequential_instruction_count;
+            verified = anotherProcess.verified;
+
+            if (page_table) {
+                *page_table = *anotherProcess.page_table;
+            } else {
+                page_table = new MMU::page_table_type(*anotherProcess.page_table);
+            }
+
+            DeleteBlockList(blocklist);
+            blocklist = CopyBlockList(anotherProcess.blocklist);
+
+            huge_mappings = anotherProcess.huge_mappings;
+            mapped_pages = anotherProcess.mapped_pages;
+            page_limit = anotherProcess.page_limit;
+        }
+
+        return *this;
+    }
+
+    // The tables trade places, the moved from process frees ours
+
+    Process &Process::operator=(Process &&anotherProcess)
+    {
+        if (this != &anotherProcess) {
+            id = anotherProcess.id;
+            registers = anotherProcess.registers;
+            state = anotherProcess.state;
+            priority = anotherProcess.priority;
+            memory_start_position = anotherProcess.memory_start_position;
+            memory_end_position = anotherProcess.memory_end_position;
+            sequential_instruction_count = anotherProcess.sequential_instruction_count;
+            verified = anotherProcess.verified;
+
+            std::swap(page_table, anotherProcess.page_table);
+            std::swap(blocklist, anotherProcess.blocklist);
+
+            huge_mappings.swap(anotherProcess.huge_mappings);
+            mapped_pages.swap(anotherProcess.mapped_pages);
+            page_limit = anotherProcess.page_limit;
+        }
+
+        return *this;
     }
 
     Process::~Process()
+    {
+        DeleteBlockList(blocklist);
+		delete page_table;
+		
+    }
+
+    MMU::header *Process::CopyBlockList(const MMU::header *blocklist)
+    {
+        MMU::header *copy = NULL;
+        MMU::header **tail = &copy;
+
+        for (; blocklist; blocklist = blocklist->next) {
+            *tail = new MMU::header(*blocklist);
+            tail = &(*tail)->next;
+        }
+        *tail = NULL;
+
+        return copy;
+    }
+
+    void Process::DeleteBlockList(MMU::header *blocklist)
     {
         MMU::header *prev;
 
@@ -26,11 +136,39 @@ namespace vm
 			
 			delete prev;
 		}
-		delete page_table;
-		
     }
 
     bool Process::operator<(const Process &anotherProcess) const {
         return priority < anotherProcess.priority;
     }
+
+    // The list is pruned once it outgrows the page table, so mapping and
+    // unmapping the same pages over and over keeps it bounded
+
+    void Process::MapPage(MMU::page_table_size_type page, MMU::page_entry_type frame)
+    {
+        if ((*page_table)[page] == MMU::INVALID_PAGE && frame != MMU::INVALID_PAGE) {
+            if (mapped_pages.size() >= page_table->size()) {
+                PruneMappedPages();
+            }
+
+            mapped_pages.push_back(page);
+        }
+
+        (*page_table)[page] = frame;
+    }
+
+    void Process::PruneMappedPages()
+    {
+        std::sort(mapped_pages.begin(), mapped_pages.end());
+        mapped_pages.erase(std::unique(mapped_pages.begin(), mapped_pages.end()), mapped_pages.end());
+
+        std::vector<MMU::page_table_size_type>::iterator end = mapped_pages.begin();
+        for (std::vector<MMU::page_table_size_type>::const_iterator it = mapped_pages.begin(); it != mapped_pages.end(); ++it) {
+            if ((*page_table)[*it] != MMU::INVALID_PAGE) {
+                *end++ = *it;
+            }
+        }
+        mapped_pages.erase(end, mapped_pages.end());
+    }
 }
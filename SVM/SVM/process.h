@@ -30,16 +30,60 @@ namespace vm
 
         MMU::ram_size_type sequential_instruction_count;
 
+        bool verified;
+
         MMU::page_table_type *page_table;
 
 		MMU::header *blocklist;
 
+        // See MMU::huge_mappings
+
+        std::vector<unsigned char> huge_mappings;
+
+        // Every page mapped since the process started, in no order. Pages
+        // unmapped since, or mapped again, stay until the list is pruned.
+        // Exit and fork go over these instead of the whole page table.
+
+        std::vector<MMU::page_table_size_type> mapped_pages;
+
+        // Pages the process may map before the kernel ends it, 0 for no
+        // limit. Forked children inherit it.
+
+        MMU::page_table_size_type page_limit;
+
+        // The page table and block list are sized for the MMU's page size
+
         Process(process_id_type id, MMU::ram_size_type memory_start_position,
-                                    MMU::ram_size_type memory_end_position);
+                                    MMU::ram_size_type memory_end_position, const MMU &mmu);
+
+        // Copies own their page table and block list. The kernel keeps
+        // processes by value, so erasing one shifts the others by copying.
+
+        Process(const Process &anotherProcess);
+        Process &operator=(const Process &anotherProcess);
+
+        // Moves take the tables over, so erasing a process from the middle of
+        // the kernel's list copies none
+
+        Process(Process &&anotherProcess);
+        Process &operator=(Process &&anotherProcess);
 
         virtual ~Process();
 
         bool operator<(const Process &anotherProcess) const;
+
+        // Maps a page that may have been unmapped, remapping a mapped one
+        // goes straight to the page table
+
+        void MapPage(MMU::page_table_size_type page, MMU::page_entry_type frame);
+
+        // Leaves mapped_pages with each mapped page once, sorted
+
+        void PruneMappedPages();
+
+    private:
+        static MMU::header *CopyBlockList(const MMU::header *blocklist);
+        static void DeleteBlockList(MMU::header *blocklist);
     };
 }
 
@@ -0,0 +1,197 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace vm
+{
+    namespace
+    {
+        typedef std::pair<Profiler::count_type, std::string> ranked_entry_type;
+
+        bool MoreSamples(const ranked_entry_type &left, const ranked_entry_type &right)
+        {
+            return left.first > right.first;
+        }
+
+        // Folded stacks use ';' between frames and ' ' before the count
+
+        std::string SanitizeFrame(const std::string &frame)
+        {
+            std::string result(frame);
+            std::replace(result.begin(), result.end(), ';', ',');
+            std::replace(result.begin(), result.end(), '\t', ' ');
+
+            return result;
+        }
+    }
+
+    Profiler::SourceMap::SourceMap()
+        : source_path(), lines(), text(), loaded(false) {}
+
+    Profiler::ProcessProfile::ProcessProfile()
+        : image_path(), image_start(0), ip_samples(),
+          page_accesses(MMU::RAM_SIZE / MMU::MIN_PAGE_SIZE, 0) {}
+
+    Profiler::Profiler(interval_type interval)
+        : interval(interval > 0 ? interval : DEFAULT_INTERVAL),
+          _profiles(), _current(NULL), _page_size(MMU::DEFAULT_PAGE_SIZE),
+          _ticks_until_sample(this->interval), _total_samples(0),
+          _source_maps() {}
+
+    Profiler::~Profiler() {}
+
+    void Profiler::RegisterProcess(process_id_type id, const std::string &image_path, MMU::ram_size_type image_start)
+    {
+        ProcessProfile &profile = _profiles[id];
+        profile.image_path = image_path;
+        profile.image_start = image_start;
+    }
+
+    void Profiler::RegisterForkedProcess(process_id_type id, process_id_type parent_id)
+    {
+        profiles_type::const_iterator parent = _profiles.find(parent_id);
+        if (parent != _profiles.end()) {
+            RegisterProcess(id, parent->second.image_path, parent->second.image_start);
+        }
+    }
+
+    void Profiler::MoveImage(process_id_type id, MMU::ram_size_type image_start)
+    {
+        profiles_type::iterator it = _profiles.find(id);
+        if (it != _profiles.end()) {
+            it->second.image_start = image_start;
+        }
+    }
+
+    void Profiler::SetCurrentProcess(process_id_type id)
+    {
+        profiles_type::iterator it = _profiles.find(id);
+        _current = it == _profiles.end() ? NULL : &it->second;
+    }
+
+    void Profiler::Tick(MMU::ram_size_type ip)
+    {
+        if (--_ticks_until_sample > 0) {
+            return;
+        }
+        _ticks_until_sample = interval;
+
+        if (_current && ip >= _current->image_start) {
+            ++_current->ip_samples[ip - _current->image_start];
+            ++_total_samples;
+        }
+    }
+
+    void Profiler::WriteReport(std::ostream &output) const
+    {
+        output << "Profiler: " << _total_samples << " samples, one every " << interval << " ticks." << std::endl;
+
+        std::vector<ranked_entry_type> lines;
+        for (profiles_type::const_iterator process = _profiles.begin(); process != _profiles.end(); ++process) {
+            for (std::map<MMU::ram_size_type, count_type>::const_iterator sample = process->second.ip_samples.begin();
+                 sample != process->second.ip_samples.end(); ++sample) {
+                std::ostringstream description;
+                description << "process " << process->first << "  "
+                            << DescribeLocation(process->second, sample->first, false);
+
+                lines.push_back(std::make_pair(sample->second, description.str()));
+            }
+        }
+        std::sort(lines.begin(), lines.end(), MoreSamples);
+
+        output << std::endl << "Hot instructions:" << std::endl;
+        for (std::vector<ranked_entry_type>::size_type i = 0; i < lines.size() && i < REPORT_TOP_ENTRIES; ++i) {
+            output << std::setw(10) << lines[i].first << " "
+                   << std::setw(6) << std::fixed << std::setprecision(2)
+                   << (100.0 * lines[i].first / _total_samples) << "%  "
+                   << lines[i].second << std::endl;
+        }
+
+        std::vector<ranked_entry_type> pages;
+        for (profiles_type::const_iterator process = _profiles.begin(); process != _profiles.end(); ++process) {
+            const std::vector<count_type> &accesses = process->second.page_accesses;
+            for (std::vector<count_type>::size_type page = 0; page < accesses.size(); ++page) {
+                if (accesses[page] > 0) {
+                    std::ostringstream description;
+                    description << "process " << process->first << "  page " << page
+                                << " [" << page * _page_size << ", " << (page + 1) * _page_size << ")";
+
+                    pages.push_back(std::make_pair(accesses[page], description.str()));
+                }
+            }
+        }
+        std::sort(pages.begin(), pages.end(), MoreSamples);
+
+        output << std::endl << "Hot pages (loads and stores):" << std::endl;
+        for (std::vector<ranked_entry_type>::size_type i = 0; i < pages.size() && i < REPORT_TOP_ENTRIES; ++i) {
+            output << std::setw(10) << pages[i].first << "  " << pages[i].second << std::endl;
+        }
+
+        output << std::endl;
+    }
+
+    void Profiler::WriteFoldedStacks(std::ostream &output) const
+    {
+        for (profiles_type::const_iterator process = _profiles.begin(); process != _profiles.end(); ++process) {
+            for (std::map<MMU::ram_size_type, count_type>::const_iterator sample = process->second.ip_samples.begin();
+                 sample != process->second.ip_samples.end(); ++sample) {
+                output << SanitizeFrame(process->second.image_path) << ";"
+                       << SanitizeFrame(DescribeLocation(process->second, sample->first, true)) << " "
+                       << sample->second << "\n";
+            }
+        }
+    }
+
+    const Profiler::SourceMap &Profiler::GetSourceMap(const std::string &image_path) const
+    {
+        SourceMap &source_map = _source_maps[image_path];
+        if (source_map.loaded) {
+            return source_map;
+        }
+        source_map.loaded = true;
+
+        std::ifstream map_stream((image_path + ".map").c_str());
+        if (!map_stream) {
+            return source_map;
+        }
+
+        std::string keyword;
+        if (map_stream >> keyword && keyword == "source") {
+            std::getline(map_stream >> std::ws, source_map.source_path);
+        }
+
+        MMU::ram_size_type offset; unsigned int line;
+        while (map_stream >> offset >> line) {
+            source_map.lines[offset] = line;
+        }
+
+        std::ifstream source_stream(source_map.source_path.c_str());
+        for (std::string text; std::getline(source_stream, text);) {
+            source_map.text.push_back(text);
+        }
+
+        return source_map;
+    }
+
+    std::string Profiler::DescribeLocation(const ProcessProfile &profile, MMU::ram_size_type offset, bool folded) const
+    {
+        const SourceMap &source_map = GetSourceMap(profile.image_path);
+
+        std::ostringstream description;
+
+        std::map<MMU::ram_size_type, unsigned int>::const_iterator line = source_map.lines.find(offset);
+        if (line == source_map.lines.end()) {
+            description << (folded ? "" : profile.image_path + " ") << "+" << offset;
+        } else {
+            description << source_map.source_path << ":" << line->second;
+            if (line->second > 0 && line->second <= source_map.text.size()) {
+                description << (folded ? " " : "  ") << source_map.text[line->second - 1];
+            }
+        }
+
+        return description.str();
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "mmu.h"
+
+namespace vm
+{
+    // Samples the guest instruction pointer on timer ticks and counts the virtual
+    // pages touched by loads and stores. Samples are mapped back to source lines
+    // through the "<image>.map" files written by "vmasm /debug".
+    class Profiler
+    {
+    public:
+        typedef unsigned int process_id_type;
+        typedef unsigned int interval_type;
+        typedef unsigned long long count_type;
+
+        static const interval_type DEFAULT_INTERVAL = 1;
+        static const unsigned int REPORT_TOP_ENTRIES = 20;
+
+        interval_type interval;
+
+        Profiler(interval_type interval = DEFAULT_INTERVAL);
+        virtual ~Profiler();
+
+        void RegisterProcess(process_id_type id, const std::string &image_path, MMU::ram_size_type image_start);
+
+        // A forked child runs the image of its parent and is reported under it
+
+        void RegisterForkedProcess(process_id_type id, process_id_type parent_id);
+
+        // The image was relocated, samples stay relative to its start
+
+        void MoveImage(process_id_type id, MMU::ram_size_type image_start);
+        void SetCurrentProcess(process_id_type id);
+
+        // Only used to report page ranges, pages are counted by index
+
+        void SetPageSize(MMU::ram_size_type page_size) { _page_size = page_size; }
+
+        void Tick(MMU::ram_size_type ip);
+
+        void RecordPageAccess(MMU::page_table_size_type page)
+        {
+            if (_current && page < _current->page_accesses.size()) {
+                ++_current->page_accesses[page];
+            }
+        }
+
+        void WriteReport(std::ostream &output) const;
+        void WriteFoldedStacks(std::ostream &output) const;
+
+    private:
+        struct SourceMap
+        {
+            std::string source_path;
+            std::map<MMU::ram_size_type, unsigned int> lines;
+            std::vector<std::string> text;
+
+            bool loaded;
+
+            SourceMap();
+        };
+
+        struct ProcessProfile
+        {
+            std::string image_path;
+            MMU::ram_size_type image_start;
+
+            std::map<MMU::ram_size_type, count_type> ip_samples;
+            std::vector<count_type> page_accesses;
+
+            ProcessProfile();
+        };
+
+        typedef std::map<process_id_type, ProcessProfile> profiles_type;
+
+        profiles_type _profiles;
+        ProcessProfile *_current;
+
+        MMU::ram_size_type _page_size;
+
+        interval_type _ticks_until_sample;
+        count_type _total_samples;
+
+        mutable std::map<std::string, SourceMap> _source_maps;
+
+        const SourceMap &GetSourceMap(const std::string &image_path) const;
+        std::string DescribeLocation(const ProcessProfile &profile, MMU::ram_size_type offset, bool folded) const;
+    };
+}
+
+#endif
@@ -0,0 +1,196 @@
+#include "rings.h"
+#include "kernel.h"
+
+#include <iostream>
+
+namespace vm
+{
+    IORingTable::Ring::Ring()
+        : address(0), entries(0), in_flight(0), waiting(false) {}
+
+    IORingTable::IORingTable(IOService &io)
+        : _io(io), _rings() {}
+
+    IORingTable::~IORingTable() {}
+
+    bool IORingTable::HasRing(Process::process_id_type owner) const
+    {
+        return _rings.count(owner) != 0;
+    }
+
+    unsigned int IORingTable::GetInFlightCount(Process::process_id_type owner) const
+    {
+        ring_map_type::const_iterator ring = _rings.find(owner);
+
+        return ring != _rings.end() ? ring->second.in_flight : 0;
+    }
+
+    bool IORingTable::Setup(Kernel &kernel, Process &process, MMU::vmem_size_type address, unsigned int entries)
+    {
+        for (int i = 0; i < HEADER_SIZE; ++i) {
+            if (!kernel.WriteGuestWord(process, address + i, 0)) {
+                return false;
+            }
+        }
+
+        Ring ring;
+        ring.address = address;
+        ring.entries = entries;
+
+        _rings[process.id] = ring;
+
+        return true;
+    }
+
+    int IORingTable::Submit(Kernel &kernel, Process &process)
+    {
+        ring_map_type::iterator ring = _rings.find(process.id);
+        if (ring == _rings.end()) {
+            return 0;
+        }
+
+        MMU::vmem_size_type address = ring->second.address;
+        unsigned int entries = ring->second.entries;
+
+        int submission_head = 0, submission_tail = 0, completion_head = 0, completion_tail = 0;
+        kernel.ReadGuestWord(process, address, submission_head);
+        kernel.ReadGuestWord(process, address + 1, submission_tail);
+        kernel.ReadGuestWord(process, address + 2, completion_head);
+        kernel.ReadGuestWord(process, address + 3, completion_tail);
+
+        MMU::vmem_size_type address_space_size = process.page_table->size() * kernel.machine.mmu.GetPageSize();
+
+        int submitted = 0;
+        while (submission_head != submission_tail &&
+               ring->second.in_flight + static_cast<unsigned int>(completion_tail - completion_head) < entries) {
+            MMU::vmem_size_type entry = address + HEADER_SIZE +
+                                        static_cast<unsigned int>(submission_head) % entries * SUBMISSION_SIZE;
+
+            int fields[SUBMISSION_SIZE];
+            for (int i = 0; i < SUBMISSION_SIZE; ++i) {
+                fields[i] = 0;
+                kernel.ReadGuestWord(process, entry + i, fields[i]);
+            }
+
+            IOService::Request request;
+            request.owner = process.id;
+            request.operation = static_cast<IOService::Operation>(fields[0]);
+            request.file = static_cast<unsigned int>(fields[1]);
+            request.offset = fields[2];
+            request.address = static_cast<MMU::vmem_size_type>(fields[3]);
+            request.tag = fields[5];
+
+            int count = fields[4];
+
+            ++submission_head;
+
+            if ((request.operation != IOService::Read && request.operation != IOService::Write) ||
+                request.file >= _io.GetFileCount() || fields[3] < 0 || count < 0 ||
+                request.address + count > address_space_size) {
+                Complete(kernel, process, ring->second, request);
+                kernel.ReadGuestWord(process, address + 3, completion_tail);
+
+                continue;
+            }
+
+            request.data.resize(count);
+            if (request.operation == IOService::Write) {
+                for (int i = 0; i < count; ++i) {
+                    kernel.ReadGuestWord(process, request.address + i, request.data[i]);
+                }
+            }
+
+            _io.Submit(request);
+
+            ++ring->second.in_flight;
+            ++submitted;
+        }
+
+        kernel.WriteGuestWord(process, address, submission_head);
+
+        return submitted;
+    }
+
+    int IORingTable::Wait(Kernel &kernel, Process &process, bool &block)
+    {
+        block = false;
+
+        if (_io.HasCompletions()) {
+            DeliverCompletions(kernel);
+        }
+
+        ring_map_type::iterator ring = _rings.find(process.id);
+        if (ring == _rings.end()) {
+            return 0;
+        }
+
+        int completion_head = 0, completion_tail = 0;
+        kernel.ReadGuestWord(process, ring->second.address + 2, completion_head);
+        kernel.ReadGuestWord(process, ring->second.address + 3, completion_tail);
+
+        int ready = completion_tail - completion_head;
+
+        if (ready <= 0 && ring->second.in_flight > 0) {
+            ring->second.waiting = true;
+
+            block = true;
+        }
+
+        return ready;
+    }
+
+    void IORingTable::DeliverCompletions(Kernel &kernel)
+    {
+        IOService::Request request;
+        while (_io.PollCompletion(request)) {
+            ring_map_type::iterator ring = _rings.find(request.owner);
+            Process *process = kernel.FindProcess(request.owner);
+
+            if (ring != _rings.end() && process) {
+                --ring->second.in_flight;
+
+                Complete(kernel, *process, ring->second, request);
+            }
+        }
+    }
+
+    void IORingTable::Remove(Process::process_id_type owner)
+    {
+        _rings.erase(owner);
+    }
+
+    void IORingTable::Complete(Kernel &kernel, Process &process, Ring &ring, const IOService::Request &request)
+    {
+        int result = request.result;
+
+        if (request.operation == IOService::Read && result > 0) {
+            for (int i = 0; i < result; ++i) {
+                if (!kernel.WriteGuestWord(process, request.address + i, request.data[i])) {
+                    result = -1;
+
+                    break;
+                }
+            }
+        }
+
+        int completion_head = 0, completion_tail = 0;
+        kernel.ReadGuestWord(process, ring.address + 2, completion_head);
+        kernel.ReadGuestWord(process, ring.address + 3, completion_tail);
+
+        MMU::vmem_size_type entry = ring.address + HEADER_SIZE + ring.entries * SUBMISSION_SIZE +
+                                    static_cast<unsigned int>(completion_tail) % ring.entries * COMPLETION_SIZE;
+
+        kernel.WriteGuestWord(process, entry, request.tag);
+        kernel.WriteGuestWord(process, entry + 1, result);
+        kernel.WriteGuestWord(process, ring.address + 3, ++completion_tail);
+
+        if (ring.waiting) {
+            std::cout << "Kernel: waking up the process " << process.id << std::endl;
+
+            ring.waiting = false;
+
+            process.registers.a = completion_tail - completion_head;
+            process.state = Process::Ready;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef RINGS_H
+#define RINGS_H
+
+#include <map>
+
+#include "io.h"
+#include "process.h"
+
+namespace vm
+{
+    class Kernel;
+
+    // Guest side of I/O, a ring of submissions and completions in the memory
+    // of each process that set one up. Requests run on the kernel's
+    // IOService, completions are written back as they are delivered. The
+    // rings are reached through the kernel, which may have to map their
+    // pages or copy shared ones.
+    class IORingTable
+    {
+    public:
+        // Ring layout in words: submission head and tail, completion head and
+        // tail, then the submissions and the completions. Heads and tails only
+        // grow, an entry sits at its counter modulo the entry count. A
+        // submission is operation (1 read, 2 write), file, file offset in
+        // words, buffer address, word count and tag. A completion is the tag
+        // and the words transferred, -1 on error.
+
+        static const int HEADER_SIZE = 4;
+        static const int SUBMISSION_SIZE = 6;
+        static const int COMPLETION_SIZE = 2;
+
+        static const int MAX_ENTRIES = 256;
+
+        explicit IORingTable(IOService &io);
+        virtual ~IORingTable();
+
+        bool IsEmpty() const { return _rings.empty(); }
+        bool HasRing(Process::process_id_type owner) const;
+
+        unsigned int GetInFlightCount(Process::process_id_type owner) const;
+
+        // Clears the ring's header. False when its pages could not be
+        // mapped, the process keeps the ring it had then.
+
+        bool Setup(Kernel &kernel, Process &process, MMU::vmem_size_type address, unsigned int entries);
+
+        // Takes submissions for as long as there are completion slots to
+        // answer them in, the rest stay queued. Requests in flight never
+        // exceed the free completion slots, so the completion ring can not
+        // overflow. Returns how many went to the I/O service, requests that
+        // could never succeed complete straight away.
+
+        int Submit(Kernel &kernel, Process &process);
+
+        // Returns how many completions are ready. With none ready and some in
+        // flight "block" is set, and the next completion wakes the process.
+
+        int Wait(Kernel &kernel, Process &process, bool &block);
+
+        // Completions of processes that have exited since are dropped
+
+        void DeliverCompletions(Kernel &kernel);
+
+        void Remove(Process::process_id_type owner);
+
+    private:
+        struct Ring
+        {
+            MMU::vmem_size_type address;
+            unsigned int entries;
+
+            unsigned int in_flight;
+            bool waiting;
+
+            Ring();
+        };
+
+        typedef std::map<Process::process_id_type, Ring> ring_map_type;
+
+        IOService &_io;
+        ring_map_type _rings;
+
+        IORingTable(const IORingTable &);
+        IORingTable &operator=(const IORingTable &);
+
+        void Complete(Kernel &kernel, Process &process, Ring &ring, const IOService::Request &request);
+    };
+}
+
+#endif
@@ -0,0 +1,82 @@
+#include "segments.h"
+
+#include <algorithm>
+
+namespace vm
+{
+    SegmentTable::Segment::Segment()
+        : frames(), notifications(0), waiters() {}
+
+    SegmentTable::SegmentTable(MMU &mmu)
+        : _mmu(mmu), _segments() {}
+
+    SegmentTable::~SegmentTable() {}
+
+    const SegmentTable::frame_list_type *SegmentTable::Find(int key) const
+    {
+        segment_map_type::const_iterator segment = _segments.find(key);
+
+        return segment != _segments.end() ? &segment->second.frames : NULL;
+    }
+
+    bool SegmentTable::Create(int key, MMU::page_table_size_type pages)
+    {
+        Segment segment;
+        for (MMU::page_table_size_type i = 0; i < pages; ++i) {
+            MMU::page_entry_type frame = _mmu.AcquireFrame();
+            if (frame == MMU::INVALID_PAGE) {
+                std::for_each(segment.frames.begin(), segment.frames.end(), [&](MMU::page_entry_type acquired) {
+                    _mmu.ReleaseFrame(acquired);
+                });
+
+                return false;
+            }
+
+            _mmu.segment_frames[frame >> _mmu.GetPageShift()] = 1;
+
+            segment.frames.push_back(frame);
+        }
+
+        _segments[key] = segment;
+
+        return true;
+    }
+
+    bool SegmentTable::Wait(int key, Process::process_id_type waiter)
+    {
+        Segment &segment = _segments[key];
+
+        if (segment.notifications > 0) {
+            --segment.notifications;
+
+            return true;
+        }
+
+        segment.waiters.push_back(waiter);
+
+        return false;
+    }
+
+    bool SegmentTable::Notify(int key, Process::process_id_type &waiter)
+    {
+        Segment &segment = _segments[key];
+
+        if (segment.waiters.empty()) {
+            ++segment.notifications;
+
+            return false;
+        }
+
+        waiter = segment.waiters.front();
+        segment.waiters.pop_front();
+
+        return true;
+    }
+
+    void SegmentTable::MoveFrame(MMU::page_entry_type from, MMU::page_entry_type to)
+    {
+        for (segment_map_type::iterator it = _segments.begin(); it != _segments.end(); ++it) {
+            std::replace(it->second.frames.begin(), it->second.frames.end(), from, to);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "mmu.h"
+#include "process.h"
+
+namespace vm
+{
+    // Shared memory segments by key. The table keeps a reference to every
+    // frame of a segment, so segments stay until the kernel goes away and a
+    // consumer can attach after the producer has exited. Notifications are
+    // counted, so one posted before the wait is not lost.
+    class SegmentTable
+    {
+    public:
+        typedef std::vector<MMU::page_entry_type> frame_list_type;
+
+        explicit SegmentTable(MMU &mmu);
+        virtual ~SegmentTable();
+
+        // NULL when no segment has the key
+
+        const frame_list_type *Find(int key) const;
+
+        // False when the frames ran out, nothing is kept then
+
+        bool Create(int key, MMU::page_table_size_type pages);
+
+        // Takes a posted notification and returns true, or queues the
+        // process until one is posted. The key must name a segment.
+
+        bool Wait(int key, Process::process_id_type waiter);
+
+        // Takes the longest waiting process off the queue and returns true,
+        // or posts the notification for the next wait
+
+        bool Notify(int key, Process::process_id_type &waiter);
+
+        // For the compactor, every segment holding the frame follows it
+
+        void MoveFrame(MMU::page_entry_type from, MMU::page_entry_type to);
+
+    private:
+        struct Segment
+        {
+            frame_list_type frames;
+
+            unsigned int notifications;
+            std::deque<Process::process_id_type> waiters;
+
+            Segment();
+        };
+
+        typedef std::map<int, Segment> segment_map_type;
+
+        MMU &_mmu;
+        segment_map_type _segments;
+
+        SegmentTable(const SegmentTable &);
+        SegmentTable &operator=(const SegmentTable &);
+    };
+}
+
+#endif
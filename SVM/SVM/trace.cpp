@@ -0,0 +1,165 @@
+#include "trace.h"
+
+#include <iostream>
+
+namespace vm
+{
+    namespace
+    {
+        const unsigned int MACHINE_PID = 1;
+
+        void WriteEscaped(std::ostream &output, const std::string &text)
+        {
+            output << '"';
+            for (std::string::const_iterator it = text.begin(); it != text.end(); ++it) {
+                switch (*it) {
+                case '"':  output << "\\\""; break;
+                case '\\': output << "\\\\"; break;
+                case '\n': output << "\\n";  break;
+                case '\t': output << "\\t";  break;
+                default:
+                    if (static_cast<unsigned char>(*it) >= 0x20) {
+                        output << *it;
+                    }
+
+                    break;
+                }
+            }
+            output << '"';
+        }
+    }
+
+    Tracer::Tracer(const std::string &path)
+        : _buffer(_BUFFER_SIZE), _output(), _first_event(true),
+          _slice_open(false), _current_track(KERNEL_TRACK)
+    {
+        _output.rdbuf()->pubsetbuf(&_buffer[0], _buffer.size());
+        _output.open(path.c_str(), std::ios::out | std::ios::trunc);
+
+        if (!_output) {
+            std::cerr << "Tracer: failed to open the trace file." << std::endl;
+        } else {
+            _output << "{\"traceEvents\":[\n";
+
+            NameTrack(KERNEL_TRACK, "kernel");
+        }
+    }
+
+    Tracer::~Tracer()
+    {
+        if (_output) {
+            _output << "\n]}\n";
+            _output.flush();
+        }
+    }
+
+    bool Tracer::IsOpen() const
+    {
+        return _output.is_open() && _output.good();
+    }
+
+    void Tracer::NameTrack(track_id_type track, const std::string &name)
+    {
+        if (!IsOpen()) {
+            return;
+        }
+
+        BeginEvent("M", 0, track) << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+        WriteEscaped(_output, name);
+        _output << '}';
+        EndEvent();
+    }
+
+    void Tracer::BeginSlice(timestamp_type timestamp, track_id_type track, const std::string &name)
+    {
+        if (!IsOpen()) {
+            return;
+        }
+
+        if (_slice_open) {
+            EndSlice(timestamp);
+        }
+
+        BeginEvent("B", timestamp, track) << ",\"name\":";
+        WriteEscaped(_output, name);
+        EndEvent();
+
+        _slice_open = true;
+        _current_track = track;
+    }
+
+    void Tracer::EndSlice(timestamp_type timestamp)
+    {
+        if (!IsOpen() || !_slice_open) {
+            return;
+        }
+
+        BeginEvent("E", timestamp, _current_track);
+        EndEvent();
+
+        _slice_open = false;
+    }
+
+    void Tracer::ContextSwitch(timestamp_type timestamp, track_id_type from, track_id_type to)
+    {
+        if (!IsOpen()) {
+            return;
+        }
+
+        BeginEvent("i", timestamp, KERNEL_TRACK) << ",\"s\":\"p\",\"name\":\"context switch\""
+                                                 << ",\"args\":{\"from\":" << from << ",\"to\":" << to << '}';
+        EndEvent();
+    }
+
+    void Tracer::ProcessExit(timestamp_type timestamp, track_id_type track)
+    {
+        if (!IsOpen()) {
+            return;
+        }
+
+        BeginEvent("i", timestamp, track) << ",\"s\":\"t\",\"name\":\"exit\"";
+        EndEvent();
+    }
+
+    void Tracer::PageFault(timestamp_type timestamp, unsigned int page, unsigned int address, unsigned int ip)
+    {
+        if (!IsOpen()) {
+            return;
+        }
+
+        BeginEvent("i", timestamp, _current_track) << ",\"s\":\"t\",\"name\":\"page fault\""
+                                                   << ",\"args\":{\"page\":" << page << ",\"address\":" << address
+                                                   << ",\"ip\":" << ip << '}';
+        EndEvent();
+    }
+
+    void Tracer::MemoryCounter(timestamp_type timestamp, unsigned int used_frames, unsigned int free_frames)
+    {
+        if (!IsOpen()) {
+            return;
+        }
+
+        BeginEvent("C", timestamp, KERNEL_TRACK) << ",\"name\":\"memory\""
+                                                 << ",\"args\":{\"used frames\":" << used_frames
+                                                 << ",\"free frames\":" << free_frames << '}';
+        EndEvent();
+    }
+
+    std::ostream &Tracer::BeginEvent(const char *phase, timestamp_type timestamp, track_id_type track)
+    {
+        if (!_first_event) {
+            _output << ",\n";
+        }
+        _first_event = false;
+
+        _output << "{\"ph\":\"" << phase << "\",\"ts\":" << timestamp
+                << ",\"pid\":" << MACHINE_PID << ",\"tid\":" << track;
+
+        return _output;
+    }
+
+    void Tracer::EndEvent()
+    {
+        _output << '}';
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace vm
+{
+    // Streams a Chrome trace-event JSON timeline (chrome://tracing, ui.perfetto.dev).
+    // Events are written as they happen, so the trace never has to fit in memory.
+    // Timestamps are machine cycles and show up as microseconds in the viewer.
+    class Tracer
+    {
+    public:
+        typedef unsigned long long timestamp_type;
+        typedef unsigned int track_id_type;
+
+        static const track_id_type KERNEL_TRACK = 0;
+
+        Tracer(const std::string &path);
+        virtual ~Tracer();
+
+        bool IsOpen() const;
+
+        void NameTrack(track_id_type track, const std::string &name);
+
+        void BeginSlice(timestamp_type timestamp, track_id_type track, const std::string &name);
+        void EndSlice(timestamp_type timestamp);
+
+        void ContextSwitch(timestamp_type timestamp, track_id_type from, track_id_type to);
+        void ProcessExit(timestamp_type timestamp, track_id_type track);
+
+        void PageFault(timestamp_type timestamp, unsigned int page, unsigned int address, unsigned int ip);
+        void MemoryCounter(timestamp_type timestamp, unsigned int used_frames, unsigned int free_frames);
+
+    private:
+        static const std::vector<char>::size_type _BUFFER_SIZE = 1 << 16;
+
+        std::vector<char> _buffer;
+        std::ofstream _output;
+
+        bool _first_event;
+
+        bool _slice_open;
+        track_id_type _current_track;
+
+        std::ostream &BeginEvent(const char *phase, timestamp_type timestamp, track_id_type track);
+        void EndEvent();
+    };
+}
+
+#endif
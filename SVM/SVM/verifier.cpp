@@ -0,0 +1,132 @@
+#include "verifier.h"
+#include "cpu.h"
+
+#include <sstream>
+
+namespace vm
+{
+    namespace
+    {
+        void AddError(Verifier::error_list_type &errors, MMU::ram_size_type offset, const std::string &message)
+        {
+            std::ostringstream error;
+            error << "+" << offset << ": " << message;
+
+            errors.push_back(error.str());
+        }
+
+        bool IsFused(int instruction)
+        {
+            return (instruction >= CPU::MOVA_STA_FUSED_OPCODE && instruction <= CPU::MOVC_STC_FUSED_OPCODE) ||
+                   (instruction >= CPU::LDA_STA_FUSED_OPCODE  && instruction <= CPU::LDC_STC_FUSED_OPCODE)  ||
+                   (instruction >= CPU::LDA_LDA_FUSED_OPCODE  && instruction <= CPU::LDC_LDC_FUSED_OPCODE);
+        }
+
+        // The second instruction of a pair stays in the image and is verified on its own
+
+        int SecondOpcodeOfFused(int instruction)
+        {
+            if (instruction >= CPU::MOVA_STA_FUSED_OPCODE && instruction <= CPU::MOVC_STC_FUSED_OPCODE) {
+                return CPU::STA_BASE_OPCODE + (instruction - CPU::MOVA_STA_FUSED_OPCODE);
+            } else if (instruction >= CPU::LDA_STA_FUSED_OPCODE && instruction <= CPU::LDC_STC_FUSED_OPCODE) {
+                return CPU::STA_BASE_OPCODE + (instruction - CPU::LDA_STA_FUSED_OPCODE);
+            } else {
+                return CPU::LDA_BASE_OPCODE + (instruction - CPU::LDA_LDA_FUSED_OPCODE) % 3;
+            }
+        }
+    }
+
+    bool Verifier::Verify(const MMU::ram_type &image, MMU::vmem_size_type address_space_size, error_list_type &errors)
+    {
+        const MMU::ram_size_type size = image.size();
+
+        error_list_type::size_type initial_error_count = errors.size();
+
+        if (size == 0 || size % 2 != 0) {
+            AddError(errors, size, "the image is not a whole number of instructions");
+
+            return false;
+        }
+
+        for (MMU::ram_size_type offset = 0; offset < size; offset += 2) {
+            int instruction = image[offset];
+            int data = image[offset + 1];
+
+            switch (instruction) {
+            case CPU::MOVA_BASE_OPCODE:
+            case CPU::MOVB_BASE_OPCODE:
+            case CPU::MOVC_BASE_OPCODE:
+                break;
+
+            case CPU::LDA_BASE_OPCODE:
+            case CPU::LDB_BASE_OPCODE:
+            case CPU::LDC_BASE_OPCODE:
+            case CPU::STA_BASE_OPCODE:
+            case CPU::STB_BASE_OPCODE:
+            case CPU::STC_BASE_OPCODE:
+                if (data < 0 || static_cast<MMU::vmem_size_type>(data) >= address_space_size) {
+                    AddError(errors, offset, "the virtual address is outside of the address space");
+                }
+
+                break;
+
+            case CPU::JMP_BASE_OPCODE:
+                {
+                    long long target = static_cast<long long>(offset) + data;
+                    if (target < 0 || target >= static_cast<long long>(size)) {
+                        AddError(errors, offset, "the jump target is outside of the image");
+                    } else if (target % 2 != 0) {
+                        AddError(errors, offset, "the jump target is not on an instruction boundary");
+                    }
+                }
+
+                break;
+
+            case CPU::COPY_OPCODE:
+            case CPU::FILL_OPCODE:
+            case CPU::COMPARE_OPCODE:
+                if (data != 0) {
+                    AddError(errors, offset, "the operand of a bulk instruction is not zero");
+                }
+
+                break;
+
+            case CPU::INT_BASE_OPCODE:
+                if (data < MIN_INTERRUPT_NUMBER || data > MAX_INTERRUPT_NUMBER) {
+                    AddError(errors, offset, "the interrupt number is invalid");
+                }
+
+                break;
+
+            default:
+                if (IsFused(instruction)) {
+                    bool loads_first = instruction < CPU::MOVA_STA_FUSED_OPCODE || instruction > CPU::MOVC_STC_FUSED_OPCODE;
+                    if (loads_first && (data < 0 || static_cast<MMU::vmem_size_type>(data) >= address_space_size)) {
+                        AddError(errors, offset, "the virtual address is outside of the address space");
+                    }
+
+                    if (offset + 2 >= size || image[offset + 2] != SecondOpcodeOfFused(instruction)) {
+                        AddError(errors, offset, "the superinstruction is not followed by its second instruction");
+                    }
+
+                    break;
+                }
+
+                AddError(errors, offset, "the opcode is invalid");
+
+                break;
+            }
+        }
+
+        // A fork or any other call returns past the last instruction
+
+        int last_instruction = image[size - 2];
+        int last_data = image[size - 1];
+        if (last_instruction != CPU::JMP_BASE_OPCODE &&
+            (last_instruction != CPU::INT_BASE_OPCODE || last_data < MIN_INTERRUPT_NUMBER || last_data > MAX_EXIT_INTERRUPT_NUMBER)) {
+            AddError(errors, size - 2, "execution can fall off the end of the image");
+        }
+
+        return errors.size() == initial_error_count;
+    }
+}
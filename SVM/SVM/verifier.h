@@ -0,0 +1,34 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <string>
+#include <vector>
+
+#include "mmu.h"
+
+namespace vm
+{
+    // Load-time bytecode verification. An image passes when every instruction
+    // slot holds a known opcode with an in-range operand, every jump lands on an
+    // instruction boundary inside the image, every load and store addresses the
+    // virtual address space of "address_space_size" words, and control can not
+    // run off the end of the image.
+    // The CPU executes verified images without per-instruction checks.
+    class Verifier
+    {
+    public:
+        typedef std::vector<std::string> error_list_type;
+
+        static const int MIN_INTERRUPT_NUMBER = 1;
+        static const int MAX_INTERRUPT_NUMBER = 13;
+
+        // Interrupts from MIN_INTERRUPT_NUMBER up to this one never return to
+        // the next instruction, and so are the only ones that may end an image
+
+        static const int MAX_EXIT_INTERRUPT_NUMBER = 3;
+
+        static bool Verify(const MMU::ram_type &image, MMU::vmem_size_type address_space_size, error_list_type &errors);
+    };
+}
+
+#endif
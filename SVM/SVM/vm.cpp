@@ -1,7 +1,47 @@
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <thread>
 
 #include "kernel.h"
+#include "balancer.h"
+#include "daemon.h"
+
+static const char *TRACE_OPTION = "/trace:";
+static const char *PROFILE_OPTION = "/profile:";
+static const char *FOLDED_STACKS_OPTION = "/folded:";
+static const char *JIT_OPTION = "/jit";
+static const char *TIMER_OPTION = "/timer:";
+static const char *QUANTUM_OPTION = "/quantum:";
+static const char *FILE_OPTION = "/file:";
+static const char *PAGE_SIZE_OPTION = "/page:";
+static const char *NO_HUGE_PAGES_OPTION = "/nohuge";
+static const char *ZEROED_FRAMES_OPTION = "/zeroed:";
+static const char *MACHINES_OPTION = "/machines:";
+static const char *DAEMON_OPTION = "/daemon:";
+static const char *QUEUE_OPTION = "/queue:";
+
+static bool HasPrefix(const std::string &text, const char *prefix)
+{
+    return text.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+static int PrintUsage()
+{
+    std::cerr << "The syntax of the command is incorrect." << std::endl <<
+                 " vm /scheduler:<fcfs|sf|rr|priority> <program> [<program> ...]" << std::endl <<
+                 "    [/jit] [/timer:<cycles>] [/quantum:<ticks>] [/file:<path> ...] [/page:<words>] [/nohuge]" << std::endl <<
+                 "    [/zeroed:<frames>] [/machines:<count>] [/daemon:<socket>] [/queue:<jobs>]" << std::endl <<
+                 "    [/trace:<file>] [/profile:<cycles>] [/folded:<file>]" << std::endl << std::endl <<
+                 " /jit without /timer sets a period of " << vm::Jit::DEFAULT_TIMER_PERIOD << " cycles. Translated code needs" << std::endl <<
+                 " " << vm::Jit::MIN_BUDGET << " cycles to the next tick, /jit with a shorter /timer gets a warning." << std::endl << std::endl;
+
+    return -1;
+}
 
 int main(int argc, char *argv[])
 {
@@ -17,14 +57,157 @@ int main(int argc, char *argv[])
             scheduler = vm::Kernel::RoundRobin;
         } else if (arg == "/scheduler:priority") {
             scheduler = vm::Kernel::Priority;
+        } else {
+            return PrintUsage();
         }
 
+        std::unique_ptr<vm::Tracer> tracer;
+        std::unique_ptr<vm::Profiler> profiler;
+        std::unique_ptr<vm::Jit> jit;
+        std::string folded_stacks_path;
+
+        vm::Kernel::Options options;
+        bool timer_chosen = false;
+
+        unsigned int machine_count = 1;
+
+        std::string daemon_path;
+        vm::Daemon::Options daemon_options;
+
         std::vector<std::string> processes;
         for (int i = 2; i < argc; ++i) {
-            processes.push_back(std::string(argv[i]));
+            std::string option(argv[i]);
+
+            if (HasPrefix(option, TRACE_OPTION)) {
+                tracer.reset(new vm::Tracer(option.substr(std::strlen(TRACE_OPTION))));
+            } else if (HasPrefix(option, PROFILE_OPTION)) {
+                profiler.reset(new vm::Profiler(std::atoi(option.c_str() + std::strlen(PROFILE_OPTION))));
+            } else if (HasPrefix(option, FOLDED_STACKS_OPTION)) {
+                folded_stacks_path = option.substr(std::strlen(FOLDED_STACKS_OPTION));
+            } else if (option == JIT_OPTION) {
+                jit.reset(new vm::Jit());
+                if (!jit->IsAvailable()) {
+                    std::cerr << "The JIT is not available on this host, interpreting instead." << std::endl;
+                }
+            } else if (HasPrefix(option, TIMER_OPTION)) {
+                options.timer_frequency = std::atoi(option.c_str() + std::strlen(TIMER_OPTION));
+                timer_chosen = true;
+            } else if (HasPrefix(option, QUANTUM_OPTION)) {
+                options.quantum = std::atoi(option.c_str() + std::strlen(QUANTUM_OPTION));
+            } else if (HasPrefix(option, FILE_OPTION)) {
+                options.files.push_back(option.substr(std::strlen(FILE_OPTION)));
+            } else if (HasPrefix(option, PAGE_SIZE_OPTION)) {
+                options.page_size = std::atoi(option.c_str() + std::strlen(PAGE_SIZE_OPTION));
+            } else if (option == NO_HUGE_PAGES_OPTION) {
+                options.huge_pages = false;
+            } else if (HasPrefix(option, ZEROED_FRAMES_OPTION)) {
+                options.zeroed_frames = std::atoi(option.c_str() + std::strlen(ZEROED_FRAMES_OPTION));
+            } else if (HasPrefix(option, MACHINES_OPTION)) {
+                machine_count = std::max(std::atoi(option.c_str() + std::strlen(MACHINES_OPTION)), 1);
+            } else if (HasPrefix(option, DAEMON_OPTION)) {
+                daemon_path = option.substr(std::strlen(DAEMON_OPTION));
+            } else if (HasPrefix(option, QUEUE_OPTION)) {
+                daemon_options.queue_size = std::max(std::atoi(option.c_str() + std::strlen(QUEUE_OPTION)), 1);
+            } else {
+                processes.push_back(option);
+            }
+        }
+
+        // The tracer and the profiler follow a single machine
+
+        if (machine_count > 1 && (tracer || profiler)) {
+            std::cerr << "Tracing and profiling need a single machine, ignoring them." << std::endl;
+
+            tracer.reset();
+            profiler.reset();
+        }
+
+        if (jit && jit->IsAvailable()) {
+            if (!timer_chosen) {
+                options.timer_frequency = vm::Jit::DEFAULT_TIMER_PERIOD;
+            } else if (options.timer_frequency < vm::Jit::MIN_BUDGET) {
+                std::cerr << "A timer period below " << vm::Jit::MIN_BUDGET << " cycles leaves the JIT no room to run." << std::endl;
+            }
         }
 
-        vm::Kernel kernel(scheduler, processes);
+        options.tracer = tracer.get();
+        options.profiler = profiler.get();
+        options.jit = jit.get();
+
+        // The kernels stay up waiting for jobs until a client asks the
+        // daemon to shut down
+
+        std::unique_ptr<vm::Daemon> daemon;
+        if (!daemon_path.empty()) {
+            vm::MMU::ram_size_type page_size = vm::MMU::IsValidPageSize(options.page_size) ? options.page_size : vm::MMU::DEFAULT_PAGE_SIZE;
+            daemon_options.address_space_size = vm::MMU::RAM_SIZE / page_size * page_size;
+
+            daemon.reset(new vm::Daemon(daemon_options));
+            if (!daemon->Listen(daemon_path)) {
+                return 1;
+            }
+
+            options.daemon = daemon.get();
+        }
+
+        if (machine_count == 1) {
+            vm::Kernel kernel(scheduler, processes, options);
+        } else {
+            // Programs are dealt out in turn, the balancer evens out the
+            // rest. Under a daemon idle kernels take the next job themselves.
+
+            std::vector<std::vector<std::string> > machine_processes(machine_count);
+            for (std::vector<std::string>::size_type i = 0; i < processes.size(); ++i) {
+                machine_processes[i % machine_count].push_back(processes[i]);
+            }
+
+            vm::Balancer balancer(machine_count);
+            if (!daemon) {
+                options.balancer = &balancer;
+            }
+
+            std::vector<std::thread> machines;
+            for (unsigned int machine = 0; machine < machine_count; ++machine) {
+                machines.push_back(std::thread([&, machine]() {
+                    vm::Kernel::Options machine_options = options;
+
+                    std::unique_ptr<vm::Jit> machine_jit;
+                    if (options.jit) {
+                        machine_jit.reset(new vm::Jit());
+                        machine_options.jit = machine_jit.get();
+                    }
+
+                    vm::Kernel kernel(scheduler, machine_processes[machine], machine_options);
+                }));
+            }
+
+            for (std::vector<std::thread>::iterator it = machines.begin(); it != machines.end(); ++it) {
+                it->join();
+            }
+
+            if (!daemon) {
+                std::cout << "Balancer: " << balancer.GetMigrationCount() << " processes migrated." << std::endl;
+            }
+        }
+
+        if (daemon) {
+            std::cout << "Daemon: " << daemon->GetJobCount() << " jobs queued." << std::endl;
+        }
+
+        if (profiler) {
+            profiler->WriteReport(std::cout);
+
+            if (!folded_stacks_path.empty()) {
+                std::ofstream folded_stacks_stream(folded_stacks_path.c_str());
+                if (!folded_stacks_stream) {
+                    std::cerr << "Failed to open the folded stacks file." << std::endl;
+                } else {
+                    profiler->WriteFoldedStacks(folded_stacks_stream);
+                }
+            }
+        }
+    } else {
+        return PrintUsage();
     }
 
     return 0;
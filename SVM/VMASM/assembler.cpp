@@ -0,0 +1,601 @@
+#include "assembler.h"
+#include "mapped_file.h"
+
+#include "opcodes.h"
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+namespace vmasm
+{
+    namespace
+    {
+        inline char ToLower(char character)
+        {
+            return (character >= 'A' && character <= 'Z') ? static_cast<char>(character - 'A' + 'a') : character;
+        }
+
+        inline bool IsSpace(char character)
+        {
+            return character == ' ' || character == '\t' || character == '\r' || character == '\v' || character == '\f';
+        }
+
+        inline bool IsCommentStart(char character)
+        {
+            return character == ';' || character == '#';
+        }
+
+        // Perfect hash on (lower-case first letter + length) & 15 over the
+        // mnemonics of the instruction table. A mnemonic added to a slot that
+        // is already taken stops the assembler at startup.
+
+        const unsigned int MNEMONIC_TABLE_SIZE = 16;
+
+        struct MnemonicTable
+        {
+            const vm::InstructionDescription *slots[MNEMONIC_TABLE_SIZE];
+        };
+
+        inline unsigned int MnemonicSlot(const char *begin, std::string::size_type length)
+        {
+            return (static_cast<unsigned char>(ToLower(*begin)) + length) & (MNEMONIC_TABLE_SIZE - 1);
+        }
+
+        MnemonicTable BuildMnemonicTable()
+        {
+            MnemonicTable table;
+            for (unsigned int slot = 0; slot < MNEMONIC_TABLE_SIZE; ++slot) {
+                table.slots[slot] = NULL;
+            }
+
+            for (std::size_t i = 0; i < vm::INSTRUCTION_COUNT; ++i) {
+                const vm::InstructionDescription &description = vm::INSTRUCTION_TABLE[i];
+                if (!description.mnemonic) {
+                    continue;
+                }
+
+                const vm::InstructionDescription *&slot = table.slots[MnemonicSlot(description.mnemonic, std::strlen(description.mnemonic))];
+                if (slot) {
+                    std::cerr << "Assembler: mnemonics " << slot->mnemonic << " and " << description.mnemonic <<
+                                 " share a slot of the mnemonic table. Terminating..." << std::endl;
+
+                    std::abort();
+                }
+
+                slot = &description;
+            }
+
+            return table;
+        }
+
+        const MnemonicTable mnemonic_table = BuildMnemonicTable();
+
+        const vm::InstructionDescription *FindMnemonic(const char *begin, const char *end)
+        {
+            std::string::size_type length = static_cast<std::string::size_type>(end - begin);
+
+            const vm::InstructionDescription *candidate = mnemonic_table.slots[MnemonicSlot(begin, length)];
+            if (!candidate) {
+                return NULL;
+            }
+
+            std::string::size_type i = 0;
+            for (; i < length && candidate->mnemonic[i]; ++i) {
+                if (ToLower(begin[i]) != candidate->mnemonic[i]) {
+                    return NULL;
+                }
+            }
+
+            return (i == length && !candidate->mnemonic[i]) ? candidate : NULL;
+        }
+
+        int FindRegister(const char *begin, const char *end)
+        {
+            if (end - begin != 1) {
+                return -1;
+            }
+
+            char name = ToLower(*begin);
+
+            return (name >= 'a' && name <= 'c') ? name - 'a' : -1;
+        }
+
+        bool ParseInteger(const char *begin, const char *end, int &value)
+        {
+            bool negative = false;
+            if (begin != end && (*begin == '-' || *begin == '+')) {
+                negative = *begin == '-';
+                ++begin;
+            }
+
+            if (begin == end) {
+                return false;
+            }
+
+            long long result = 0;
+            for (; begin != end; ++begin) {
+                if (*begin < '0' || *begin > '9') {
+                    return false;
+                }
+
+                result = result * 10 + (*begin - '0');
+                if (result > static_cast<long long>(INT_MAX) + 1) {
+                    return false;
+                }
+            }
+
+            if (negative) {
+                result = -result;
+            }
+            if (result > INT_MAX || result < INT_MIN) {
+                return false;
+            }
+
+            value = static_cast<int>(result);
+
+            return true;
+        }
+
+        bool IsLabelName(const char *begin, const char *end)
+        {
+            if (begin == end || (*begin >= '0' && *begin <= '9') || *begin == '-' || *begin == '+') {
+                return false;
+            }
+
+            for (; begin != end; ++begin) {
+                char character = ToLower(*begin);
+                if (!((character >= 'a' && character <= 'z') || (character >= '0' && character <= '9') || character == '_' || character == '.')) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // Register instructions are encoded as a base opcode plus the register index
+
+        inline int BaseOpcode(int opcode)
+        {
+            return opcode & 0xF0;
+        }
+
+        inline int RegisterIndex(int opcode)
+        {
+            return opcode & 0x0F;
+        }
+
+        // Bulk instructions read and write registers and memory in ways the
+        // optimiser does not track, so they end a block for it too
+
+        inline bool EndsBlock(const Assembler::Instruction &instruction)
+        {
+            return instruction.opcode == vm::Opcodes::JMP_BASE_OPCODE || instruction.opcode == vm::Opcodes::INT_BASE_OPCODE ||
+                   instruction.opcode == vm::Opcodes::COPY_OPCODE || instruction.opcode == vm::Opcodes::FILL_OPCODE ||
+                   instruction.opcode == vm::Opcodes::COMPARE_OPCODE;
+        }
+
+        // Marks the instructions that jumps land on. Returns false if a jump does not
+        // land on an instruction, in which case the program is left as written.
+
+        bool FindJumpTargets(const Assembler::instruction_list_type &instructions, std::vector<bool> &targets)
+        {
+            targets.assign(instructions.size(), false);
+
+            for (Assembler::instruction_list_type::size_type i = 0; i < instructions.size(); ++i) {
+                if (instructions[i].opcode == vm::Opcodes::JMP_BASE_OPCODE) {
+                    long long target = static_cast<long long>(i) * 2 + instructions[i].data;
+                    if (target < 0 || target % 2 != 0 || target / 2 >= static_cast<long long>(instructions.size())) {
+                        return false;
+                    }
+
+                    targets[static_cast<Assembler::instruction_list_type::size_type>(target / 2)] = true;
+                }
+            }
+
+            return true;
+        }
+
+        void ReportError(std::ostream &errors, const std::string &input_path, unsigned int line, const char *message)
+        {
+            errors << input_path << ":" << line << ": " << message << std::endl;
+        }
+    }
+
+    const char *Assembler::DEBUG_MAP_EXTENSION = ".map";
+
+    Assembler::Options::Options()
+        : debug(false), fusion(true), optimization(true) {}
+
+    Assembler::Assembler(const Options &options)
+        : _options(options), _instructions(), _labels(), _label_references() {}
+
+    Assembler::~Assembler() {}
+
+    bool Assembler::Assemble(const std::string &input_path, const std::string &output_path, std::ostream &errors)
+    {
+        _instructions.clear();
+        _labels.clear();
+        _label_references.clear();
+
+        MappedFile input(input_path);
+        if (!input.IsOpen()) {
+            errors << input_path << ": failed to open the input file." << std::endl;
+
+            return false;
+        }
+
+        // Pass one: tokenize straight out of the mapping, collecting instructions and labels
+
+        bool succeeded = true;
+
+        unsigned int line = 0;
+        for (const char *line_begin = input.Begin(), *input_end = input.End(); line_begin < input_end;) {
+            const char *line_end = line_begin;
+            while (line_end != input_end && *line_end != '\n') {
+                ++line_end;
+            }
+
+            succeeded = ParseLine(line_begin, line_end, ++line, input_path, errors) && succeeded;
+
+            line_begin = line_end + 1;
+        }
+
+        // Pass two: patch jumps to labels
+
+        succeeded = succeeded && ResolveLabels(input_path, errors);
+        if (!succeeded) {
+            return false;
+        }
+
+        if (_options.optimization) {
+            RemoveRedundantInstructions();
+
+            if (_options.fusion) {
+                FuseInstructions();
+            }
+        }
+
+        return Write(input_path, output_path, errors);
+    }
+
+    bool Assembler::ParseLine(const char *begin, const char *end, unsigned int line,
+                              const std::string &input_path, std::ostream &errors)
+    {
+        const unsigned int MAX_TOKENS = 4;
+
+        Token tokens[MAX_TOKENS + 1];
+        unsigned int count = 0;
+
+        for (const char *current = begin; current != end;) {
+            if (IsSpace(*current)) {
+                ++current;
+            } else if (IsCommentStart(*current)) {
+                break;
+            } else {
+                if (count > MAX_TOKENS) {
+                    break;
+                }
+
+                tokens[count].begin = current;
+                while (current != end && !IsSpace(*current) && !IsCommentStart(*current)) {
+                    ++current;
+                }
+                tokens[count++].end = current;
+            }
+        }
+
+        unsigned int first = 0;
+
+        // "name:" defines a label for the next instruction
+
+        if (count > 0 && *(tokens[0].end - 1) == ':') {
+            if (!IsLabelName(tokens[0].begin, tokens[0].end - 1)) {
+                ReportError(errors, input_path, line, "Invalid label name.");
+
+                return false;
+            }
+
+            std::string label(tokens[0].begin, tokens[0].end - 1);
+            if (!_labels.insert(std::make_pair(label, _instructions.size())).second) {
+                ReportError(errors, input_path, line, "Duplicate label.");
+
+                return false;
+            }
+
+            first = 1;
+        }
+
+        if (first == count) {
+            return true;
+        }
+
+        const vm::InstructionDescription *mnemonic = FindMnemonic(tokens[first].begin, tokens[first].end);
+        if (!mnemonic) {
+            ReportError(errors, input_path, line, "Invalid assembly statement.");
+
+            return false;
+        }
+
+        Instruction instruction;
+        instruction.opcode = mnemonic->opcode;
+        instruction.data = 0;
+        instruction.line = line;
+
+        unsigned int operand = first + 1;
+
+        switch (mnemonic->operands) {
+        case vm::RegisterAndImmediate:
+            {
+                int index = operand < count ? FindRegister(tokens[operand].begin, tokens[operand].end) : -1;
+                if (index < 0) {
+                    ReportError(errors, input_path, line, "Invalid register specifier.");
+
+                    return false;
+                }
+
+                instruction.opcode += index;
+                ++operand;
+
+                if (operand >= count || !ParseInteger(tokens[operand].begin, tokens[operand].end, instruction.data)) {
+                    ReportError(errors, input_path, line, "Invalid immediate value.");
+
+                    return false;
+                }
+            }
+
+            break;
+
+        case vm::JumpTarget:
+            if (operand < count && !ParseInteger(tokens[operand].begin, tokens[operand].end, instruction.data)) {
+                if (!IsLabelName(tokens[operand].begin, tokens[operand].end)) {
+                    ReportError(errors, input_path, line, "Invalid relative address.");
+
+                    return false;
+                }
+
+                LabelReference reference;
+                reference.instruction = _instructions.size();
+                reference.label.assign(tokens[operand].begin, tokens[operand].end);
+
+                _label_references.push_back(reference);
+            } else if (operand >= count) {
+                ReportError(errors, input_path, line, "Invalid relative address.");
+
+                return false;
+            }
+
+            break;
+
+        case vm::Immediate:
+            if (operand >= count || !ParseInteger(tokens[operand].begin, tokens[operand].end, instruction.data)) {
+                ReportError(errors, input_path, line, "Invalid interrupt number.");
+
+                return false;
+            }
+
+            break;
+
+        case vm::NoOperand:
+            --operand;
+
+            break;
+        }
+
+        if (operand + 1 < count) {
+            ReportError(errors, input_path, line, "Unexpected token after the statement.");
+
+            return false;
+        }
+
+        _instructions.push_back(instruction);
+
+        return true;
+    }
+
+    bool Assembler::ResolveLabels(const std::string &input_path, std::ostream &errors)
+    {
+        bool succeeded = true;
+
+        for (std::vector<LabelReference>::const_iterator it = _label_references.begin(); it != _label_references.end(); ++it) {
+            std::map<std::string, instruction_list_type::size_type>::const_iterator label = _labels.find(it->label);
+
+            Instruction &instruction = _instructions[it->instruction];
+            if (label == _labels.end() || label->second >= _instructions.size()) {
+                ReportError(errors, input_path, instruction.line, "Undefined label.");
+                succeeded = false;
+            } else {
+                instruction.data = static_cast<int>(label->second * 2) - static_cast<int>(it->instruction * 2);
+            }
+        }
+
+        return succeeded;
+    }
+
+    // Removes moves of a value the register already holds, moves that are
+    // overwritten before they are read and stores that are overwritten before they
+    // are read. The analysis never crosses a jump, an interrupt or a jump target.
+    // Jumps are re-targeted to the next surviving instruction afterwards.
+
+    void Assembler::RemoveRedundantInstructions()
+    {
+        instruction_list_type &instructions = _instructions;
+
+        std::vector<bool> targets;
+        if (!FindJumpTargets(instructions, targets)) {
+            return;
+        }
+
+        const instruction_list_type::size_type count = instructions.size();
+        std::vector<bool> removed(count, false);
+
+        bool known[3] = { false, false, false };
+        int values[3] = { 0, 0, 0 };
+
+        for (instruction_list_type::size_type i = 0; i < count; ++i) {
+            const Instruction &instruction = instructions[i];
+
+            if (targets[i]) {
+                known[0] = known[1] = known[2] = false;
+            }
+
+            if (BaseOpcode(instruction.opcode) == vm::Opcodes::MOVA_BASE_OPCODE) {
+                int index = RegisterIndex(instruction.opcode);
+                if (known[index] && values[index] == instruction.data) {
+                    removed[i] = true;
+                } else {
+                    known[index] = true;
+                    values[index] = instruction.data;
+                }
+            } else if (BaseOpcode(instruction.opcode) == vm::Opcodes::LDA_BASE_OPCODE) {
+                known[RegisterIndex(instruction.opcode)] = false;
+            } else if (EndsBlock(instruction)) {
+                known[0] = known[1] = known[2] = false;
+            }
+        }
+
+        // Walk each block backwards, remembering which registers and addresses are
+        // overwritten further down before anything reads them
+
+        bool overwritten[3] = { false, false, false };
+        std::set<int> overwritten_addresses;
+
+        for (instruction_list_type::size_type i = count; i-- > 0;) {
+            const Instruction &instruction = instructions[i];
+
+            if (EndsBlock(instruction)) {
+                overwritten[0] = overwritten[1] = overwritten[2] = false;
+                overwritten_addresses.clear();
+            } else if (!removed[i]) {
+                int base = BaseOpcode(instruction.opcode), index = RegisterIndex(instruction.opcode);
+
+                if (base == vm::Opcodes::MOVA_BASE_OPCODE) {
+                    removed[i] = overwritten[index];
+                    overwritten[index] = true;
+                } else if (base == vm::Opcodes::LDA_BASE_OPCODE) {
+                    // A load into the register may fault and be skipped, so only a move kills it
+
+                    overwritten[index] = false;
+                    overwritten_addresses.erase(instruction.data);
+                } else if (base == vm::Opcodes::STA_BASE_OPCODE) {
+                    overwritten[index] = false;
+                    removed[i] = !overwritten_addresses.insert(instruction.data).second;
+                }
+            }
+
+            if (targets[i]) {
+                overwritten[0] = overwritten[1] = overwritten[2] = false;
+                overwritten_addresses.clear();
+            }
+        }
+
+        std::vector<instruction_list_type::size_type> new_indices(count);
+        instruction_list_type::size_type kept = 0;
+        for (instruction_list_type::size_type i = 0; i < count; ++i) {
+            new_indices[i] = kept;
+            if (!removed[i]) {
+                ++kept;
+            }
+        }
+
+        instruction_list_type result;
+        result.reserve(kept);
+        for (instruction_list_type::size_type i = 0; i < count; ++i) {
+            if (!removed[i]) {
+                Instruction instruction = instructions[i];
+                if (instruction.opcode == vm::Opcodes::JMP_BASE_OPCODE) {
+                    instruction_list_type::size_type target = (i * 2 + instruction.data) / 2;
+                    instruction.data = static_cast<int>(new_indices[target] * 2) - static_cast<int>(new_indices[i] * 2);
+                }
+
+                result.push_back(instruction);
+            }
+        }
+
+        instructions.swap(result);
+    }
+
+    // Rewrites the first opcode of common pairs into a superinstruction. The second
+    // instruction stays in place, so the layout and all jump offsets are unchanged.
+
+    void Assembler::FuseInstructions()
+    {
+        instruction_list_type &instructions = _instructions;
+
+        for (instruction_list_type::size_type i = 0; i + 1 < instructions.size();) {
+            Instruction &first = instructions[i];
+            const Instruction &second = instructions[i + 1];
+
+            int first_base = BaseOpcode(first.opcode), second_base = BaseOpcode(second.opcode);
+            int first_register = RegisterIndex(first.opcode), second_register = RegisterIndex(second.opcode);
+
+            int fused = 0;
+            if (first_base == vm::Opcodes::MOVA_BASE_OPCODE && second_base == vm::Opcodes::STA_BASE_OPCODE && first_register == second_register) {
+                fused = vm::Opcodes::MOVA_STA_FUSED_OPCODE + first_register;
+            } else if (first_base == vm::Opcodes::LDA_BASE_OPCODE && second_base == vm::Opcodes::STA_BASE_OPCODE && first_register == second_register) {
+                fused = vm::Opcodes::LDA_STA_FUSED_OPCODE + first_register;
+            } else if (first_base == vm::Opcodes::LDA_BASE_OPCODE && second_base == vm::Opcodes::LDA_BASE_OPCODE) {
+                fused = vm::Opcodes::LDA_LDA_FUSED_OPCODE + first_register * 3 + second_register;
+            }
+
+            if (fused) {
+                first.opcode = fused;
+                i += 2;
+            } else {
+                i += 1;
+            }
+        }
+    }
+
+    bool Assembler::Write(const std::string &input_path, const std::string &output_path, std::ostream &errors) const
+    {
+        std::vector<char> buffer(1 << 16);
+
+        std::ofstream output_stream;
+        output_stream.rdbuf()->pubsetbuf(&buffer[0], buffer.size());
+        output_stream.open(output_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!output_stream) {
+            errors << output_path << ": failed to open the output file." << std::endl;
+
+            return false;
+        }
+
+        for (instruction_list_type::const_iterator it = _instructions.begin(); it != _instructions.end(); ++it) {
+            output_stream.write(reinterpret_cast<const char *>(&it->opcode), sizeof(int));
+            output_stream.write(reinterpret_cast<const char *>(&it->data), sizeof(int));
+        }
+
+        output_stream.flush();
+        if (output_stream.bad()) {
+            errors << output_path << ": failed to write the output file." << std::endl;
+
+            return false;
+        }
+
+        if (_options.debug) {
+            std::ofstream map_stream((output_path + DEBUG_MAP_EXTENSION).c_str());
+            if (!map_stream) {
+                errors << output_path << DEBUG_MAP_EXTENSION << ": failed to open the debug map file." << std::endl;
+
+                return false;
+            }
+
+            map_stream << "source " << input_path << "\n";
+            for (instruction_list_type::size_type i = 0; i < _instructions.size(); ++i) {
+                map_stream << i * 2 << " " << _instructions[i].line << "\n";
+            }
+
+            map_stream.flush();
+            if (map_stream.bad()) {
+                errors << output_path << DEBUG_MAP_EXTENSION << ": failed to write the debug map file." << std::endl;
+
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
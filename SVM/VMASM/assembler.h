@@ -0,0 +1,75 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace vmasm
+{
+    // Assembles one .vmasm file into one .vmexe image. Every instance is
+    // independent, so separate files can be assembled on separate threads.
+    class Assembler
+    {
+    public:
+        struct Options
+        {
+            bool debug;
+            bool fusion;
+            bool optimization;
+
+            Options();
+        };
+
+        struct Instruction
+        {
+            int opcode;
+            int data;
+
+            unsigned int line;
+        };
+
+        typedef std::vector<Instruction> instruction_list_type;
+
+        static const char *DEBUG_MAP_EXTENSION;
+
+        Assembler(const Options &options);
+        virtual ~Assembler();
+
+        bool Assemble(const std::string &input_path, const std::string &output_path, std::ostream &errors);
+
+    private:
+        struct Token
+        {
+            const char *begin;
+            const char *end;
+
+            std::string::size_type Length() const { return static_cast<std::string::size_type>(end - begin); }
+        };
+
+        struct LabelReference
+        {
+            instruction_list_type::size_type instruction;
+            std::string label;
+        };
+
+        Options _options;
+
+        instruction_list_type _instructions;
+
+        std::map<std::string, instruction_list_type::size_type> _labels;
+        std::vector<LabelReference> _label_references;
+
+        bool ParseLine(const char *begin, const char *end, unsigned int line,
+                       const std::string &input_path, std::ostream &errors);
+        bool ResolveLabels(const std::string &input_path, std::ostream &errors);
+
+        void RemoveRedundantInstructions();
+        void FuseInstructions();
+
+        bool Write(const std::string &input_path, const std::string &output_path, std::ostream &errors) const;
+    };
+}
+
+#endif
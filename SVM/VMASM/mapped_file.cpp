@@ -0,0 +1,116 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vmasm
+{
+#ifdef _WIN32
+    MappedFile::MappedFile(const std::string &path)
+        : _data(NULL), _size(0), _open(false), _file(INVALID_HANDLE_VALUE), _mapping(NULL)
+    {
+        _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (_file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(_file, &size)) {
+            return;
+        }
+
+        _size = static_cast<std::size_t>(size.QuadPart);
+        _open = true;
+
+        // Empty files can not be mapped, but they are still valid input
+
+        if (_size == 0) {
+            return;
+        }
+
+        _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (_mapping != NULL) {
+            _data = static_cast<const char *>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+
+        _open = _data != NULL;
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (_data) {
+            UnmapViewOfFile(_data);
+        }
+        if (_mapping) {
+            CloseHandle(_mapping);
+        }
+        if (_file != INVALID_HANDLE_VALUE) {
+            CloseHandle(_file);
+        }
+    }
+#else
+    MappedFile::MappedFile(const std::string &path)
+        : _data(NULL), _size(0), _open(false), _file(-1)
+    {
+        _file = open(path.c_str(), O_RDONLY);
+        if (_file < 0) {
+            return;
+        }
+
+        struct stat status;
+        if (fstat(_file, &status) != 0) {
+            return;
+        }
+
+        _size = static_cast<std::size_t>(status.st_size);
+        _open = true;
+
+        // Empty files can not be mapped, but they are still valid input
+
+        if (_size == 0) {
+            return;
+        }
+
+        void *data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, _file, 0);
+        if (data == MAP_FAILED) {
+            _open = false;
+        } else {
+            madvise(data, _size, MADV_SEQUENTIAL);
+            _data = static_cast<const char *>(data);
+        }
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (_data) {
+            munmap(const_cast<char *>(_data), _size);
+        }
+        if (_file >= 0) {
+            close(_file);
+        }
+    }
+#endif
+
+    bool MappedFile::IsOpen() const
+    {
+        return _open;
+    }
+
+    const char *MappedFile::Begin() const
+    {
+        return _data;
+    }
+
+    const char *MappedFile::End() const
+    {
+        return _data + (_data ? _size : 0);
+    }
+}
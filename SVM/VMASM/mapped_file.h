@@ -0,0 +1,40 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+namespace vmasm
+{
+    // Read-only memory mapping of a whole file. The assembler tokenizes straight
+    // out of the mapping, so source text is never copied.
+    class MappedFile
+    {
+    public:
+        MappedFile(const std::string &path);
+        virtual ~MappedFile();
+
+        bool IsOpen() const;
+
+        const char *Begin() const;
+        const char *End() const;
+
+    private:
+        const char *_data;
+        std::size_t _size;
+
+        bool _open;
+
+#ifdef _WIN32
+        void *_file;
+        void *_mapping;
+#else
+        int _file;
+#endif
+
+        MappedFile(const MappedFile &);
+        MappedFile &operator=(const MappedFile &);
+    };
+}
+
+#endif
@@ -1,206 +1,113 @@
 #include <iostream>
-#include <fstream>
-#include <string>
 #include <sstream>
+#include <string>
 #include <vector>
-#include <algorithm>
-#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <thread>
 
-static const char *REGISTER_A_TOKEN = "a";
-static const char *REGISTER_B_TOKEN = "b";
-static const char *REGISTER_C_TOKEN = "c";
+#include "assembler.h"
 
-static const char *MOV_OPCODE_TOKEN = "mov";
+static const char *DEBUG_OPTION = "/debug";
+static const char *NO_FUSION_OPTION = "/nofusion";
+static const char *NO_OPTIMIZATION_OPTION = "/noopt";
+static const char *JOBS_OPTION = "/jobs:";
 
-static const int MOVA_BASE_OPCODE = 0x10;
-static const int MOVB_BASE_OPCODE = MOVA_BASE_OPCODE + 1;
-static const int MOVC_BASE_OPCODE = MOVA_BASE_OPCODE + 2;
-
-static const char *LD_OPCODE_TOKEN = "ld";
-static const int LDA_BASE_OPCODE = 0x20;
-static const int LDB_BASE_OPCODE = LDA_BASE_OPCODE + 1;
-static const int LDC_BASE_OPCODE = LDA_BASE_OPCODE + 2;
+struct Job
+{
+    std::string input_path;
+    std::string output_path;
 
-static const char *ST_OPCODE_TOKEN = "st";
-static const int STA_BASE_OPCODE = 0x30;
-static const int STB_BASE_OPCODE = STA_BASE_OPCODE + 1;
-static const int STC_BASE_OPCODE = STA_BASE_OPCODE + 2;
+    std::ostringstream errors;
+    bool succeeded;
+};
 
+// Each worker takes the next unassembled file until none are left. Errors are
+// buffered per file and printed in command line order once everything is done.
 
-static const char *JMP_OPCODE_TOKEN = "jmp";
-static const int JMP_BASE_OPCODE = 0x40;
+static void AssembleJobs(std::vector<Job *> &jobs, std::atomic<std::size_t> &next_job, const vmasm::Assembler::Options &options)
+{
+    vmasm::Assembler assembler(options);
 
-static const char *INT_OPCODE_TOKEN = "int";
-static const int INT_BASE_OPCODE = 0x50;
+    for (std::size_t i = next_job++; i < jobs.size(); i = next_job++) {
+        jobs[i]->succeeded = assembler.Assemble(jobs[i]->input_path, jobs[i]->output_path, jobs[i]->errors);
+    }
+}
 
 int main(int argc, char *argv[])
 {
-    int exit_code = 0;
-
-    if (argc >= 3) {
-        std::string input_file;
-
-        std::string input_file_name(argv[1]);
-        std::string output_file_name(argv[2]);
-
-        std::ifstream input_stream(argv[1]);
-        if (!input_stream) {
-            std::cerr << "Failed to open the input file." << std::endl;
+    vmasm::Assembler::Options options;
+    unsigned int thread_count = std::thread::hardware_concurrency();
+
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument(argv[i]);
+
+        if (argument == DEBUG_OPTION) {
+            options.debug = true;
+        } else if (argument == NO_FUSION_OPTION) {
+            options.fusion = false;
+        } else if (argument == NO_OPTIMIZATION_OPTION) {
+            options.optimization = false;
+        } else if (argument.compare(0, std::strlen(JOBS_OPTION), JOBS_OPTION) == 0) {
+            thread_count = static_cast<unsigned int>(std::atoi(argument.c_str() + std::strlen(JOBS_OPTION)));
+        } else if (!argument.empty() && argument[0] == '/' && argument.find('/', 1) == std::string::npos) {
+            std::cerr << "Unknown option " << argument << "." << std::endl;
 
             return -1;
+        } else {
+            paths.push_back(argument);
         }
+    }
 
-        std::ofstream output_stream(argv[2], std::ios::out | std::ios::binary);
-        if (!output_stream) {
-            std::cerr << "Failed to open the output file." << std::endl;
+    if (paths.empty() || paths.size() % 2 != 0) {
+        std::cerr << "The syntax of the command is incorrect." << std::endl <<
+                     " vmasm <input file> <output file> [<input file> <output file> ...]" << std::endl <<
+                     "       [/debug] [/nofusion] [/noopt] [/jobs:<count>]" << std::endl << std::endl;
 
-            return -1;
-        }
+        return -1;
+    }
 
-        std::vector<int> ops;
-
-        for (std::string line; std::getline(input_stream, line);) {
-            std::stringstream tokens(line); std::string token;
-            if (tokens >> token) {
-                std::transform(token.begin(), token.end(), token.begin(), tolower);
-
-                if (token == MOV_OPCODE_TOKEN) {
-                    int instruction, data;
-                    if (tokens >> token) {
-                        std::transform(token.begin(), token.end(), token.begin(), tolower);
-
-                        if (token == REGISTER_A_TOKEN) {
-                            instruction = MOVA_BASE_OPCODE;
-                        } else if (token == REGISTER_B_TOKEN) {
-                            instruction = MOVB_BASE_OPCODE;
-                        } else if (token == REGISTER_C_TOKEN) {
-                            instruction = MOVC_BASE_OPCODE;
-                        } else {
-                            std::cerr << "Invalid register specifier." << std::endl;
-
-                            return -1;
-                        }
-
-                        if (!(tokens >> data)) {
-                            std::cerr << "Invalid immediate value." << std::endl;
-
-                            return -1;
-                        }
-
-                        ops.push_back(instruction);
-                        ops.push_back(data);
-                    } else {
-                        std::cerr << "Invalid assembly statement." << std::endl;
-
-                        return -1;
-                    }
-                } if (token == LD_OPCODE_TOKEN) {
-					int instruction, data;
-                    if (tokens >> token) {
-                        std::transform(token.begin(), token.end(), token.begin(), tolower);
-						
-                        if (token == REGISTER_A_TOKEN) {
-                            instruction = LDA_BASE_OPCODE;
-                        } else if (token == REGISTER_B_TOKEN) {
-                            instruction = LDB_BASE_OPCODE;
-                        } else if (token == REGISTER_C_TOKEN) {
-                            instruction = LDC_BASE_OPCODE;
-                        } else {
-                            std::cerr << "Invalid register specifier." << std::endl;
-
-                            return -1;
-                        }
-
-                        if (!(tokens >> data)) {
-                            std::cerr << "Invalid immediate value." << std::endl;
-
-                            return -1;
-                        }
-
-                        ops.push_back(instruction);
-                        ops.push_back(data);
-                    } else {
-                        std::cerr << "Invalid assembly statement." << std::endl;
-
-                        return -1;
-                    }
-				} if (token == ST_OPCODE_TOKEN) {
-					int instruction, data;
-                    if (tokens >> token) {
-                        std::transform(token.begin(), token.end(), token.begin(), tolower);
-
-                        if (token == REGISTER_A_TOKEN) {
-                            instruction = STA_BASE_OPCODE;
-                        } else if (token == REGISTER_B_TOKEN) {
-                            instruction = STB_BASE_OPCODE;
-                        } else if (token == REGISTER_C_TOKEN) {
-                            instruction = STC_BASE_OPCODE;
-                        } else {
-                            std::cerr << "Invalid register specifier." << std::endl;
-
-                            return -1;
-                        }
-
-                        if (!(tokens >> data)) {
-                            std::cerr << "Invalid immediate value." << std::endl;
-
-                            return -1;
-                        }
-
-                        ops.push_back(instruction);
-                        ops.push_back(data);
-                    } else {
-                        std::cerr << "Invalid assembly statement." << std::endl;
-
-                        return -1;
-                    }
-				} else if (token == JMP_OPCODE_TOKEN) {
-                    int instruction = JMP_BASE_OPCODE;
-
-                    int data;
-                    if (!(tokens >> data)) {
-                        std::cerr << "Invalid relative address." << std::endl;
-                    }
-
-                    ops.push_back(instruction);
-                    ops.push_back(data);
-                } else if (token == INT_OPCODE_TOKEN) {
-                    int instruction = INT_BASE_OPCODE;
-                    
-                    int data;
-                    if (!(tokens >> data)) {
-                        std::cerr << "Invalid interrupt number." << std::endl;
-
-                        return -1;
-                    }
-
-                    ops.push_back(instruction);
-                    ops.push_back(data);
-                }
-            }
-
-            input_file.append(line);
-        }
+    std::vector<Job *> jobs;
+    for (std::vector<std::string>::size_type i = 0; i < paths.size(); i += 2) {
+        Job *job = new Job();
+        job->input_path = paths[i];
+        job->output_path = paths[i + 1];
+        job->succeeded = false;
 
-        if (input_stream.bad()) {
-            std::cerr << "Failed to read the input file." << std::endl;
+        jobs.push_back(job);
+    }
 
-            return -1;
-        }
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    if (thread_count > jobs.size()) {
+        thread_count = static_cast<unsigned int>(jobs.size());
+    }
 
-        output_stream.write(reinterpret_cast<const char *>(&ops[0]), ops.size() * sizeof(int));
+    std::atomic<std::size_t> next_job(0);
 
-        if (output_stream.bad()) {
-            std::cerr << "Failed to write the output file." << std::endl;
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < thread_count; ++i) {
+        workers.push_back(std::thread(AssembleJobs, std::ref(jobs), std::ref(next_job), std::cref(options)));
+    }
 
-            return -1;
+    AssembleJobs(jobs, next_job, options);
+
+    for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+
+    int exit_code = 0;
+    for (std::vector<Job *>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+        if (!(*it)->succeeded) {
+            std::cerr << (*it)->errors.str();
+            exit_code = -1;
         }
-    } else {
-        std::cerr << "The syntax of the command is incorrect." << std::endl <<
-                     " vmasm <input file> <output file>"       << std::endl << std::endl;
 
-        return -1;
+        delete *it;
     }
 
-    return 0;
+    return exit_code;
 }
@@ -0,0 +1,373 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "kernel.h"
+#include "workloads.h"
+
+static const char *JIT_OPTION = "/jit";
+static const char *TIMER_OPTION = "/timer:";
+static const char *CYCLES_OPTION = "/cycles:";
+static const char *REPEAT_OPTION = "/repeat:";
+static const char *MIN_TIME_OPTION = "/mintime:";
+static const char *SEED_OPTION = "/seed:";
+static const char *OUTPUT_OPTION = "/output:";
+static const char *BASELINE_OPTION = "/baseline:";
+static const char *THRESHOLD_OPTION = "/threshold:";
+
+static const vm::CPU::cycle_count_type DEFAULT_CYCLE_LIMIT = 2000000;
+static const double DEFAULT_THRESHOLD = 10.0; // percent
+
+// Runs of a workload are repeated until they add up to this much wall time,
+// the short ones finish in well under a millisecond. Three runs at least
+// give the spread something to go by.
+
+static const unsigned int DEFAULT_REPEAT = 3;
+static const unsigned int DEFAULT_MIN_TIME = 200; // milliseconds
+static const unsigned int MAX_RUNS = 100000;
+
+struct SchedulerName
+{
+    vm::Kernel::Scheduler scheduler;
+    const char *name;
+};
+
+// Same names as the /scheduler: option of vm
+
+static const SchedulerName SCHEDULERS[] = {
+    { vm::Kernel::FirstComeFirstServed, "fcfs" },
+    { vm::Kernel::ShortestJob, "sf" },
+    { vm::Kernel::RoundRobin, "rr" },
+    { vm::Kernel::Priority, "priority" }
+};
+
+struct Result
+{
+    std::string workload;
+    std::string scheduler;
+
+    vm::CPU::cycle_count_type cycles;
+    double wall_seconds;
+
+    unsigned long long page_faults;
+    unsigned long long copy_on_write_faults;
+    unsigned long long context_switches;
+    unsigned long long context_switch_nanoseconds;
+
+    // Between the quartiles of the runs' MIPS, as a percent of the median
+
+    unsigned int runs;
+    double mips_spread;
+
+    double Mips() const { return wall_seconds > 0 ? cycles / wall_seconds / 1e6 : 0; }
+    double PageFaultsPerSecond() const { return wall_seconds > 0 ? page_faults / wall_seconds : 0; }
+    double ContextSwitchNanoseconds() const
+    {
+        return context_switches ? static_cast<double>(context_switch_nanoseconds) / context_switches : 0;
+    }
+};
+
+// Swallows the kernel log while a workload runs. Formatting still happens, so
+// the numbers include what logging costs the kernel, but not the terminal.
+
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) { return c; }
+};
+
+static bool HasPrefix(const std::string &text, const char *prefix)
+{
+    return text.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+static bool FasterRun(const Result &first, const Result &second)
+{
+    return first.wall_seconds < second.wall_seconds;
+}
+
+static bool WriteImages(const vmbench::Workload &workload, std::vector<std::string> &paths)
+{
+    for (std::vector<vm::MMU::ram_type>::size_type i = 0; i < workload.images.size(); ++i) {
+        std::ostringstream path;
+        path << "vmbench_" << workload.name << "_" << i << ".vmexe";
+
+        std::ofstream output(path.str().c_str(), std::ios::out | std::ios::binary);
+        output.write(reinterpret_cast<const char *>(&workload.images[i][0]), workload.images[i].size() * sizeof(int));
+        if (!output) {
+            std::cerr << "Failed to write " << path.str() << "." << std::endl;
+
+            return false;
+        }
+
+        paths.push_back(path.str());
+    }
+
+    return true;
+}
+
+static Result Run(const vmbench::Workload &workload, const std::vector<std::string> &paths,
+                  const SchedulerName &scheduler, const vm::Kernel::Options &options)
+{
+    Result result;
+    result.workload = workload.name;
+    result.scheduler = scheduler.name;
+    result.runs = 1;
+    result.mips_spread = 0;
+
+    NullBuffer null_buffer;
+    std::streambuf *log_buffer = std::cout.rdbuf(&null_buffer);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        vm::Kernel kernel(scheduler.scheduler, paths, options);
+
+        result.cycles = kernel.machine.cpu.cycles;
+        result.page_faults = kernel.statistics.page_faults;
+        result.copy_on_write_faults = kernel.statistics.copy_on_write_faults;
+        result.context_switches = kernel.statistics.context_switches;
+        result.context_switch_nanoseconds = kernel.statistics.context_switch_nanoseconds;
+    }
+    result.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout.rdbuf(log_buffer);
+
+    return result;
+}
+
+// One result per line, so the baseline reader below can stay line based
+
+static void WriteJson(std::ostream &output, const std::vector<Result> &results, const vm::Kernel::Options &options)
+{
+    output << "{" << std::endl;
+    output << "  \"options\": {\"jit\": " << (options.jit ? "true" : "false")
+           << ", \"timer\": " << options.timer_frequency
+           << ", \"cycle_limit\": " << options.cycle_limit << "}," << std::endl;
+    output << "  \"results\": [" << std::endl;
+
+    for (std::vector<Result>::size_type i = 0; i < results.size(); ++i) {
+        const Result &result = results[i];
+
+        char numbers[256];
+        std::sprintf(numbers, "\"wall_seconds\": %.6f, \"mips\": %.3f, \"mips_spread\": %.1f, \"page_faults_per_second\": %.1f, \"context_switch_ns\": %.1f",
+                     result.wall_seconds, result.Mips(), result.mips_spread, result.PageFaultsPerSecond(), result.ContextSwitchNanoseconds());
+
+        output << "    {\"workload\": \"" << result.workload << "\", \"scheduler\": \"" << result.scheduler << "\""
+               << ", \"cycles\": " << result.cycles
+               << ", \"page_faults\": " << result.page_faults
+               << ", \"copy_on_write_faults\": " << result.copy_on_write_faults
+               << ", \"context_switches\": " << result.context_switches
+               << ", \"runs\": " << result.runs
+               << ", " << numbers << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+
+    output << "  ]" << std::endl;
+    output << "}" << std::endl;
+}
+
+static bool ExtractString(const std::string &line, const std::string &key, std::string &value)
+{
+    std::string::size_type position = line.find("\"" + key + "\": \"");
+    if (position == std::string::npos) {
+        return false;
+    }
+
+    position += key.size() + 5;
+    std::string::size_type end = line.find('"', position);
+    if (end == std::string::npos) {
+        return false;
+    }
+
+    value = line.substr(position, end - position);
+
+    return true;
+}
+
+static bool ExtractNumber(const std::string &line, const std::string &key, double &value)
+{
+    std::string::size_type position = line.find("\"" + key + "\": ");
+    if (position == std::string::npos) {
+        return false;
+    }
+
+    value = std::atof(line.c_str() + position + key.size() + 4);
+
+    return true;
+}
+
+// Reads MIPS per workload and scheduler back from a file written by WriteJson
+
+static bool ReadBaseline(const std::string &path, std::map<std::string, double> &baseline)
+{
+    std::ifstream input(path.c_str());
+    if (!input) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(input, line)) {
+        std::string workload, scheduler;
+        double mips = 0;
+
+        if (ExtractString(line, "workload", workload) && ExtractString(line, "scheduler", scheduler) &&
+            ExtractNumber(line, "mips", mips)) {
+            baseline[workload + "/" + scheduler] = mips;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    vm::Kernel::Options options;
+    options.cycle_limit = DEFAULT_CYCLE_LIMIT;
+
+    vmbench::Parameters parameters;
+
+    unsigned int repeat = DEFAULT_REPEAT;
+    unsigned int min_time = DEFAULT_MIN_TIME;
+    std::string output_path;
+    std::string baseline_path;
+    double threshold = DEFAULT_THRESHOLD;
+
+    vm::Jit jit;
+    bool timer_chosen = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument(argv[i]);
+
+        if (argument == JIT_OPTION) {
+            if (jit.IsAvailable()) {
+                options.jit = &jit;
+            } else {
+                std::cerr << "The JIT is not available on this host, interpreting instead." << std::endl;
+            }
+        } else if (HasPrefix(argument, TIMER_OPTION)) {
+            options.timer_frequency = std::atoi(argument.c_str() + std::strlen(TIMER_OPTION));
+            timer_chosen = true;
+        } else if (HasPrefix(argument, CYCLES_OPTION)) {
+            options.cycle_limit = std::strtoull(argument.c_str() + std::strlen(CYCLES_OPTION), NULL, 10);
+        } else if (HasPrefix(argument, REPEAT_OPTION)) {
+            repeat = std::atoi(argument.c_str() + std::strlen(REPEAT_OPTION));
+        } else if (HasPrefix(argument, MIN_TIME_OPTION)) {
+            min_time = std::atoi(argument.c_str() + std::strlen(MIN_TIME_OPTION));
+        } else if (HasPrefix(argument, SEED_OPTION)) {
+            parameters.seed = std::atoi(argument.c_str() + std::strlen(SEED_OPTION));
+        } else if (HasPrefix(argument, OUTPUT_OPTION)) {
+            output_path = argument.substr(std::strlen(OUTPUT_OPTION));
+        } else if (HasPrefix(argument, BASELINE_OPTION)) {
+            baseline_path = argument.substr(std::strlen(BASELINE_OPTION));
+        } else if (HasPrefix(argument, THRESHOLD_OPTION)) {
+            threshold = std::atof(argument.c_str() + std::strlen(THRESHOLD_OPTION));
+        } else {
+            std::cerr << "The syntax of the command is incorrect." << std::endl <<
+                         " vmbench [/jit] [/timer:<cycles>] [/cycles:<limit>] [/repeat:<count>] [/mintime:<ms>]" << std::endl <<
+                         "         [/seed:<seed>] [/output:<file>] [/baseline:<file>] [/threshold:<percent>]" << std::endl << std::endl;
+
+            return -1;
+        }
+    }
+
+    if (repeat == 0) {
+        repeat = 1;
+    }
+
+    // Like vm, the JIT gets a timer period it can run translated code in
+
+    if (options.jit && !timer_chosen) {
+        options.timer_frequency = vm::Jit::DEFAULT_TIMER_PERIOD;
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baseline_path.empty() && !ReadBaseline(baseline_path, baseline)) {
+        std::cerr << "Failed to read the baseline " << baseline_path << "." << std::endl;
+
+        return -1;
+    }
+
+    vmbench::workload_list_type workloads = vmbench::GenerateWorkloads(parameters);
+
+    std::vector<Result> results;
+    for (vmbench::workload_list_type::const_iterator workload = workloads.begin(); workload != workloads.end(); ++workload) {
+        std::vector<std::string> paths;
+        if (!WriteImages(*workload, paths)) {
+            return -1;
+        }
+
+        for (std::size_t i = 0; i < sizeof(SCHEDULERS) / sizeof(SCHEDULERS[0]); ++i) {
+
+            // At least "repeat" runs and "min_time" of them. The median run
+            // stands for all of them, the work is the same every time.
+
+            std::vector<Result> runs;
+            double seconds = 0;
+
+            while (runs.size() < MAX_RUNS && (runs.size() < repeat || seconds * 1000.0 < min_time)) {
+                runs.push_back(Run(*workload, paths, SCHEDULERS[i], options));
+                seconds += runs.back().wall_seconds;
+            }
+
+            std::sort(runs.begin(), runs.end(), FasterRun);
+
+            Result median = runs[runs.size() / 2];
+            median.runs = static_cast<unsigned int>(runs.size());
+            median.mips_spread = median.Mips() > 0 ?
+                (runs[runs.size() / 4].Mips() - runs[runs.size() * 3 / 4].Mips()) / median.Mips() * 100.0 : 0;
+
+            char summary[128];
+            std::sprintf(summary, "%.3f MIPS, spread %.1f%% over %u runs", median.Mips(), median.mips_spread, median.runs);
+
+            std::cerr << workload->name << "/" << SCHEDULERS[i].name << ": " << summary << ", "
+                      << median.page_faults << " faults, " << median.context_switches << " switches" << std::endl;
+
+            results.push_back(median);
+        }
+
+        for (std::vector<std::string>::const_iterator it = paths.begin(); it != paths.end(); ++it) {
+            std::remove(it->c_str());
+        }
+    }
+
+    if (output_path.empty()) {
+        WriteJson(std::cout, results, options);
+    } else {
+        std::ofstream output(output_path.c_str());
+        if (!output) {
+            std::cerr << "Failed to open " << output_path << "." << std::endl;
+
+            return -1;
+        }
+
+        WriteJson(output, results, options);
+    }
+
+    int exit_code = 0;
+    for (std::vector<Result>::const_iterator it = results.begin(); it != results.end(); ++it) {
+        std::map<std::string, double>::const_iterator expected = baseline.find(it->workload + "/" + it->scheduler);
+        if (expected == baseline.end()) {
+            continue;
+        }
+
+        // Closer than the runs are to each other nothing can be told apart
+
+        if (it->mips_spread > threshold) {
+            std::cerr << "Noisy: " << it->workload << "/" << it->scheduler << " spreads by " << it->mips_spread
+                      << "%, more than the threshold, not compared." << std::endl;
+        } else if (it->Mips() < expected->second * (1.0 - threshold / 100.0)) {
+            std::cerr << "Regression: " << it->workload << "/" << it->scheduler << " runs at " << it->Mips()
+                      << " MIPS, the baseline is " << expected->second << " MIPS." << std::endl;
+            exit_code = 1;
+        }
+    }
+
+    return exit_code;
+}
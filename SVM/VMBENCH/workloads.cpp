@@ -0,0 +1,320 @@
+#include "workloads.h"
+#include "cpu.h"
+#include "kernel.h"
+
+namespace vmbench
+{
+    namespace
+    {
+        // Virtual address space as seen by the Verifier: whole pages below
+        // RAM_SIZE. Workloads are laid out for the default page size.
+
+        const vm::MMU::ram_size_type ADDRESS_SPACE_PAGES = vm::MMU::RAM_SIZE / vm::MMU::DEFAULT_PAGE_SIZE;
+
+        void Emit(vm::MMU::ram_type &image, int opcode, int data)
+        {
+            image.push_back(opcode);
+            image.push_back(data);
+        }
+
+        // Jumps are relative to the jump itself
+
+        void EmitJumpTo(vm::MMU::ram_type &image, vm::MMU::ram_size_type target)
+        {
+            Emit(image, vm::CPU::JMP_BASE_OPCODE, static_cast<int>(target) - static_cast<int>(image.size()));
+        }
+
+        int PageAddress(vm::MMU::ram_size_type page, vm::MMU::ram_size_type offset)
+        {
+            return static_cast<int>(page * vm::MMU::DEFAULT_PAGE_SIZE + offset);
+        }
+
+        // Numerical Recipes LCG, good enough to scatter addresses reproducibly
+
+        unsigned int NextRandom(unsigned int &state)
+        {
+            state = state * 1664525u + 1013904223u;
+
+            return state >> 8;
+        }
+    }
+
+    Parameters::Parameters()
+        : seed(1),
+          loop_processes(4), loop_length(32),
+          sweep_processes(2), sweep_pages(32), random_accesses(256),
+          short_lived_processes(64),
+          sparse_processes(8), sparse_pages(48),
+          fork_processes(2), fork_pages(8), fork_depth(3),
+          pipeline_pairs(2), pipeline_items(64),
+          heap_processes(2), heap_rounds(64),
+          large_sweep_pages(3 * vm::MMU::HUGE_PAGE_PAGES) {}
+
+    Workload GenerateRegisterLoop(unsigned int processes, unsigned int length)
+    {
+        Workload workload;
+        workload.name = "register_loop";
+        workload.terminates = false;
+
+        for (unsigned int process = 0; process < processes; ++process) {
+            vm::MMU::ram_type image;
+            for (unsigned int i = 0; i < length; ++i) {
+                Emit(image, vm::CPU::MOVA_BASE_OPCODE + i % 3, static_cast<int>(process * length + i));
+            }
+            EmitJumpTo(image, 0);
+
+            workload.images.push_back(image);
+        }
+
+        return workload;
+    }
+
+    Workload GenerateSequentialSweep(unsigned int processes, unsigned int pages)
+    {
+        Workload workload;
+        workload.name = "sequential_sweep";
+        workload.terminates = false;
+
+        for (unsigned int process = 0; process < processes; ++process) {
+            vm::MMU::ram_type image;
+            Emit(image, vm::CPU::MOVA_BASE_OPCODE, static_cast<int>(process));
+            for (unsigned int page = 0; page < pages; ++page) {
+                Emit(image, vm::CPU::STA_BASE_OPCODE, PageAddress(page, 0));
+                Emit(image, vm::CPU::LDB_BASE_OPCODE, PageAddress(page, 0));
+                Emit(image, vm::CPU::STB_BASE_OPCODE, PageAddress(page, 1));
+            }
+            EmitJumpTo(image, 2);
+
+            workload.images.push_back(image);
+        }
+
+        return workload;
+    }
+
+    Workload GenerateLargeSweep(unsigned int pages)
+    {
+        Workload workload;
+        workload.name = "large_sweep";
+        workload.terminates = true;
+
+        vm::MMU::ram_type image;
+        for (unsigned int page = 0; page < pages; ++page) {
+            Emit(image, vm::CPU::MOVA_BASE_OPCODE, static_cast<int>(page));
+            Emit(image, vm::CPU::STA_BASE_OPCODE, PageAddress(page, page % vm::MMU::DEFAULT_PAGE_SIZE));
+        }
+        Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::EXIT_INTERRUPT);
+
+        workload.images.push_back(image);
+
+        return workload;
+    }
+
+    Workload GenerateRandomSweep(unsigned int processes, unsigned int pages, unsigned int accesses, unsigned int seed)
+    {
+        Workload workload;
+        workload.name = "random_sweep";
+        workload.terminates = false;
+
+        unsigned int state = seed;
+
+        for (unsigned int process = 0; process < processes; ++process) {
+            vm::MMU::ram_type image;
+            for (unsigned int i = 0; i < accesses; ++i) {
+                int address = PageAddress(NextRandom(state) % pages, NextRandom(state) % vm::MMU::DEFAULT_PAGE_SIZE);
+
+                if (NextRandom(state) % 2 == 0) {
+                    Emit(image, vm::CPU::LDA_BASE_OPCODE + i % 3, address);
+                } else {
+                    Emit(image, vm::CPU::STA_BASE_OPCODE + i % 3, address);
+                }
+            }
+            EmitJumpTo(image, 0);
+
+            workload.images.push_back(image);
+        }
+
+        return workload;
+    }
+
+    Workload GenerateShortLived(unsigned int processes)
+    {
+        Workload workload;
+        workload.name = "short_lived";
+        workload.terminates = true;
+
+        for (unsigned int process = 0; process < processes; ++process) {
+            vm::MMU::ram_type image;
+            Emit(image, vm::CPU::MOVA_BASE_OPCODE, static_cast<int>(process));
+            Emit(image, vm::CPU::STA_BASE_OPCODE, PageAddress(0, process % vm::MMU::DEFAULT_PAGE_SIZE));
+            Emit(image, vm::CPU::LDB_BASE_OPCODE, PageAddress(0, process % vm::MMU::DEFAULT_PAGE_SIZE));
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::EXIT_INTERRUPT);
+
+            workload.images.push_back(image);
+        }
+
+        return workload;
+    }
+
+    Workload GenerateSparseFaults(unsigned int processes, unsigned int pages)
+    {
+        Workload workload;
+        workload.name = "sparse_faults";
+        workload.terminates = true;
+
+        vm::MMU::ram_size_type stride = pages ? ADDRESS_SPACE_PAGES / pages : 1;
+        if (stride == 0) {
+            stride = 1;
+        }
+
+        for (unsigned int process = 0; process < processes; ++process) {
+            vm::MMU::ram_type image;
+            Emit(image, vm::CPU::MOVA_BASE_OPCODE, static_cast<int>(process));
+            for (unsigned int i = 0; i < pages; ++i) {
+                Emit(image, vm::CPU::STA_BASE_OPCODE, PageAddress((i * stride + process) % ADDRESS_SPACE_PAGES, i % vm::MMU::DEFAULT_PAGE_SIZE));
+            }
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::EXIT_INTERRUPT);
+
+            workload.images.push_back(image);
+        }
+
+        return workload;
+    }
+
+    Workload GenerateForkFanout(unsigned int processes, unsigned int pages, unsigned int depth)
+    {
+        Workload workload;
+        workload.name = "fork_fanout";
+        workload.terminates = true;
+
+        for (unsigned int process = 0; process < processes; ++process) {
+            vm::MMU::ram_type image;
+            Emit(image, vm::CPU::MOVB_BASE_OPCODE, static_cast<int>(process));
+            for (unsigned int page = 0; page < pages; ++page) {
+                Emit(image, vm::CPU::STB_BASE_OPCODE, PageAddress(page, 0));
+            }
+            for (unsigned int i = 0; i < depth; ++i) {
+                Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::FORK_INTERRUPT);
+            }
+
+            // a holds the fork result, which differs between parent and child
+
+            for (unsigned int page = 0; page < pages; ++page) {
+                Emit(image, vm::CPU::STA_BASE_OPCODE, PageAddress(page, 1));
+            }
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::EXIT_INTERRUPT);
+
+            workload.images.push_back(image);
+        }
+
+        return workload;
+    }
+
+    Workload GenerateSharedPipeline(unsigned int pairs, unsigned int items)
+    {
+        Workload workload;
+        workload.name = "shared_pipeline";
+        workload.terminates = true;
+
+        // Both sides create the segment of their pair before they attach,
+        // whichever of them the scheduler runs first
+
+        const vm::MMU::ram_size_type segment_page = 8;
+
+        for (unsigned int pair = 0; pair < pairs; ++pair) {
+            int key = static_cast<int>(pair + 1);
+
+            vm::MMU::ram_type image;
+            Emit(image, vm::CPU::MOVA_BASE_OPCODE, key);
+            Emit(image, vm::CPU::MOVC_BASE_OPCODE, 1);
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::SEGMENT_CREATE_INTERRUPT);
+            Emit(image, vm::CPU::MOVA_BASE_OPCODE, key);
+            Emit(image, vm::CPU::MOVB_BASE_OPCODE, PageAddress(segment_page, 0));
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::SEGMENT_ATTACH_INTERRUPT);
+            for (unsigned int i = 0; i < items; ++i) {
+                Emit(image, vm::CPU::MOVB_BASE_OPCODE, static_cast<int>(i));
+                Emit(image, vm::CPU::STB_BASE_OPCODE, PageAddress(segment_page, i % vm::MMU::DEFAULT_PAGE_SIZE));
+                Emit(image, vm::CPU::MOVA_BASE_OPCODE, key);
+                Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::SEGMENT_NOTIFY_INTERRUPT);
+            }
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::EXIT_INTERRUPT);
+
+            workload.images.push_back(image);
+        }
+
+        for (unsigned int pair = 0; pair < pairs; ++pair) {
+            int key = static_cast<int>(pair + 1);
+
+            vm::MMU::ram_type image;
+            Emit(image, vm::CPU::MOVA_BASE_OPCODE, key);
+            Emit(image, vm::CPU::MOVC_BASE_OPCODE, 1);
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::SEGMENT_CREATE_INTERRUPT);
+            Emit(image, vm::CPU::MOVA_BASE_OPCODE, key);
+            Emit(image, vm::CPU::MOVB_BASE_OPCODE, PageAddress(segment_page, 0));
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::SEGMENT_ATTACH_INTERRUPT);
+            for (unsigned int i = 0; i < items; ++i) {
+                Emit(image, vm::CPU::MOVA_BASE_OPCODE, key);
+                Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::SEGMENT_WAIT_INTERRUPT);
+                Emit(image, vm::CPU::LDB_BASE_OPCODE, PageAddress(segment_page, i % vm::MMU::DEFAULT_PAGE_SIZE));
+                Emit(image, vm::CPU::STB_BASE_OPCODE, PageAddress(0, i % vm::MMU::DEFAULT_PAGE_SIZE));
+            }
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::EXIT_INTERRUPT);
+
+            workload.images.push_back(image);
+        }
+
+        return workload;
+    }
+
+    Workload GenerateHeapChurn(unsigned int processes, unsigned int rounds)
+    {
+        Workload workload;
+        workload.name = "heap_churn";
+        workload.terminates = true;
+
+        const int sizes[] = { 8, 16, 32, 64, 200 };
+        const unsigned int size_count = sizeof(sizes) / sizeof(sizes[0]);
+
+        // fill advances a, so the pointer is kept in the first page
+
+        const int pointer_address = PageAddress(0, 0);
+
+        for (unsigned int process = 0; process < processes; ++process) {
+            vm::MMU::ram_type image;
+            for (unsigned int round = 0; round < rounds; ++round) {
+                int size = sizes[(round + process) % size_count];
+
+                Emit(image, vm::CPU::MOVA_BASE_OPCODE, size);
+                Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::HEAP_ALLOCATE_INTERRUPT);
+                Emit(image, vm::CPU::STA_BASE_OPCODE, pointer_address);
+                Emit(image, vm::CPU::MOVB_BASE_OPCODE, static_cast<int>(round));
+                Emit(image, vm::CPU::MOVC_BASE_OPCODE, size);
+                Emit(image, vm::CPU::FILL_OPCODE, 0);
+                Emit(image, vm::CPU::LDA_BASE_OPCODE, pointer_address);
+                Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::HEAP_FREE_INTERRUPT);
+            }
+            Emit(image, vm::CPU::INT_BASE_OPCODE, vm::Kernel::EXIT_INTERRUPT);
+
+            workload.images.push_back(image);
+        }
+
+        return workload;
+    }
+
+    workload_list_type GenerateWorkloads(const Parameters &parameters)
+    {
+        workload_list_type workloads;
+
+        workloads.push_back(GenerateRegisterLoop(parameters.loop_processes, parameters.loop_length));
+        workloads.push_back(GenerateSequentialSweep(parameters.sweep_processes, parameters.sweep_pages));
+        workloads.push_back(GenerateLargeSweep(parameters.large_sweep_pages));
+        workloads.push_back(GenerateRandomSweep(parameters.sweep_processes, parameters.sweep_pages,
+                                                parameters.random_accesses, parameters.seed));
+        workloads.push_back(GenerateShortLived(parameters.short_lived_processes));
+        workloads.push_back(GenerateSparseFaults(parameters.sparse_processes, parameters.sparse_pages));
+        workloads.push_back(GenerateForkFanout(parameters.fork_processes, parameters.fork_pages, parameters.fork_depth));
+        workloads.push_back(GenerateSharedPipeline(parameters.pipeline_pairs, parameters.pipeline_items));
+        workloads.push_back(GenerateHeapChurn(parameters.heap_processes, parameters.heap_rounds));
+
+        return workloads;
+    }
+}
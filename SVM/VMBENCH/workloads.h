@@ -0,0 +1,91 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include <string>
+#include <vector>
+
+#include "mmu.h"
+
+namespace vmbench
+{
+    // A named set of guest images that run together on one machine. Images
+    // are generated in memory, so every run of the suite sees the same code.
+    struct Workload
+    {
+        std::string name;
+        std::vector<vm::MMU::ram_type> images;
+
+        // Workloads that loop forever are stopped by the cycle limit
+
+        bool terminates;
+    };
+
+    typedef std::vector<Workload> workload_list_type;
+
+    struct Parameters
+    {
+        unsigned int seed;
+
+        unsigned int loop_processes;
+        unsigned int loop_length;
+
+        unsigned int sweep_processes;
+        unsigned int sweep_pages;
+        unsigned int random_accesses;
+
+        unsigned int short_lived_processes;
+
+        unsigned int sparse_processes;
+        unsigned int sparse_pages;
+
+        unsigned int fork_processes;
+        unsigned int fork_pages;
+        unsigned int fork_depth;
+
+        unsigned int pipeline_pairs;
+        unsigned int pipeline_items;
+
+        unsigned int heap_processes;
+        unsigned int heap_rounds;
+
+        unsigned int large_sweep_pages;
+
+        Parameters();
+    };
+
+    // mov a/b/c in a loop, no memory traffic at all
+    Workload GenerateRegisterLoop(unsigned int processes, unsigned int length);
+
+    // ld/st over the first "pages" pages, in order
+    Workload GenerateSequentialSweep(unsigned int processes, unsigned int pages);
+
+    // One process storing once to each of the first "pages" pages, in order,
+    // so that filled regions become huge pages
+    Workload GenerateLargeSweep(unsigned int pages);
+
+    // ld/st at random addresses within the first "pages" pages
+    Workload GenerateRandomSweep(unsigned int processes, unsigned int pages, unsigned int accesses, unsigned int seed);
+
+    // Many processes that touch one page and exit straight away
+    Workload GenerateShortLived(unsigned int processes);
+
+    // Processes that store once to each of "pages" pages spread over the whole
+    // address space and exit, so nearly every access faults
+    Workload GenerateSparseFaults(unsigned int processes, unsigned int pages);
+
+    // Processes that fill "pages" pages, fork "depth" times in a row and then
+    // all write the pages again, so every child copies them on write
+    Workload GenerateForkFanout(unsigned int processes, unsigned int pages, unsigned int depth);
+
+    // Producer and consumer pairs handing "items" words over a shared memory
+    // segment, one notification per word
+    Workload GenerateSharedPipeline(unsigned int pairs, unsigned int items);
+
+    // Processes that allocate, fill and free heap memory "rounds" times,
+    // cycling through the size classes and one request over a page
+    Workload GenerateHeapChurn(unsigned int processes, unsigned int rounds);
+
+    workload_list_type GenerateWorkloads(const Parameters &parameters);
+}
+
+#endif
@@ -0,0 +1,419 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "kernel.h"
+
+static const char *BATCHES_OPTION = "/batches:";
+static const char *SEED_OPTION = "/seed:";
+
+static const unsigned int DEFAULT_BATCHES = 1000;
+static const unsigned int DEFAULT_SEED = 1;
+
+// Frames or blocks held at once by one batch of the allocation benchmarks
+
+static const unsigned int FRAMES_PER_BATCH = 64;
+static const unsigned int BLOCKS_PER_BATCH = 32;
+static const unsigned int MAX_BLOCK_PAGES = 8;
+
+// Pages at the start of a list that the fragmented benchmarks turn into one
+// page holes, the rest stays free for larger blocks
+
+static const unsigned int FRAGMENTED_PAGES = 192;
+
+static const unsigned int LOOKUPS_PER_BATCH = 256;
+static const unsigned int SWITCHES_PER_BATCH = 256;
+
+// Every heap allocation made by the process goes through here, so the
+// benchmarks can report how many allocations one operation costs
+
+static unsigned long long allocation_count = 0;
+
+void *operator new(std::size_t size)
+{
+    ++allocation_count;
+
+    void *memory = std::malloc(size ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+
+    return memory;
+}
+
+void operator delete(void *memory) throw()
+{
+    std::free(memory);
+}
+
+// C++14 compilers call the sized form, which has to pair with the operator new
+// above as well
+
+void operator delete(void *memory, std::size_t) throw()
+{
+    std::free(memory);
+}
+
+struct Measurement
+{
+    std::string name;
+
+    unsigned long long operations;
+    unsigned long long allocations;
+    double nanoseconds;
+
+    // Average latency of one operation in each batch, sorted
+
+    std::vector<double> batch_latencies;
+
+    double Percentile(double percent) const
+    {
+        if (batch_latencies.empty()) {
+            return 0;
+        }
+
+        std::vector<double>::size_type index = static_cast<std::vector<double>::size_type>(percent / 100.0 * (batch_latencies.size() - 1) + 0.5);
+
+        return batch_latencies[index];
+    }
+};
+
+// Runs "batches" batches of "operations" operations each. "prepare" runs
+// untimed before every batch, "run" is the timed part.
+
+template <typename Prepare, typename Run>
+static Measurement Measure(const char *name, unsigned int batches, unsigned int operations, Prepare prepare, Run run)
+{
+    Measurement measurement;
+    measurement.name = name;
+    measurement.operations = 0;
+    measurement.allocations = 0;
+    measurement.nanoseconds = 0;
+    measurement.batch_latencies.reserve(batches);
+
+    for (unsigned int batch = 0; batch < batches; ++batch) {
+        prepare();
+
+        unsigned long long allocations = allocation_count;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        run();
+
+        double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        measurement.allocations += allocation_count - allocations;
+
+        measurement.operations += operations;
+        measurement.nanoseconds += nanoseconds;
+        measurement.batch_latencies.push_back(nanoseconds / operations);
+    }
+
+    std::sort(measurement.batch_latencies.begin(), measurement.batch_latencies.end());
+
+    return measurement;
+}
+
+// Fisher-Yates on top of mt19937 rather than std::shuffle, whose output is
+// left to the library and would differ between toolchains
+
+template <typename T>
+static void Shuffle(std::vector<T> &values, std::mt19937 &random)
+{
+    for (typename std::vector<T>::size_type i = values.size(); i > 1; --i) {
+        std::swap(values[i - 1], values[random() % i]);
+    }
+}
+
+enum ReleaseOrder
+{
+    SameOrder, ReverseOrder, RandomOrder
+};
+
+static void Order(std::vector<unsigned int> &order, ReleaseOrder release_order, std::mt19937 &random)
+{
+    for (std::vector<unsigned int>::size_type i = 0; i < order.size(); ++i) {
+        order[i] = static_cast<unsigned int>(release_order == ReverseOrder ? order.size() - 1 - i : i);
+    }
+
+    if (release_order == RandomOrder) {
+        Shuffle(order, random);
+    }
+}
+
+// Holds every other one of the first frames, so that the free list starts
+// with a chain of one frame holes
+
+static void FragmentFrames(vm::MMU &mmu, std::vector<vm::MMU::page_entry_type> &held)
+{
+    std::vector<vm::MMU::page_entry_type> frames;
+    for (unsigned int i = 0; i < FRAGMENTED_PAGES; ++i) {
+        frames.push_back(mmu.AcquireFrame());
+    }
+
+    for (std::vector<vm::MMU::page_entry_type>::size_type i = 0; i < frames.size(); ++i) {
+        if (i % 2) {
+            mmu.ReleaseFrame(frames[i]);
+        } else {
+            held.push_back(frames[i]);
+        }
+    }
+}
+
+// Released frames are dirty, so every batch after the first clears them on
+// acquisition, unless "zeroed" fills the zeroed pool ahead of it untimed
+
+static Measurement MeasureFrames(const char *name, unsigned int batches, std::mt19937 &random,
+                                 ReleaseOrder release_order, bool fragmented, bool zeroed)
+{
+    vm::MMU mmu;
+
+    std::vector<vm::MMU::page_entry_type> held;
+    if (fragmented) {
+        FragmentFrames(mmu, held);
+    }
+
+    std::vector<vm::MMU::page_entry_type> frames(FRAMES_PER_BATCH);
+    std::vector<unsigned int> order(FRAMES_PER_BATCH);
+
+    return Measure(name, batches, FRAMES_PER_BATCH * 2,
+        [&]() {
+            Order(order, release_order, random);
+            if (zeroed) {
+                mmu.ZeroFrames(FRAMES_PER_BATCH);
+            }
+        },
+        [&]() {
+            for (unsigned int i = 0; i < FRAMES_PER_BATCH; ++i) {
+                frames[i] = mmu.AcquireFrame();
+            }
+            for (unsigned int i = 0; i < FRAMES_PER_BATCH; ++i) {
+                mmu.ReleaseFrame(frames[order[i]]);
+            }
+        });
+}
+
+// The frames of an exiting process, released in one batch
+
+static Measurement MeasureBatchRelease(unsigned int batches, std::mt19937 &random)
+{
+    vm::MMU mmu;
+
+    std::vector<vm::MMU::page_entry_type> frames(FRAMES_PER_BATCH);
+    std::vector<vm::MMU::page_entry_type> released(FRAMES_PER_BATCH);
+    std::vector<unsigned int> order(FRAMES_PER_BATCH);
+
+    return Measure("frames/batch_release", batches, FRAMES_PER_BATCH * 2,
+        [&]() {
+            Order(order, RandomOrder, random);
+        },
+        [&]() {
+            for (unsigned int i = 0; i < FRAMES_PER_BATCH; ++i) {
+                frames[i] = mmu.AcquireFrame();
+            }
+            for (unsigned int i = 0; i < FRAMES_PER_BATCH; ++i) {
+                released[i] = frames[order[i]];
+            }
+            mmu.ReleaseFrames(released);
+        });
+}
+
+// Kernel::AllocateMemory and FreeMemory over the frame list, or over the
+// virtual block list of "process" when one is given
+
+static Measurement MeasureMemory(const char *name, unsigned int batches, std::mt19937 &random, vm::Kernel &kernel,
+                                 vm::Process *process, ReleaseOrder release_order, bool fragmented)
+{
+    std::vector<vm::MMU::ram_size_type> held;
+    if (fragmented) {
+        for (unsigned int i = 0; i < FRAGMENTED_PAGES; ++i) {
+            held.push_back(kernel.AllocateMemory(kernel.machine.mmu.GetPageSize(), process));
+        }
+
+        std::vector<vm::MMU::ram_size_type> kept;
+        for (std::vector<vm::MMU::ram_size_type>::size_type i = 0; i < held.size(); ++i) {
+            if (i % 2) {
+                kernel.FreeMemory(held[i], process);
+            } else {
+                kept.push_back(held[i]);
+            }
+        }
+        held.swap(kept);
+    }
+
+    std::vector<vm::MMU::ram_size_type> sizes(BLOCKS_PER_BATCH);
+    std::vector<vm::MMU::ram_size_type> blocks(BLOCKS_PER_BATCH);
+    std::vector<unsigned int> order(BLOCKS_PER_BATCH);
+
+    // On a fragmented list only single pages fit into the holes, larger
+    // blocks come from the tail
+
+    Measurement measurement = Measure(name, batches, BLOCKS_PER_BATCH * 2,
+        [&]() {
+            for (unsigned int i = 0; i < BLOCKS_PER_BATCH; ++i) {
+                sizes[i] = (random() % MAX_BLOCK_PAGES + 1) * kernel.machine.mmu.GetPageSize();
+            }
+            Order(order, release_order, random);
+        },
+        [&]() {
+            for (unsigned int i = 0; i < BLOCKS_PER_BATCH; ++i) {
+                blocks[i] = kernel.AllocateMemory(sizes[i], process);
+            }
+            for (unsigned int i = 0; i < BLOCKS_PER_BATCH; ++i) {
+                kernel.FreeMemory(blocks[order[i]], process);
+            }
+        });
+
+    for (std::vector<vm::MMU::ram_size_type>::const_iterator it = held.begin(); it != held.end(); ++it) {
+        kernel.FreeMemory(*it, process);
+    }
+
+    return measurement;
+}
+
+// GetPageIndexAndOffsetForVirtualAddress and the page table lookup behind
+// every guest load and store, over a fully mapped address space
+
+static Measurement MeasureTranslation(unsigned int batches, std::mt19937 &random)
+{
+    vm::MMU mmu;
+    vm::MMU::page_table_type *page_table = mmu.CreateEmptyPageTable();
+    for (vm::MMU::page_table_size_type page = 0; page < page_table->size(); ++page) {
+        (*page_table)[page] = mmu.GetPageSize() * (1 + page % (mmu.GetFrameCount() - 1));
+    }
+    mmu.page_table = page_table;
+
+    std::vector<vm::MMU::vmem_size_type> addresses(LOOKUPS_PER_BATCH);
+    volatile int sink = 0;
+
+    Measurement measurement = Measure("translate", batches, LOOKUPS_PER_BATCH,
+        [&]() {
+            for (unsigned int i = 0; i < LOOKUPS_PER_BATCH; ++i) {
+                addresses[i] = random() % (page_table->size() * mmu.GetPageSize());
+            }
+        },
+        [&]() {
+            int sum = 0;
+            for (unsigned int i = 0; i < LOOKUPS_PER_BATCH; ++i) {
+                vm::MMU::page_index_offset_pair_type pair = mmu.GetPageIndexAndOffsetForVirtualAddress(addresses[i]);
+                sum += mmu.ram[(*mmu.page_table)[pair.first] + pair.second];
+            }
+            sink = sink + sum;
+        });
+
+    delete page_table;
+
+    return measurement;
+}
+
+// Kernel::SwitchToProcess, the switch the round robin timer handler does on
+// preemption, without the logging around it
+
+static Measurement MeasureContextSwitch(unsigned int batches, vm::Kernel &kernel)
+{
+    kernel.processes.push_back(vm::Process(1, 0, 0, kernel.machine.mmu));
+    kernel.processes.push_back(vm::Process(2, 0, 0, kernel.machine.mmu));
+
+    vm::Kernel::process_list_type::size_type current = 0;
+
+    Measurement measurement = Measure("context_switch", batches, SWITCHES_PER_BATCH,
+        [&]() {},
+        [&]() {
+            for (unsigned int i = 0; i < SWITCHES_PER_BATCH; ++i) {
+                current = (current + 1) % kernel.processes.size();
+
+                kernel.SwitchToProcess(current, true);
+            }
+        });
+
+    kernel.processes.clear();
+
+    return measurement;
+}
+
+static bool HasPrefix(const std::string &text, const char *prefix)
+{
+    return text.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int batches = DEFAULT_BATCHES;
+    unsigned int seed = DEFAULT_SEED;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument(argv[i]);
+
+        if (HasPrefix(argument, BATCHES_OPTION)) {
+            batches = std::atoi(argument.c_str() + std::strlen(BATCHES_OPTION));
+        } else if (HasPrefix(argument, SEED_OPTION)) {
+            seed = std::atoi(argument.c_str() + std::strlen(SEED_OPTION));
+        } else {
+            std::cerr << "The syntax of the command is incorrect." << std::endl <<
+                         " vmmicro [/batches:<count>] [/seed:<seed>]" << std::endl << std::endl;
+
+            return -1;
+        }
+    }
+
+    if (batches == 0) {
+        batches = 1;
+    }
+
+    // Every benchmark starts from the same seed, so adding or reordering
+    // benchmarks does not change the input of the others
+
+    std::vector<Measurement> measurements;
+    std::mt19937 random;
+
+    random.seed(seed);
+    measurements.push_back(MeasureFrames("frames/same_order", batches, random, SameOrder, false, false));
+    random.seed(seed);
+    measurements.push_back(MeasureFrames("frames/reverse_order", batches, random, ReverseOrder, false, false));
+    random.seed(seed);
+    measurements.push_back(MeasureFrames("frames/random_order", batches, random, RandomOrder, false, false));
+    random.seed(seed);
+    measurements.push_back(MeasureFrames("frames/fragmented", batches, random, RandomOrder, true, false));
+    random.seed(seed);
+    measurements.push_back(MeasureFrames("frames/zeroed", batches, random, RandomOrder, false, true));
+    random.seed(seed);
+    measurements.push_back(MeasureBatchRelease(batches, random));
+
+    {
+        vm::Kernel::Options options;
+        options.start_machine = false;
+
+        vm::Kernel kernel(vm::Kernel::RoundRobin, std::vector<std::string>(), options);
+
+        random.seed(seed);
+        measurements.push_back(MeasureMemory("memory/same_order", batches, random, kernel, NULL, SameOrder, false));
+        random.seed(seed);
+        measurements.push_back(MeasureMemory("memory/random_order", batches, random, kernel, NULL, RandomOrder, false));
+        random.seed(seed);
+        measurements.push_back(MeasureMemory("memory/fragmented", batches, random, kernel, NULL, RandomOrder, true));
+
+        vm::Process process(1, 0, 0, kernel.machine.mmu);
+        random.seed(seed);
+        measurements.push_back(MeasureMemory("memory/process", batches, random, kernel, &process, RandomOrder, false));
+
+        random.seed(seed);
+        measurements.push_back(MeasureTranslation(batches, random));
+
+        measurements.push_back(MeasureContextSwitch(batches, kernel));
+    }
+
+    std::printf("%-22s %10s %10s %10s %10s %10s %10s\n", "benchmark", "ns/op", "allocs/op", "p50", "p90", "p99", "max");
+    for (std::vector<Measurement>::const_iterator it = measurements.begin(); it != measurements.end(); ++it) {
+        std::printf("%-22s %10.1f %10.3f %10.1f %10.1f %10.1f %10.1f\n", it->name.c_str(),
+                    it->nanoseconds / it->operations,
+                    static_cast<double>(it->allocations) / it->operations,
+                    it->Percentile(50), it->Percentile(90), it->Percentile(99), it->Percentile(100));
+    }
+
+    return 0;
+}
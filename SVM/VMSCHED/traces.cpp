@@ -0,0 +1,201 @@
+#include "traces.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace vmsched
+{
+    namespace
+    {
+        const char *const BURST_PREFIX = "burst:";
+
+        // Generated programs store within the pages of the default page size
+
+        const vm::MMU::ram_size_type ADDRESS_SPACE_PAGES = vm::MMU::RAM_SIZE / vm::MMU::DEFAULT_PAGE_SIZE;
+
+        void Emit(vm::MMU::ram_type &image, int opcode, int data)
+        {
+            image.push_back(opcode);
+            image.push_back(data);
+        }
+
+        // Numerical Recipes LCG, the same on every toolchain
+
+        unsigned int NextRandom(unsigned int &state)
+        {
+            state = state * 1664525u + 1013904223u;
+
+            return state >> 8;
+        }
+
+        // Uniform in (0, 1]
+
+        double NextUniform(unsigned int &state)
+        {
+            return (NextRandom(state) + 1.0) / 16777216.0;
+        }
+
+        unsigned int Scatter(unsigned int size, unsigned int &state)
+        {
+            unsigned int low = size - size / 2;
+
+            return low + NextRandom(state) % (size + 1);
+        }
+
+        bool EntryBefore(const vm::Kernel::Arrival &first, const vm::Kernel::Arrival &second)
+        {
+            return first.cycle < second.cycle;
+        }
+    }
+
+    TraceEntry::TraceEntry()
+        : cycle(0), priority(0), program() {}
+
+    SyntheticParameters::SyntheticParameters()
+        : seed(1), processes(64), mean_interarrival(600),
+          short_burst(200), long_burst(2000), long_percent(20),
+          pages(4), priorities(4) {}
+
+    bool ReadTrace(const std::string &path, trace_type &trace)
+    {
+        std::ifstream input(path.c_str());
+        if (!input) {
+            std::cerr << "Failed to open the trace " << path << "." << std::endl;
+
+            return false;
+        }
+
+        std::string line;
+        for (unsigned int number = 1; std::getline(input, line); ++number) {
+            std::string::size_type comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.erase(comment);
+            }
+
+            std::istringstream stream(line);
+
+            TraceEntry entry;
+            unsigned long priority = 0;
+
+            if (!(stream >> entry.cycle)) {
+                if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                    continue;
+                }
+            } else if (stream >> priority >> entry.program) {
+                entry.priority = static_cast<vm::Process::process_priority_type>(priority);
+                trace.push_back(entry);
+
+                continue;
+            }
+
+            std::cerr << path << "(" << number << "): expected \"cycle priority program\"." << std::endl;
+
+            return false;
+        }
+
+        return true;
+    }
+
+    void WriteTrace(std::ostream &output, const trace_type &trace)
+    {
+        output << "# cycle priority program" << std::endl;
+
+        for (trace_type::const_iterator it = trace.begin(); it != trace.end(); ++it) {
+            output << it->cycle << " " << it->priority << " " << it->program << std::endl;
+        }
+    }
+
+    trace_type GenerateTrace(const SyntheticParameters &parameters)
+    {
+        trace_type trace;
+        unsigned int state = parameters.seed;
+
+        vm::CPU::cycle_count_type cycle = 0;
+        for (unsigned int i = 0; i < parameters.processes; ++i) {
+            if (i > 0) {
+                cycle += static_cast<vm::CPU::cycle_count_type>(-std::log(NextUniform(state)) * parameters.mean_interarrival);
+            }
+
+            bool long_burst = NextRandom(state) % 100 < parameters.long_percent;
+            unsigned int instructions = Scatter(long_burst ? parameters.long_burst : parameters.short_burst, state);
+
+            std::ostringstream program;
+            program << BURST_PREFIX << instructions << ":" << parameters.pages;
+
+            TraceEntry entry;
+            entry.cycle = cycle;
+            entry.priority = static_cast<vm::Process::process_priority_type>(
+                parameters.priorities ? NextRandom(state) % parameters.priorities : 0);
+            entry.program = program.str();
+
+            trace.push_back(entry);
+        }
+
+        return trace;
+    }
+
+    // mov and st in turns, the first stores each touching a new page, and an
+    // exit at the end
+
+    vm::MMU::ram_type GenerateBurst(unsigned int instructions, unsigned int pages)
+    {
+        pages = std::max(1u, std::min(pages, static_cast<unsigned int>(ADDRESS_SPACE_PAGES)));
+        instructions = std::max(instructions, 1u);
+
+        vm::MMU::ram_type image;
+        image.reserve(instructions * 2);
+
+        for (unsigned int i = 0; i + 1 < instructions; ++i) {
+            unsigned int store = i / 2;
+
+            if (i % 2 == 0) {
+                Emit(image, vm::Opcodes::MOVA_BASE_OPCODE, static_cast<int>(store));
+            } else {
+                vm::MMU::ram_size_type page = store % pages;
+                vm::MMU::ram_size_type offset = store / pages % vm::MMU::DEFAULT_PAGE_SIZE;
+
+                Emit(image, vm::Opcodes::STA_BASE_OPCODE, static_cast<int>(page * vm::MMU::DEFAULT_PAGE_SIZE + offset));
+            }
+        }
+
+        Emit(image, vm::Opcodes::INT_BASE_OPCODE, vm::Kernel::EXIT_INTERRUPT);
+
+        return image;
+    }
+
+    bool BuildArrivals(const trace_type &trace, vm::Kernel::arrival_list_type &arrivals)
+    {
+        arrivals.clear();
+
+        for (trace_type::const_iterator it = trace.begin(); it != trace.end(); ++it) {
+            vm::Kernel::Arrival arrival;
+            arrival.cycle = it->cycle;
+            arrival.name = it->program;
+            arrival.priority = it->priority;
+
+            if (it->program.compare(0, std::strlen(BURST_PREFIX), BURST_PREFIX) == 0) {
+                const char *size = it->program.c_str() + std::strlen(BURST_PREFIX);
+
+                char *end = NULL;
+                unsigned long instructions = std::strtoul(size, &end, 10);
+                unsigned long pages = *end == ':' ? std::strtoul(end + 1, NULL, 10) : 1;
+
+                arrival.image = GenerateBurst(static_cast<unsigned int>(instructions), static_cast<unsigned int>(pages));
+            } else if (!vm::Kernel::ReadProgram(it->program, arrival.image)) {
+                std::cerr << "Failed to read " << it->program << "." << std::endl;
+
+                return false;
+            }
+
+            arrivals.push_back(arrival);
+        }
+
+        std::stable_sort(arrivals.begin(), arrivals.end(), EntryBefore);
+
+        return true;
+    }
+}
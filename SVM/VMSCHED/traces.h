@@ -0,0 +1,62 @@
+#ifndef TRACES_H
+#define TRACES_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "kernel.h"
+
+namespace vmsched
+{
+    // One arrival of an arrival trace. The program is an executable on the
+    // host, or "burst:<instructions>[:<pages>]" for a generated one that
+    // runs that many instructions, storing over "pages" pages, and exits.
+    struct TraceEntry
+    {
+        vm::CPU::cycle_count_type cycle;
+        vm::Process::process_priority_type priority;
+        std::string program;
+
+        TraceEntry();
+    };
+
+    typedef std::vector<TraceEntry> trace_type;
+
+    // Arrivals come at exponentially distributed intervals. Bursts are short
+    // or, "long_percent" of the time, long, both within half of their size
+    // either way.
+    struct SyntheticParameters
+    {
+        unsigned int seed;
+
+        unsigned int processes;
+        unsigned int mean_interarrival;
+
+        unsigned int short_burst;
+        unsigned int long_burst;
+        unsigned int long_percent;
+
+        unsigned int pages;
+        unsigned int priorities;
+
+        SyntheticParameters();
+    };
+
+    // Trace files hold one "cycle priority program" line per arrival, # starts
+    // a comment. Entries may come in any order.
+
+    bool ReadTrace(const std::string &path, trace_type &trace);
+    void WriteTrace(std::ostream &output, const trace_type &trace);
+
+    trace_type GenerateTrace(const SyntheticParameters &parameters);
+
+    vm::MMU::ram_type GenerateBurst(unsigned int instructions, unsigned int pages);
+
+    // Loads or generates every program, and orders the arrivals by cycle.
+    // Arrivals in the same cycle keep their order in the trace.
+
+    bool BuildArrivals(const trace_type &trace, vm::Kernel::arrival_list_type &arrivals);
+}
+
+#endif
@@ -0,0 +1,400 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "kernel.h"
+#include "traces.h"
+
+static const char *TRACE_OPTION = "/trace:";
+static const char *SAVE_OPTION = "/save:";
+static const char *SEED_OPTION = "/seed:";
+static const char *PROCESSES_OPTION = "/processes:";
+static const char *INTERARRIVAL_OPTION = "/interarrival:";
+static const char *SCHEDULERS_OPTION = "/schedulers:";
+static const char *QUANTA_OPTION = "/quanta:";
+static const char *TIMER_OPTION = "/timer:";
+static const char *CYCLES_OPTION = "/cycles:";
+static const char *THREADS_OPTION = "/threads:";
+static const char *OUTPUT_OPTION = "/output:";
+
+static const vm::CPU::cycle_count_type DEFAULT_CYCLE_LIMIT = 50000000;
+static const char *DEFAULT_QUANTA = "1,2,5,10,20";
+
+struct SchedulerName
+{
+    vm::Kernel::Scheduler scheduler;
+    const char *name;
+};
+
+// Same names as the /scheduler: option of vm
+
+static const SchedulerName SCHEDULERS[] = {
+    { vm::Kernel::FirstComeFirstServed, "fcfs" },
+    { vm::Kernel::ShortestJob, "sf" },
+    { vm::Kernel::RoundRobin, "rr" },
+    { vm::Kernel::Priority, "priority" }
+};
+
+// One point of the sweep. Only round robin preempts, the other policies run
+// once with the default quantum.
+
+struct Setting
+{
+    const SchedulerName *scheduler;
+    unsigned int quantum;
+};
+
+struct Result
+{
+    Setting setting;
+
+    std::size_t arrivals;
+    std::size_t completed;
+
+    vm::CPU::cycle_count_type cycles;
+    vm::CPU::cycle_count_type idle_cycles;
+
+    double mean_turnaround;
+    vm::CPU::cycle_count_type p99_turnaround;
+    double mean_waiting;
+    vm::CPU::cycle_count_type p99_waiting;
+
+    unsigned long long context_switches;
+
+    // Processes completed per thousand cycles
+
+    double Throughput() const { return cycles ? completed * 1000.0 / cycles : 0; }
+    double Utilisation() const { return cycles ? static_cast<double>(cycles - idle_cycles) / cycles : 0; }
+};
+
+// Swallows the kernel log of every run, the runs share std::cout
+
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) { return c; }
+};
+
+static bool HasPrefix(const std::string &text, const char *prefix)
+{
+    return text.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+static bool ParseList(const std::string &text, std::vector<std::string> &items)
+{
+    std::istringstream stream(text);
+
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty()) {
+            return false;
+        }
+
+        items.push_back(item);
+    }
+
+    return !items.empty();
+}
+
+// Nearest rank, over values sorted in ascending order
+
+static vm::CPU::cycle_count_type Percentile(const std::vector<vm::CPU::cycle_count_type> &sorted, unsigned int percent)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    std::size_t rank = (sorted.size() * percent + 99) / 100;
+
+    return sorted[std::max<std::size_t>(rank, 1) - 1];
+}
+
+static double Mean(const std::vector<vm::CPU::cycle_count_type> &values)
+{
+    if (values.empty()) {
+        return 0;
+    }
+
+    double sum = 0;
+    for (std::vector<vm::CPU::cycle_count_type>::const_iterator it = values.begin(); it != values.end(); ++it) {
+        sum += static_cast<double>(*it);
+    }
+
+    return sum / values.size();
+}
+
+// The runs are deterministic: arrivals are taken on timer ticks, which come
+// at fixed cycles, and the JIT is left out
+
+static Result Run(const Setting &setting, const vm::Kernel::Options &base_options)
+{
+    vm::Kernel::Options options = base_options;
+    options.quantum = setting.quantum;
+    options.record_processes = true;
+
+    Result result;
+    result.setting = setting;
+    result.arrivals = options.arrivals.size();
+
+    std::vector<vm::CPU::cycle_count_type> turnarounds;
+    std::vector<vm::CPU::cycle_count_type> waits;
+
+    {
+        vm::Kernel kernel(setting.scheduler->scheduler, std::vector<std::string>(), options);
+
+        result.cycles = kernel.machine.cpu.cycles;
+        result.idle_cycles = kernel.statistics.idle_cycles;
+        result.context_switches = kernel.statistics.context_switches;
+
+        for (vm::Kernel::process_record_list_type::const_iterator it = kernel.records.begin(); it != kernel.records.end(); ++it) {
+            vm::CPU::cycle_count_type turnaround = it->exit_cycle - it->arrival_cycle;
+
+            turnarounds.push_back(turnaround);
+            waits.push_back(turnaround - std::min(turnaround, it->run_cycles));
+        }
+    }
+
+    std::sort(turnarounds.begin(), turnarounds.end());
+    std::sort(waits.begin(), waits.end());
+
+    result.completed = turnarounds.size();
+    result.mean_turnaround = Mean(turnarounds);
+    result.p99_turnaround = Percentile(turnarounds, 99);
+    result.mean_waiting = Mean(waits);
+    result.p99_waiting = Percentile(waits, 99);
+
+    return result;
+}
+
+// Every host thread takes the next setting until none are left. Results keep
+// the order of the settings, whichever thread ran them.
+
+static void RunAll(const std::vector<Setting> &settings, const vm::Kernel::Options &options,
+                   unsigned int thread_count, std::vector<Result> &results)
+{
+    results.resize(settings.size());
+
+    std::atomic<std::size_t> next(0);
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < std::min<std::size_t>(thread_count, settings.size()); ++i) {
+        threads.push_back(std::thread([&]() {
+            for (std::size_t index = next++; index < settings.size(); index = next++) {
+                results[index] = Run(settings[index], options);
+            }
+        }));
+    }
+
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+}
+
+static void WriteTable(std::ostream &output, const std::vector<Result> &results)
+{
+    output << "scheduler quantum completed   cycles throughput turnaround      p99    waiting      p99 switches utilisation" << std::endl;
+
+    for (std::vector<Result>::const_iterator it = results.begin(); it != results.end(); ++it) {
+        char line[256];
+        std::sprintf(line, "%-9s %7u %5u/%-4u %8llu %10.3f %10.1f %8llu %10.1f %8llu %8llu %10.1f%%",
+                     it->setting.scheduler->name, it->setting.quantum,
+                     static_cast<unsigned int>(it->completed), static_cast<unsigned int>(it->arrivals),
+                     it->cycles, it->Throughput(), it->mean_turnaround, it->p99_turnaround,
+                     it->mean_waiting, it->p99_waiting, it->context_switches, it->Utilisation() * 100.0);
+
+        output << line << std::endl;
+    }
+}
+
+// One result per line, like the output of vmbench
+
+static void WriteJson(std::ostream &output, const std::vector<Result> &results, const vm::Kernel::Options &options)
+{
+    output << "{" << std::endl;
+    output << "  \"options\": {\"timer\": " << options.timer_frequency
+           << ", \"cycle_limit\": " << options.cycle_limit
+           << ", \"arrivals\": " << options.arrivals.size() << "}," << std::endl;
+    output << "  \"results\": [" << std::endl;
+
+    for (std::vector<Result>::size_type i = 0; i < results.size(); ++i) {
+        const Result &result = results[i];
+
+        char numbers[256];
+        std::sprintf(numbers, "\"throughput\": %.6f, \"mean_turnaround\": %.1f, \"mean_waiting\": %.1f, \"utilisation\": %.4f",
+                     result.Throughput(), result.mean_turnaround, result.mean_waiting, result.Utilisation());
+
+        output << "    {\"scheduler\": \"" << result.setting.scheduler->name << "\""
+               << ", \"quantum\": " << result.setting.quantum
+               << ", \"completed\": " << result.completed
+               << ", \"cycles\": " << result.cycles
+               << ", \"idle_cycles\": " << result.idle_cycles
+               << ", \"p99_turnaround\": " << result.p99_turnaround
+               << ", \"p99_waiting\": " << result.p99_waiting
+               << ", \"context_switches\": " << result.context_switches
+               << ", " << numbers << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+
+    output << "  ]" << std::endl;
+    output << "}" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    vm::Kernel::Options options;
+    options.cycle_limit = DEFAULT_CYCLE_LIMIT;
+
+    vmsched::SyntheticParameters parameters;
+
+    std::string trace_path;
+    std::string save_path;
+    std::string output_path;
+
+    std::vector<std::string> scheduler_names;
+    std::vector<std::string> quanta;
+
+    unsigned int thread_count = std::thread::hardware_concurrency();
+
+    bool valid = true;
+    for (int i = 1; i < argc && valid; ++i) {
+        std::string argument(argv[i]);
+
+        if (HasPrefix(argument, TRACE_OPTION)) {
+            trace_path = argument.substr(std::strlen(TRACE_OPTION));
+        } else if (HasPrefix(argument, SAVE_OPTION)) {
+            save_path = argument.substr(std::strlen(SAVE_OPTION));
+        } else if (HasPrefix(argument, SEED_OPTION)) {
+            parameters.seed = std::atoi(argument.c_str() + std::strlen(SEED_OPTION));
+        } else if (HasPrefix(argument, PROCESSES_OPTION)) {
+            parameters.processes = std::atoi(argument.c_str() + std::strlen(PROCESSES_OPTION));
+        } else if (HasPrefix(argument, INTERARRIVAL_OPTION)) {
+            parameters.mean_interarrival = std::atoi(argument.c_str() + std::strlen(INTERARRIVAL_OPTION));
+        } else if (HasPrefix(argument, SCHEDULERS_OPTION)) {
+            valid = ParseList(argument.substr(std::strlen(SCHEDULERS_OPTION)), scheduler_names);
+        } else if (HasPrefix(argument, QUANTA_OPTION)) {
+            valid = ParseList(argument.substr(std::strlen(QUANTA_OPTION)), quanta);
+        } else if (HasPrefix(argument, TIMER_OPTION)) {
+            options.timer_frequency = std::atoi(argument.c_str() + std::strlen(TIMER_OPTION));
+        } else if (HasPrefix(argument, CYCLES_OPTION)) {
+            options.cycle_limit = std::strtoull(argument.c_str() + std::strlen(CYCLES_OPTION), NULL, 10);
+        } else if (HasPrefix(argument, THREADS_OPTION)) {
+            thread_count = std::atoi(argument.c_str() + std::strlen(THREADS_OPTION));
+        } else if (HasPrefix(argument, OUTPUT_OPTION)) {
+            output_path = argument.substr(std::strlen(OUTPUT_OPTION));
+        } else {
+            valid = false;
+        }
+    }
+
+    if (!valid) {
+        std::cerr << "The syntax of the command is incorrect." << std::endl <<
+                     " vmsched [/trace:<file> | /seed:<seed> /processes:<count> /interarrival:<cycles>] [/save:<file>]" << std::endl <<
+                     "         [/schedulers:<name>,...] [/quanta:<ticks>,...] [/timer:<cycles>] [/cycles:<limit>]" << std::endl <<
+                     "         [/threads:<count>] [/output:<file>]" << std::endl << std::endl;
+
+        return -1;
+    }
+
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+
+    // The trace
+
+    vmsched::trace_type trace;
+    if (trace_path.empty()) {
+        trace = vmsched::GenerateTrace(parameters);
+    } else if (!vmsched::ReadTrace(trace_path, trace)) {
+        return -1;
+    }
+
+    if (!save_path.empty()) {
+        std::ofstream save(save_path.c_str());
+        if (!save) {
+            std::cerr << "Failed to open " << save_path << "." << std::endl;
+
+            return -1;
+        }
+
+        vmsched::WriteTrace(save, trace);
+    }
+
+    if (!vmsched::BuildArrivals(trace, options.arrivals)) {
+        return -1;
+    }
+
+    // The sweep
+
+    if (scheduler_names.empty()) {
+        for (std::size_t i = 0; i < sizeof(SCHEDULERS) / sizeof(SCHEDULERS[0]); ++i) {
+            scheduler_names.push_back(SCHEDULERS[i].name);
+        }
+    }
+
+    if (quanta.empty()) {
+        ParseList(DEFAULT_QUANTA, quanta);
+    }
+
+    std::vector<Setting> settings;
+    for (std::vector<std::string>::const_iterator name = scheduler_names.begin(); name != scheduler_names.end(); ++name) {
+        const SchedulerName *scheduler = NULL;
+        for (std::size_t i = 0; i < sizeof(SCHEDULERS) / sizeof(SCHEDULERS[0]); ++i) {
+            if (*name == SCHEDULERS[i].name) {
+                scheduler = &SCHEDULERS[i];
+            }
+        }
+
+        if (scheduler == NULL) {
+            std::cerr << "Unknown scheduler " << *name << "." << std::endl;
+
+            return -1;
+        }
+
+        if (scheduler->scheduler != vm::Kernel::RoundRobin) {
+            Setting setting = { scheduler, vm::Kernel::DEFAULT_QUANTUM };
+            settings.push_back(setting);
+
+            continue;
+        }
+
+        for (std::vector<std::string>::const_iterator quantum = quanta.begin(); quantum != quanta.end(); ++quantum) {
+            Setting setting = { scheduler, static_cast<unsigned int>(std::atoi(quantum->c_str())) };
+            settings.push_back(setting);
+        }
+    }
+
+    std::cerr << "Replaying " << options.arrivals.size() << " arrivals under " << settings.size()
+              << " settings on " << std::min<std::size_t>(thread_count, settings.size()) << " threads." << std::endl;
+
+    NullBuffer null_buffer;
+    std::streambuf *log_buffer = std::cout.rdbuf(&null_buffer);
+
+    std::vector<Result> results;
+    RunAll(settings, options, thread_count, results);
+
+    std::cout.rdbuf(log_buffer);
+
+    WriteTable(std::cerr, results);
+
+    if (output_path.empty()) {
+        WriteJson(std::cout, results, options);
+    } else {
+        std::ofstream output(output_path.c_str());
+        if (!output) {
+            std::cerr << "Failed to open " << output_path << "." << std::endl;
+
+            return -1;
+        }
+
+        WriteJson(output, results, options);
+    }
+
+    return 0;
+}